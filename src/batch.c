@@ -0,0 +1,678 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_cache.h"
+#include "chip8_input_log.h"
+#include "chip8_lanes.h"
+#include "chip8_rom_store.h"
+#include "chip8_scheduler.h"
+#include "thread_pool.h"
+
+// Adds the aot engine, build with -DCHIP8_AOT=1 and link chip8_aot.c and the recompile output
+#ifndef CHIP8_AOT
+#define CHIP8_AOT 0
+#endif
+
+#if CHIP8_AOT
+#include "chip8_aot.h"
+#endif
+
+// Headless batch runner
+// Runs every job of a job list on a thread pool, without window, audio or frame pacing,
+// and reports the final display hash and register state of each instance.
+//
+// Job list format, one job per line ('#' starts a comment):
+//      <rom_file> <cycles> [instances] [input_log]
+// With an input log the recorded run is replayed: its seed and clock frequency are used,
+// and cycles may be 0 to run up to where the recording ended.
+
+#define BATCH_DEFAULT_CLOCK 700
+#define BATCH_MAX_LINE 1024
+
+typedef enum
+{
+    BATCH_ENGINE_SWITCH, // chip8_cycle
+    BATCH_ENGINE_CACHE,  // chip8_cache_run
+    BATCH_ENGINE_LANES,  // chip8_lanes_run, the instances of a job in groups of CHIP8_LANES
+    BATCH_ENGINE_VERIFY, // Lanes, checked against chip8_cycle lane by lane after every instruction
+    BATCH_ENGINE_AOT     // chip8_aot_run, chip8_cycle for ROMs that were not compiled in
+} BatchEngine;
+
+static const char *batch_engine_names[] = {"switch", "cache", "lanes", "verify", "aot"};
+
+typedef struct
+{
+    char rom[BATCH_MAX_LINE];
+    uint64_t cycles;
+    uint32_t instances;
+    char input_log[BATCH_MAX_LINE]; // Empty if none
+
+    // Shared image, NULL if the ROM could not be loaded
+    const Chip8RomEntry *rom_entry;
+} BatchJob;
+
+typedef struct
+{
+    const BatchJob *job;
+    uint32_t copy;
+    uint32_t clock_frequency;
+    uint64_t seed;
+    BatchEngine engine;
+
+    // Results
+    int error;
+    uint64_t display_hash;
+    Chip8 chip8;
+
+    // Verify engine only, cycle after which the lane first differed from chip8_cycle
+    int mismatch;
+    uint64_t mismatch_cycle;
+
+    // Replays run up to the end of the recording, checked against the recorded display hash
+    int replay_checked;
+    int replay_mismatch;
+} BatchInstance;
+
+// Input log being replayed, with its next event
+typedef struct
+{
+    Chip8InputReplay log;
+    int active;
+    int more;
+    uint64_t event_cycle;
+    uint16_t keys;
+} BatchReplay;
+
+// Consecutive instances of one job, run together by the lanes engine
+typedef struct
+{
+    BatchInstance *instances;
+    uint32_t count;
+} BatchGroup;
+
+static uint64_t batch_run_cache(Chip8 *chip8, void *engine, uint64_t cycles)
+{
+    return chip8_cache_run(chip8, engine, cycles);
+}
+
+#if CHIP8_AOT
+static uint64_t batch_run_aot(Chip8 *chip8, void *engine, uint64_t cycles)
+{
+    return chip8_aot_run(chip8, engine, cycles);
+}
+#endif
+
+// Loads the ROM and seeds the machine, from the input log if the job replays one
+static int batch_load_instance(BatchInstance *instance, BatchReplay *replay)
+{
+    Chip8 *chip8 = &instance->chip8;
+
+    replay->active = 0;
+    replay->more = 0;
+
+    if (instance->job->rom_entry == NULL)
+    {
+        instance->error = 1;
+        return 1;
+    }
+    chip8_rom_store_boot(instance->job->rom_entry, chip8);
+
+    if (instance->job->input_log[0] == '\0')
+    {
+        chip8_seed(chip8, instance->seed);
+        return 0;
+    }
+
+    if (chip8_input_replay_open(&replay->log, instance->job->input_log) != 0)
+    {
+        instance->error = 1;
+        return 1;
+    }
+    replay->active = 1;
+
+    // Recorded with another ROM
+    if (replay->log.rom_hash != chip8->rom_hash)
+    {
+        instance->error = 1;
+        return 1;
+    }
+
+    chip8_seed(chip8, replay->log.seed);
+    instance->clock_frequency = replay->log.clock_frequency;
+    replay->more = chip8_input_replay_next(&replay->log, &replay->event_cycle, &replay->keys) == 0;
+
+    return 0;
+}
+
+// Passes every recorded keypad change due by the machine's current cycle
+static void batch_replay_apply(BatchReplay *replay, Chip8 *chip8)
+{
+    while (replay->more && replay->event_cycle <= chip8->cycles)
+    {
+        chip8_set_keypad_mask(chip8, replay->keys);
+        replay->more = chip8_input_replay_next(&replay->log, &replay->event_cycle, &replay->keys) == 0;
+    }
+}
+
+// Where to run to next: the next recorded event, or the end of the run
+static uint64_t batch_replay_stop(const BatchReplay *replay, uint64_t end_cycle)
+{
+    return (replay->more && replay->event_cycle < end_cycle) ? replay->event_cycle : end_cycle;
+}
+
+static uint64_t batch_end_cycle(const BatchInstance *instance, const BatchReplay *replay)
+{
+    if (instance->job->cycles == 0 && replay->active)
+    {
+        return replay->log.end_cycle;
+    }
+
+    return instance->job->cycles;
+}
+
+static void batch_finish_instance(BatchInstance *instance, BatchReplay *replay)
+{
+    instance->display_hash = chip8_display_hash(instance->chip8.display);
+
+    if (replay->active)
+    {
+        if (replay->log.end_cycle != 0 && instance->chip8.cycles == replay->log.end_cycle)
+        {
+            instance->replay_checked = 1;
+            instance->replay_mismatch = instance->display_hash != replay->log.display_hash;
+        }
+        chip8_input_replay_close(&replay->log);
+    }
+}
+
+static void batch_run_instance(void *arg)
+{
+    BatchInstance *instance = arg;
+    Chip8 *chip8 = &instance->chip8;
+    BatchReplay replay;
+
+    if (batch_load_instance(instance, &replay) != 0)
+    {
+        if (replay.active)
+        {
+            chip8_input_replay_close(&replay.log);
+        }
+        return;
+    }
+
+    // Timers tick at 60 Hz of emulated time, idle loops are fast-forwarded to the next tick
+    Chip8Scheduler scheduler;
+    chip8_scheduler_init(&scheduler, instance->clock_frequency, 0);
+
+    Chip8Cache *cache = NULL;
+    if (instance->engine == BATCH_ENGINE_CACHE)
+    {
+        cache = malloc(sizeof(Chip8Cache));
+        if (cache == NULL)
+        {
+            instance->error = 1;
+            if (replay.active)
+            {
+                chip8_input_replay_close(&replay.log);
+            }
+            return;
+        }
+        // Starts with the ROM's code already decoded
+        memcpy(cache, &instance->job->rom_entry->cache, sizeof(Chip8Cache));
+
+        scheduler.run = batch_run_cache;
+        scheduler.engine = cache;
+    }
+
+#if CHIP8_AOT
+    Chip8Aot *aot = NULL;
+    const Chip8AotProgram *program = chip8_aot_find(chip8->rom_hash, chip8->quirks);
+    if (instance->engine == BATCH_ENGINE_AOT && program != NULL)
+    {
+        aot = malloc(sizeof(Chip8Aot));
+        if (aot == NULL)
+        {
+            instance->error = 1;
+            if (replay.active)
+            {
+                chip8_input_replay_close(&replay.log);
+            }
+            return;
+        }
+        chip8_aot_init(aot, program, chip8);
+
+        scheduler.run = batch_run_aot;
+        scheduler.engine = aot;
+    }
+#endif
+
+    uint64_t end_cycle = batch_end_cycle(instance, &replay);
+    for (;;)
+    {
+        batch_replay_apply(&replay, chip8);
+        if (chip8->cycles >= end_cycle)
+        {
+            break;
+        }
+        chip8_scheduler_run_cycles(&scheduler, chip8, batch_replay_stop(&replay, end_cycle) - chip8->cycles);
+    }
+
+    free(cache);
+#if CHIP8_AOT
+    free(aot);
+#endif
+
+    batch_finish_instance(instance, &replay);
+}
+
+// Everything chip8_cycle and the lanes engine must agree on
+static int batch_same_state(const Chip8 *a, const Chip8 *b)
+{
+    uint8_t depth = (uint8_t)(a->stack.top + 1);
+
+    return a->pc == b->pc && a->I == b->I && a->rng_state == b->rng_state && memcmp(a->V, b->V, sizeof(a->V)) == 0 &&
+           a->delay_timer == b->delay_timer && a->sound_timer == b->sound_timer &&
+           a->stack.top == b->stack.top && (depth > CHIP8_STACK_SIZE ||
+           memcmp(a->stack.arr, b->stack.arr, depth * sizeof(a->stack.arr[0])) == 0) &&
+           chip8_display_equal(a->display, b->display) && memcmp(a->memory, b->memory, sizeof(a->memory)) == 0;
+}
+
+// Runs one instruction in every lane and in the reference machines, and compares them
+static void batch_verify_step(Chip8Lanes *lanes, Chip8 reference[], BatchInstance *lane_instances[])
+{
+    chip8_lanes_run(lanes, 1);
+
+    for (uint32_t l = 0; l < lanes->count; l++)
+    {
+        BatchInstance *instance = lane_instances[l];
+        Chip8 *chip8 = lanes->machines[l];
+
+        chip8_cycle(&reference[l]);
+
+        if (!instance->mismatch && !batch_same_state(chip8, &reference[l]))
+        {
+            instance->mismatch = 1;
+            instance->mismatch_cycle = chip8->cycles;
+        }
+    }
+}
+
+static void batch_run_group(void *arg)
+{
+    BatchGroup *group = arg;
+    BatchInstance *lane_instances[CHIP8_LANES];
+    BatchReplay replays[CHIP8_LANES];
+    Chip8 *machines[CHIP8_LANES];
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < group->count; i++)
+    {
+        BatchInstance *instance = &group->instances[i];
+        if (batch_load_instance(instance, &replays[count]) == 0)
+        {
+            lane_instances[count] = instance;
+            machines[count] = &instance->chip8;
+            count++;
+        }
+        else if (replays[count].active)
+        {
+            chip8_input_replay_close(&replays[count].log);
+        }
+    }
+    if (count == 0)
+    {
+        return;
+    }
+
+    const BatchInstance *first = lane_instances[0];
+    int verify = first->engine == BATCH_ENGINE_VERIFY;
+
+    Chip8Lanes lanes;
+    chip8_lanes_init(&lanes, machines, count);
+
+    Chip8 *reference = NULL;
+    if (verify)
+    {
+        reference = malloc(count * sizeof(Chip8));
+        if (reference == NULL)
+        {
+            for (uint32_t l = 0; l < count; l++)
+            {
+                lane_instances[l]->error = 1;
+                if (replays[l].active)
+                {
+                    chip8_input_replay_close(&replays[l].log);
+                }
+            }
+            return;
+        }
+        for (uint32_t l = 0; l < count; l++)
+        {
+            reference[l] = *machines[l];
+        }
+    }
+
+    // Same timer boundaries as the scheduler in the other engines, without idle skipping
+    // All lanes replay the same log (if any), so the first lane's events stand for all
+    Chip8Scheduler scheduler;
+    chip8_scheduler_init(&scheduler, first->clock_frequency, 0);
+
+    uint64_t end_cycle = batch_end_cycle(first, &replays[0]);
+    for (;;)
+    {
+        for (uint32_t l = 0; l < count; l++)
+        {
+            batch_replay_apply(&replays[l], machines[l]);
+            if (verify)
+            {
+                reference[l].keypad = machines[l]->keypad;
+            }
+        }
+        if (machines[0]->cycles >= end_cycle)
+        {
+            break;
+        }
+
+        uint64_t until_tick = chip8_scheduler_cycles_to_tick(&scheduler);
+        uint64_t budget = batch_replay_stop(&replays[0], end_cycle) - machines[0]->cycles;
+        budget = budget < until_tick ? budget : until_tick;
+
+        if (verify)
+        {
+            for (uint64_t c = 0; c < budget; c++)
+            {
+                batch_verify_step(&lanes, reference, lane_instances);
+            }
+        }
+        else
+        {
+            chip8_lanes_run(&lanes, budget);
+        }
+
+        for (uint32_t ticks = chip8_scheduler_elapse(&scheduler, budget); ticks > 0; ticks--)
+        {
+            chip8_lanes_tick_timers(&lanes);
+            for (uint32_t l = 0; verify && l < count; l++)
+            {
+                chip8_tick_timers(&reference[l]);
+            }
+        }
+    }
+
+    for (uint32_t l = 0; l < count; l++)
+    {
+        chip8_lanes_store(&lanes, l);
+        batch_finish_instance(lane_instances[l], &replays[l]);
+    }
+
+    free(reference);
+}
+
+static int batch_read_jobs(const char *filename, BatchJob **jobs_out, uint32_t *num_jobs_out)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        return 1;
+    }
+
+    BatchJob *jobs = NULL;
+    uint32_t num_jobs = 0;
+    uint32_t capacity = 0;
+    char line[BATCH_MAX_LINE];
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        BatchJob job;
+        unsigned long long cycles;
+        unsigned instances = 1;
+
+        if (line[0] == '#')
+        {
+            continue;
+        }
+
+        job.input_log[0] = '\0';
+        int fields = sscanf(line, "%1023s %llu %u %1023s", job.rom, &cycles, &instances, job.input_log);
+        if (fields < 2)
+        {
+            continue;
+        }
+
+        job.cycles = cycles;
+        job.instances = instances;
+
+        if (num_jobs == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            BatchJob *grown = realloc(jobs, capacity * sizeof(BatchJob));
+            if (grown == NULL)
+            {
+                free(jobs);
+                fclose(file);
+                return 1;
+            }
+            jobs = grown;
+        }
+        jobs[num_jobs++] = job;
+    }
+
+    fclose(file);
+
+    *jobs_out = jobs;
+    *num_jobs_out = num_jobs;
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("Usage: chip8_batch <job_file> [-j threads] [-c clock frequency] [-e switch|cache|lanes|verify|aot] [-s seed] [-q quirks]\n");
+        return 1;
+    }
+
+    int num_threads = thread_pool_num_cores();
+    uint32_t clock_frequency = BATCH_DEFAULT_CLOCK;
+    BatchEngine engine = BATCH_ENGINE_SWITCH;
+    uint64_t seed = 0;
+    uint8_t quirks = 0;
+
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            num_threads = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-c") == 0)
+        {
+            clock_frequency = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            if (chip8_parse_quirks(argv[i + 1], &quirks) != 0)
+            {
+                printf("Error: Unknown quirks '%s'. Exiting...\n", argv[i + 1]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-e") == 0)
+        {
+            int found = 0;
+            for (int e = 0; e <= BATCH_ENGINE_AOT; e++)
+            {
+                if (strcmp(argv[i + 1], batch_engine_names[e]) == 0)
+                {
+                    engine = (BatchEngine)e;
+                    found = 1;
+                }
+            }
+            if (!found)
+            {
+                printf("Error: Unknown engine '%s'. Exiting...\n", argv[i + 1]);
+                return 1;
+            }
+        }
+    }
+
+#if !CHIP8_AOT
+    if (engine == BATCH_ENGINE_AOT)
+    {
+        printf("Error: Built without CHIP8_AOT, there is no aot engine. Exiting...\n");
+        return 1;
+    }
+#endif
+
+    BatchJob *jobs;
+    uint32_t num_jobs;
+    if (batch_read_jobs(argv[1], &jobs, &num_jobs) != 0)
+    {
+        printf("Error: Could not read job file '%s'. Exiting...\n", argv[1]);
+        return 1;
+    }
+
+    // Each distinct ROM is mapped and analysed once, however many jobs and instances use it
+    // ROMs without a .quirks file run with the -q profile
+    Chip8RomStore store;
+    chip8_rom_store_init(&store);
+
+    uint32_t num_instances = 0;
+    for (uint32_t i = 0; i < num_jobs; i++)
+    {
+        num_instances += jobs[i].instances;
+        jobs[i].rom_entry = chip8_rom_store_add(&store, jobs[i].rom, quirks);
+
+#if CHIP8_AOT
+        if (engine == BATCH_ENGINE_AOT && jobs[i].rom_entry != NULL &&
+            chip8_aot_find(jobs[i].rom_entry->rom.hash, jobs[i].rom_entry->quirks) == NULL)
+        {
+            printf("Warning: '%s' was not compiled in, it runs on the switch engine\n", jobs[i].rom);
+        }
+#endif
+    }
+
+    BatchInstance *instances = calloc(num_instances, sizeof(BatchInstance));
+    if (instances == NULL)
+    {
+        printf("Error: Out of memory. Exiting...\n");
+        return 1;
+    }
+
+    ThreadPool pool;
+    if (thread_pool_init(&pool, num_threads) != 0)
+    {
+        printf("Error: Could not start thread pool. Exiting...\n");
+        return 1;
+    }
+
+    // At most one group per CHIP8_LANES instances, plus one per job for the rest
+    BatchGroup *groups = calloc(num_instances / CHIP8_LANES + num_jobs + 1, sizeof(BatchGroup));
+    uint32_t num_groups = 0;
+    if (groups == NULL)
+    {
+        printf("Error: Out of memory. Exiting...\n");
+        return 1;
+    }
+
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < num_jobs; i++)
+    {
+        for (uint32_t copy = 0; copy < jobs[i].instances; copy++)
+        {
+            BatchInstance *instance = &instances[next++];
+            instance->job = &jobs[i];
+            instance->copy = copy;
+            instance->clock_frequency = clock_frequency;
+            instance->engine = engine;
+
+            // Copies of a job differ by seed only, the same seed gives the same run
+            instance->seed = seed + copy;
+
+            if (engine == BATCH_ENGINE_SWITCH || engine == BATCH_ENGINE_CACHE || engine == BATCH_ENGINE_AOT)
+            {
+                // Out of memory for the queue, run it on this thread instead
+                if (thread_pool_submit(&pool, batch_run_instance, instance) != 0)
+                {
+                    batch_run_instance(instance);
+                }
+            }
+            else if (copy % CHIP8_LANES == 0)
+            {
+                BatchGroup *group = &groups[num_groups++];
+                group->instances = instance;
+                group->count = jobs[i].instances - copy < CHIP8_LANES ? jobs[i].instances - copy : CHIP8_LANES;
+            }
+        }
+    }
+
+    // Groups only once all of their instances are filled in
+    for (uint32_t g = 0; g < num_groups; g++)
+    {
+        if (thread_pool_submit(&pool, batch_run_group, &groups[g]) != 0)
+        {
+            batch_run_group(&groups[g]);
+        }
+    }
+
+    thread_pool_wait(&pool);
+    thread_pool_destroy(&pool);
+
+    // Report in job order, one line per instance
+    int failed = 0;
+    for (uint32_t i = 0; i < num_instances; i++)
+    {
+        const BatchInstance *instance = &instances[i];
+        const Chip8 *chip8 = &instance->chip8;
+
+        if (instance->error)
+        {
+            printf("%s %u error\n", instance->job->rom, instance->copy);
+            failed = 1;
+            continue;
+        }
+
+        printf("%s %u hash=%016llX pc=%03X I=%03X V=",
+               instance->job->rom, instance->copy,
+               (unsigned long long)instance->display_hash, chip8->pc, chip8->I);
+        for (uint8_t r = 0; r < CHIP8_NUM_VAR_REGISTERS; r++)
+        {
+            printf("%02X", chip8->V[r]);
+        }
+        printf(" DT=%02X ST=%02X", chip8->delay_timer, chip8->sound_timer);
+
+        if (instance->engine == BATCH_ENGINE_VERIFY)
+        {
+            if (instance->mismatch)
+            {
+                printf(" verify=mismatch@%llu", (unsigned long long)instance->mismatch_cycle);
+                failed = 1;
+            }
+            else
+            {
+                printf(" verify=ok");
+            }
+        }
+
+        if (instance->replay_checked)
+        {
+            printf(instance->replay_mismatch ? " replay=mismatch" : " replay=ok");
+            failed |= instance->replay_mismatch;
+        }
+        printf("\n");
+    }
+
+    free(groups);
+    free(instances);
+    free(jobs);
+    chip8_rom_store_free(&store);
+
+    return failed;
+}
@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "chip8.h"
+#include "chip8_cache.h"
+#include "chip8_lanes.h"
+#include "host_clock.h"
+
+// Throughput benchmark for the interpreter core
+// Runs a fixed corpus of synthetic ROMs, each stressing one instruction class, through
+// the switch, cache and lanes engines and reports instructions per second, ns per instruction
+// and the spread over repeated runs. No raylib, no timers, no input.
+// The lanes engine runs CHIP8_LANES copies of the ROM in lockstep, its instructions are
+// counted over all lanes.
+
+#define BENCH_DEFAULT_CYCLES 10000000ULL
+#define BENCH_DEFAULT_RUNS 5
+
+typedef struct
+{
+    const char *name;
+    const char *description;
+    const uint8_t *rom;
+    uint16_t size;
+} BenchRom;
+
+// 8XYn arithmetic and logic in a tight loop
+static const uint8_t bench_rom_alu[] = {
+    0x60, 0x01, // 200 V0 = 01
+    0x61, 0x02, // 202 V1 = 02
+    0x80, 0x14, // 204 V0 += V1 (carry)
+    0x81, 0x05, // 206 V1 -= V0 (borrow)
+    0x82, 0x03, // 208 V2 ^= V0
+    0x83, 0x21, // 20A V3 |= V2
+    0x84, 0x32, // 20C V4 &= V3
+    0x85, 0x06, // 20E V5 >>= 1
+    0x86, 0x0E, // 210 V6 <<= 1
+    0x87, 0x17, // 212 V7 = V1 - V7
+    0x70, 0x03, // 214 V0 += 03
+    0x12, 0x04  // 216 Jump 204
+};
+
+// DXYN with full height sprites moving across (and off) the screen
+static const uint8_t bench_rom_draw[] = {
+    0xA0, 0x50, // 200 I = font 0
+    0x60, 0x00, // 202 V0 = 00
+    0x61, 0x00, // 204 V1 = 00
+    0xD0, 0x15, // 206 Draw 5 rows at (V0, V1)
+    0xD0, 0x1F, // 208 Draw 15 rows at (V0, V1)
+    0x70, 0x09, // 20A V0 += 09
+    0x71, 0x03, // 20C V1 += 03
+    0x12, 0x06  // 20E Jump 206
+};
+
+// Nested 2NNN/00EE chains
+static const uint8_t bench_rom_call[] = {
+    0x22, 0x10, // 200 Call 210
+    0x12, 0x00, // 202 Jump 200
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x22, 0x20, // 210 Call 220
+    0x00, 0xEE, // 212 Return
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x22, 0x30, // 220 Call 230
+    0x00, 0xEE, // 222 Return
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x70, 0x01, // 230 V0 += 01
+    0x00, 0xEE  // 232 Return
+};
+
+// FX55/FX65 storing and loading all 16 registers
+static const uint8_t bench_rom_memory[] = {
+    0xA3, 0x00, // 200 I = 300
+    0xFF, 0x55, // 202 Store V0..VF
+    0xFF, 0x65, // 204 Load V0..VF
+    0x70, 0x01, // 206 V0 += 01
+    0xF0, 0x1E, // 208 I += V0
+    0x12, 0x00  // 20A Jump 200
+};
+
+// FX33 binary-coded decimal conversion
+static const uint8_t bench_rom_bcd[] = {
+    0xA3, 0x00, // 200 I = 300
+    0xF0, 0x33, // 202 BCD of V0
+    0x70, 0x07, // 204 V0 += 07
+    0xF1, 0x33, // 206 BCD of V1
+    0x71, 0x0D, // 208 V1 += 0D
+    0x12, 0x02  // 20A Jump 202
+};
+
+static const BenchRom bench_roms[] = {
+    {"alu", "8XYn arithmetic and logic", bench_rom_alu, sizeof(bench_rom_alu)},
+    {"draw", "DXYN sprite drawing", bench_rom_draw, sizeof(bench_rom_draw)},
+    {"call", "2NNN/00EE call chains", bench_rom_call, sizeof(bench_rom_call)},
+    {"memory", "FX55/FX65 register store and load", bench_rom_memory, sizeof(bench_rom_memory)},
+    {"bcd", "FX33 binary-coded decimal", bench_rom_bcd, sizeof(bench_rom_bcd)},
+};
+
+#define BENCH_NUM_ROMS (sizeof(bench_roms) / sizeof(bench_roms[0]))
+
+typedef enum
+{
+    BENCH_ENGINE_SWITCH,
+    BENCH_ENGINE_CACHE,
+    BENCH_ENGINE_LANES,
+    BENCH_NUM_ENGINES
+} BenchEngine;
+
+static const char *bench_engine_names[BENCH_NUM_ENGINES] = {"switch", "cache", "lanes"};
+
+typedef struct
+{
+    double mips_mean;
+    double mips_stddev;
+    double mips_min;
+    double mips_max;
+    double ns_per_instruction;
+} BenchResult;
+
+// Machines of the lanes engine, too big for the stack
+static Chip8 bench_lane_machines[CHIP8_LANES];
+
+// Returns the host time in ns for one run of about `cycles` instructions, the exact number in `executed`
+static uint64_t bench_run_once(const BenchRom *bench, BenchEngine engine, uint64_t cycles, Chip8Cache *cache,
+                               uint64_t *executed)
+{
+    Chip8 chip8;
+    chip8_init(&chip8);
+    memcpy(&chip8.memory[CHIP8_PROGRAM_START], bench->rom, bench->size);
+    *executed = cycles;
+
+    if (engine == BENCH_ENGINE_LANES)
+    {
+        Chip8 *machines[CHIP8_LANES];
+        for (uint32_t l = 0; l < CHIP8_LANES; l++)
+        {
+            bench_lane_machines[l] = chip8;
+            machines[l] = &bench_lane_machines[l];
+        }
+
+        // The same total work as the other engines, spread over the lanes
+        uint64_t steps = cycles / CHIP8_LANES > 0 ? cycles / CHIP8_LANES : 1;
+        *executed = steps * CHIP8_LANES;
+
+        uint64_t start = host_clock_ns();
+        Chip8Lanes lanes;
+        chip8_lanes_init(&lanes, machines, CHIP8_LANES);
+        chip8_lanes_run(&lanes, steps);
+        for (uint32_t l = 0; l < CHIP8_LANES; l++)
+        {
+            chip8_lanes_store(&lanes, l);
+        }
+
+        return host_clock_ns() - start;
+    }
+
+    uint64_t start = host_clock_ns();
+
+    if (engine == BENCH_ENGINE_CACHE)
+    {
+        // Returns early after an idle loop, called again until all cycles ran
+        chip8_cache_reset(cache);
+        for (uint64_t done = 0; done < cycles;)
+        {
+            done += chip8_cache_run(&chip8, cache, cycles - done);
+        }
+    }
+    else
+    {
+        for (uint64_t i = 0; i < cycles; i++)
+        {
+            chip8_cycle(&chip8);
+        }
+    }
+
+    return host_clock_ns() - start;
+}
+
+static BenchResult bench_run(const BenchRom *bench, BenchEngine engine, uint64_t cycles, int runs, Chip8Cache *cache)
+{
+    BenchResult result = {0};
+    double sum = 0.0;
+    double sum_squares = 0.0;
+    uint64_t total_ns = 0;
+
+    uint64_t executed;
+    uint64_t total_executed = 0;
+
+    // One warm-up run, not counted
+    bench_run_once(bench, engine, cycles / 10, cache, &executed);
+
+    for (int r = 0; r < runs; r++)
+    {
+        uint64_t elapsed = bench_run_once(bench, engine, cycles, cache, &executed);
+        double mips = (double)executed / ((double)elapsed / 1e3);
+
+        sum += mips;
+        sum_squares += mips * mips;
+        total_ns += elapsed;
+        total_executed += executed;
+
+        if (r == 0 || mips < result.mips_min)
+            result.mips_min = mips;
+        if (r == 0 || mips > result.mips_max)
+            result.mips_max = mips;
+    }
+
+    result.mips_mean = sum / runs;
+    double variance = sum_squares / runs - result.mips_mean * result.mips_mean;
+    result.mips_stddev = variance > 0.0 ? sqrt(variance) : 0.0;
+    result.ns_per_instruction = (double)total_ns / (double)total_executed;
+
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t cycles = BENCH_DEFAULT_CYCLES;
+    int runs = BENCH_DEFAULT_RUNS;
+    int json = 0;
+    const char *filter = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--json") == 0)
+        {
+            json = 1;
+        }
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            cycles = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+        {
+            runs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+        {
+            filter = argv[++i];
+        }
+        else
+        {
+            printf("Usage: chip8_bench [-n cycles] [-r runs] [-b benchmark] [--json]\n");
+            return 1;
+        }
+    }
+
+    if (runs < 1 || cycles == 0)
+    {
+        printf("Error: Need at least one run of at least one cycle.\n");
+        return 1;
+    }
+
+    Chip8Cache *cache = malloc(sizeof(Chip8Cache));
+    if (cache == NULL)
+    {
+        printf("Error: Out of memory. Exiting...\n");
+        return 1;
+    }
+
+    if (json)
+    {
+        printf("{\n  \"cycles\": %llu,\n  \"runs\": %d,\n  \"results\": [", (unsigned long long)cycles, runs);
+    }
+    else
+    {
+        printf("%-8s %-8s %10s %10s %10s %10s %10s\n", "bench", "engine", "MIPS", "stddev", "min", "max", "ns/op");
+    }
+
+    int first = 1;
+    for (uint32_t b = 0; b < BENCH_NUM_ROMS; b++)
+    {
+        const BenchRom *bench = &bench_roms[b];
+        if (filter != NULL && strcmp(filter, bench->name) != 0)
+        {
+            continue;
+        }
+
+        for (int e = 0; e < BENCH_NUM_ENGINES; e++)
+        {
+            BenchResult result = bench_run(bench, (BenchEngine)e, cycles, runs, cache);
+
+            if (json)
+            {
+                printf("%s\n    {\"benchmark\": \"%s\", \"description\": \"%s\", \"engine\": \"%s\", "
+                       "\"mips_mean\": %.3f, \"mips_stddev\": %.3f, \"mips_min\": %.3f, \"mips_max\": %.3f, "
+                       "\"ns_per_instruction\": %.3f}",
+                       first ? "" : ",", bench->name, bench->description, bench_engine_names[e],
+                       result.mips_mean, result.mips_stddev, result.mips_min, result.mips_max,
+                       result.ns_per_instruction);
+            }
+            else
+            {
+                printf("%-8s %-8s %10.2f %10.2f %10.2f %10.2f %10.3f\n",
+                       bench->name, bench_engine_names[e], result.mips_mean, result.mips_stddev,
+                       result.mips_min, result.mips_max, result.ns_per_instruction);
+            }
+            fflush(stdout);
+            first = 0;
+        }
+    }
+
+    if (json)
+    {
+        printf("\n  ]\n}\n");
+    }
+
+    free(cache);
+
+    return 0;
+}
@@ -1,11 +1,20 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <time.h>
 #include <assert.h>
 #include <stdarg.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "chip8.h"
+#include "chip8_trace.h"
+
+#if CHIP8_PROFILE
+#include "chip8_profile.h"
+#include "host_clock.h"
+#endif
 
 /// ********************
 /// Chip8 functions    *
@@ -13,6 +22,13 @@
 
 #define CHIP8_UNKNOWN_OPCODE "Error: Unknown instruction encountered."
 
+// Compiles away with its arguments when CHIP8_DEBUG is off
+#if CHIP8_DEBUG
+#define CHIP8_DEBUG_PRINTF(...) chip8_debug_printf(__VA_ARGS__)
+#else
+#define CHIP8_DEBUG_PRINTF(...) ((void)0)
+#endif
+
 static const uint8_t chip8_fontset[80] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
     0x20, 0x60, 0x20, 0x20, 0x70, // 1
@@ -34,20 +50,15 @@ static const uint8_t chip8_fontset[80] = {
 
 void chip8_init(Chip8 *chip8)
 {
-    memset(chip8->memory, 0, sizeof(chip8->memory));
+    chip8_boot_memory(chip8->memory, NULL);
     memset(chip8->V, 0, sizeof(chip8->V));
     memset(chip8->display, 0, sizeof(chip8->display));
-    memset(chip8->keypad, 0, sizeof(chip8->keypad));
+    chip8->dirty_rows = 0xFFFFFFFF;
+    chip8->dirty_pages = 0xFFFF;
+    chip8->keypad = 0;
 
     stack_init(&chip8->stack);
 
-    // Load fontset into memory
-    for (uint16_t i = 0; i < 80; i++)
-    {
-        // Load at 0x50
-        chip8->memory[0x50 + i] = chip8_fontset[i];
-    }
-
     chip8->I = 0;
 
     // Program starts at 0x200
@@ -56,35 +67,60 @@ void chip8_init(Chip8 *chip8)
     chip8->delay_timer = 0;
     chip8->sound_timer = 0;
 
-    // Seed rand()
-    srand(time(NULL));
+    chip8->cycles = 0;
+    chip8->idle = CHIP8_IDLE_NONE;
+    chip8->idle_period = 0;
+    chip8->rom_hash = 0;
+    chip8->trace = NULL;
+    chip8->profile = NULL;
+
+    // Same numbers every run unless the host seeds it differently
+    chip8_seed(chip8, 0);
+
+    // Modern behavior unless the ROM's profile says otherwise
+    chip8_set_quirks(chip8, 0);
 }
+// Fails on read errors and on files that do not fit in memory after 0x200
 int chip8_load_rom(Chip8 *chip8, const char *filename)
 {
-    FILE *file = fopen(filename, "rb");
-    if (file == NULL)
+    Chip8Rom rom;
+    if (chip8_rom_read(&rom, filename) != 0)
     {
         return 1;
     }
 
-    // To read into memory position 0x200
-    // We grab the address of position 0x200 in our memory array
-    // chip8->memory[0x200] and *(chip8->memory + 0x200) are equivalent
-    // &chip8->memory[0x200] and chip8->memory + 0x200
-    // void* in C is a generic pointer type (we can pass in *uint8_t)
-    fread(&chip8->memory[0x200], 1, CHIP8_MEMORY_SIZE - 0x200, file);
-
-    fclose(file);
+    chip8_load_rom_image(chip8, &rom);
+    chip8_rom_free(&rom);
 
     return 0;
 }
 
-void chip8_pass_input(Chip8 *chip8, uint8_t input[])
+// Keypad as a bitmask, bit i = key i pressed
+uint16_t chip8_keypad_mask(const Chip8 *chip8)
 {
-    for (uint8_t i = 0; i < CHIP8_NUM_KEYS; i++)
-    {
-        chip8->keypad[i] = input[i];
-    }
+    return chip8->keypad;
+}
+
+void chip8_set_keypad_mask(Chip8 *chip8, uint16_t mask)
+{
+    chip8->keypad = mask;
+}
+
+// True while the machine sits on an FX0A with no key pressed, only a key event changes that
+int chip8_waiting_for_key(const Chip8 *chip8)
+{
+    uint16_t opcode = chip8_fetch(chip8->memory, chip8->pc);
+
+    return chip8->keypad == 0 && (opcode & 0xF0FF) == 0xF00A;
+}
+
+void chip8_tick_timers(Chip8 *chip8)
+{
+    // Called at 60 Hz by the host
+    if (chip8->delay_timer > 0)
+        chip8->delay_timer--;
+    if (chip8->sound_timer > 0)
+        chip8->sound_timer--;
 }
 
 void chip8_cycle(Chip8 *chip8)
@@ -108,449 +144,451 @@ void chip8_cycle(Chip8 *chip8)
     // op = chip8->memory[chip8->pc] << 8;
     // op = op | chip8->memory[chip8->pc + 1];
 
-    uint16_t opcode = chip8->memory[chip8->pc] << 8 | chip8->memory[chip8->pc + 1];
+    uint16_t address = chip8->pc;
+    uint16_t opcode = chip8_fetch(chip8->memory, address);
     chip8->pc += 2;
 
-    chip8_execute_opcode(chip8, opcode);
-}
-
-void chip8_execute_opcode(Chip8 *chip8, uint16_t opcode)
-{
-
-    // Instruction
-    // Nib1 Nib2 Nib3 Nib4
-    // 0000 0000 0000 0000
-
-    // X = Nib2, lookup VX
-    // Y = Nib3, lookup VY
-    // N = Nib4, a 4-bit number
-    // NN = Nib3 Nib4 (second byte), and 8-bit number
-    // NNN = Nib2 Nib3 Nib4, a 12-bit memory address
-
-    // Decode instruction
-    uint8_t instruction_category = (opcode >> 12) & 0xF;
-
-    // Nib2
-    uint8_t X = (opcode >> 8) & 0xF;
-
-    // Nib3
-    uint8_t Y = (opcode >> 4) & 0xF;
-
-    // Nib4
-    uint8_t N = opcode & 0xF;
-
-    // Second byte (Nib3 Nib4)
-    uint8_t NN = opcode & 0xFF;
+#if CHIP8_TRACE
+    // DXYN can draw at VF and then overwrite it, the trace keeps the value it drew with
+    uint8_t flag = chip8->V[0xF];
+#endif
 
-    // Nib2 Nib3 Nib4
-    uint16_t NNN = opcode & 0xFFF;
+    chip8->execute(chip8, opcode);
+    chip8->cycles++;
 
-    // Execute instruction
-    switch (instruction_category)
+#if CHIP8_TRACE
+    if (chip8->trace != NULL)
     {
-    case 0x0:
-
-        switch (opcode)
-        {
-
-        // 00E0 Clear screen
-        case 0x00E0:
-            memset(chip8->display, 0, sizeof(chip8->display));
+        chip8_trace_record(chip8->trace, chip8, address, opcode, flag);
+    }
+#endif
 
-            chip8_debug_printf(chip8, "00E0 Clear screen");
-            break;
+#if CHIP8_PROFILE
+    if (chip8->profile != NULL)
+    {
+        chip8_profile_count(chip8->profile, address, opcode);
+    }
+#endif
 
-        // 00EE Return from subroutine
-        case 0x00EE:
-            chip8->pc = stack_pop(&chip8->stack);
+    (void)address;
+}
 
-            chip8_debug_printf(chip8, "00EE Return (pop stack) - PC set to %X", chip8->pc);
-            break;
+// Seeds the CXNN generator, the same seed always gives the same numbers
+void chip8_seed(Chip8 *chip8, uint64_t seed)
+{
+    // splitmix64 spreads similar seeds (0, 1, 2, ...) apart
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+
+    // xorshift gets stuck at 0
+    chip8->rng_state = z != 0 ? z : 0x9E3779B97F4A7C15ULL;
+}
 
-        default:
-            printf(CHIP8_UNKNOWN_OPCODE);
-            break;
-        }
+// xorshift64*, the top byte of the scrambled output is the best one
+uint8_t chip8_random(Chip8 *chip8)
+{
+    uint64_t x = chip8->rng_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    chip8->rng_state = x;
 
-        break;
+    return (uint8_t)((x * 0x2545F4914F6CDD1DULL) >> 56);
+}
 
-    // 1NNN Jump
-    case 0x1:
-        chip8->pc = NNN;
+// Called after the backward jump at `address` has set the PC
+// Flags the loop it closes if nothing but a timer or key event can get the program out of it
+void chip8_detect_idle_loop(Chip8 *chip8, uint16_t address)
+{
+    uint16_t target = chip8->pc;
 
-        chip8_debug_printf(chip8, "1NNN 1%X Jump - PC set to %X", NNN, NNN);
-        break;
+    // 1NNN to itself
+    if (target == address)
+    {
+        chip8->idle = CHIP8_IDLE_HALT;
+        chip8->idle_period = 1;
+        return;
+    }
 
-    // 2NNN Jump to subroutine
-    case 0x2:
-        stack_push(&chip8->stack, chip8->pc);
-        chip8->pc = NNN;
+    // FX07, 3XNN/4XNN on the same X, jump back to the FX07
+    // The skip did not leave the loop, so it keeps going for as long as DT holds its value
+    if (address - target == 4 && address + 1 < CHIP8_MEMORY_SIZE)
+    {
+        uint16_t load = chip8_fetch(chip8->memory, target);
+        uint16_t skip = chip8_fetch(chip8->memory, target + 2);
 
-        chip8_debug_printf(chip8, "2NNN 2%X Subroutine (push stack) then PC set to %X", NNN, NNN);
-        break;
+        uint8_t X = (load >> 8) & 0xF;
 
-    // 3XNN Skip one instruction if VX == NN
-    case 0x3:
-        if (chip8->V[X] == NN)
+        // VX != DT means a tick came in after the FX07, the next iteration still changes VX
+        if ((load & 0xF0FF) == 0xF007 && ((skip >> 12) == 0x3 || (skip >> 12) == 0x4) &&
+            X == ((skip >> 8) & 0xF) && chip8->V[X] == chip8->delay_timer)
         {
-            chip8->pc += 2;
+            // A delay timer of 0 never changes again by itself
+            chip8->idle = chip8->delay_timer > 0 ? CHIP8_IDLE_TIMER : CHIP8_IDLE_HALT;
+            chip8->idle_period = 3;
         }
+    }
+}
 
-        chip8_debug_printf(chip8, "3XNN 3%X%X Skip one instruction if VX == NN", X, NN);
-        break;
+// Fast-forwards over whole iterations of the detected idle loop, at most max_cycles
+// The result is the same as executing them, only the instructions are not traced.
+// Returns the number of cycles skipped and clears chip8->idle.
+uint64_t chip8_skip_idle(Chip8 *chip8, uint64_t max_cycles)
+{
+    uint64_t skipped = 0;
+    if (chip8->idle != CHIP8_IDLE_NONE)
+    {
+        skipped = max_cycles / chip8->idle_period * chip8->idle_period;
+        chip8->cycles += skipped;
 
-    // 4XNN Skip one instruction if VX != NN
-    case 0x4:
-        if (chip8->V[X] != NN)
+#if CHIP8_PROFILE
+        // The PC sits on the first instruction of the loop, every one of them ran once per iteration
+        if (chip8->profile != NULL)
         {
-            chip8->pc += 2;
+            for (uint32_t i = 0; i < chip8->idle_period; i++)
+            {
+                uint16_t address = chip8->pc + 2 * i;
+                chip8_profile_count_repeated(chip8->profile, address, chip8_fetch(chip8->memory, address),
+                                             skipped / chip8->idle_period);
+            }
         }
+#endif
 
-        chip8_debug_printf(chip8, "4XNN 4%X%X Skip one instruction if VX != NN", X, NN);
-        break;
-
-    // 5XY0 Skip one instruction if VX == VY
-    case 0x5:
-        if (chip8->V[X] == chip8->V[Y])
-        {
-            chip8->pc += 2;
-        }
+        chip8->idle = CHIP8_IDLE_NONE;
+    }
 
-        chip8_debug_printf(chip8, "5XY0 5%X%X0 Skip one instruction if VX == VY", X, Y);
-        break;
+    return skipped;
+}
 
-    // 6XNN Set
-    case 0x6:
-        chip8->V[X] = NN;
+/// ********************
+/// Quirk profiles     *
+/// ********************
 
-        chip8_debug_printf(chip8, "6XNN 6%X%X Set VX to NN", X, NN);
-        break;
+// One switch interpreter per combination of quirks, indexed by the quirk bitmask
+#define CHIP8_EXECUTE_NAME chip8_execute_0
+#define CHIP8_EXECUTE_QUIRKS 0
+#include "chip8_execute.inc"
 
-    // 7XNN Add
-    case 0x7:
-        // CHIP8 expects overflow to happen, don't treat it
-        chip8->V[X] += NN;
+#define CHIP8_EXECUTE_NAME chip8_execute_1
+#define CHIP8_EXECUTE_QUIRKS 1
+#include "chip8_execute.inc"
 
-        chip8_debug_printf(chip8, "7XNN 7%X%X Add NN to VX", X, NN);
-        break;
+#define CHIP8_EXECUTE_NAME chip8_execute_2
+#define CHIP8_EXECUTE_QUIRKS 2
+#include "chip8_execute.inc"
 
-    case 0x8:
-        switch (N)
-        {
-        // 8XY0 Set
-        case 0x0:
-            chip8->V[X] = chip8->V[Y];
+#define CHIP8_EXECUTE_NAME chip8_execute_3
+#define CHIP8_EXECUTE_QUIRKS 3
+#include "chip8_execute.inc"
 
-            chip8_debug_printf(chip8, "8XY0 8%X%X0 Set VX = VY", X, Y);
-            break;
+#define CHIP8_EXECUTE_NAME chip8_execute_4
+#define CHIP8_EXECUTE_QUIRKS 4
+#include "chip8_execute.inc"
 
-        // 8XY1 OR
-        case 0x1:
-            chip8->V[X] |= chip8->V[Y];
+#define CHIP8_EXECUTE_NAME chip8_execute_5
+#define CHIP8_EXECUTE_QUIRKS 5
+#include "chip8_execute.inc"
 
-            chip8_debug_printf(chip8, "8XY1 8%X%X1 Set VX |= VY", X, Y);
-            break;
+#define CHIP8_EXECUTE_NAME chip8_execute_6
+#define CHIP8_EXECUTE_QUIRKS 6
+#include "chip8_execute.inc"
 
-        // 8XY2 AND
-        case 0x2:
-            chip8->V[X] &= chip8->V[Y];
+#define CHIP8_EXECUTE_NAME chip8_execute_7
+#define CHIP8_EXECUTE_QUIRKS 7
+#include "chip8_execute.inc"
 
-            chip8_debug_printf(chip8, "8XY2 8%X%X2 Set VX &= VY", X, Y);
-            break;
+#define CHIP8_EXECUTE_NAME chip8_execute_8
+#define CHIP8_EXECUTE_QUIRKS 8
+#include "chip8_execute.inc"
 
-        // 8XY3 XOR
-        case 0x3:
-            chip8->V[X] ^= chip8->V[Y];
+#define CHIP8_EXECUTE_NAME chip8_execute_9
+#define CHIP8_EXECUTE_QUIRKS 9
+#include "chip8_execute.inc"
 
-            chip8_debug_printf(chip8, "8XY3 8%X%X3 Set VX ^= VY", X, Y);
-            break;
+#define CHIP8_EXECUTE_NAME chip8_execute_10
+#define CHIP8_EXECUTE_QUIRKS 10
+#include "chip8_execute.inc"
 
-        // 8XY5 Add with carry
-        case 0x4:
-        {
-            uint16_t sum = chip8->V[X] + chip8->V[Y];
-            chip8->V[0xF] = (sum > 0xFF) ? 1 : 0;
-            chip8->V[X] = sum & 0xFF;
+#define CHIP8_EXECUTE_NAME chip8_execute_11
+#define CHIP8_EXECUTE_QUIRKS 11
+#include "chip8_execute.inc"
 
-            chip8_debug_printf(chip8, "8XY4 8%X%X4 Set VX = VX + VY with carry", X, Y);
-            break;
-        }
+#define CHIP8_EXECUTE_NAME chip8_execute_12
+#define CHIP8_EXECUTE_QUIRKS 12
+#include "chip8_execute.inc"
 
-        // 8XY5 Subtract with borrow (VX - VY)
-        case 0x5:
-            chip8->V[0xF] = (chip8->V[X] >= chip8->V[Y]) ? 1 : 0;
-            chip8->V[X] = chip8->V[X] - chip8->V[Y];
+#define CHIP8_EXECUTE_NAME chip8_execute_13
+#define CHIP8_EXECUTE_QUIRKS 13
+#include "chip8_execute.inc"
 
-            chip8_debug_printf(chip8, "8XY5 8%X%X5 Set VX = VX - VY with borrow", X, Y);
-            break;
+#define CHIP8_EXECUTE_NAME chip8_execute_14
+#define CHIP8_EXECUTE_QUIRKS 14
+#include "chip8_execute.inc"
 
-        // 8XY6 Shift right
-        case 0x6:
-            chip8->V[0xF] = chip8->V[X] & 0x1;
-            chip8->V[X] >>= 1;
+#define CHIP8_EXECUTE_NAME chip8_execute_15
+#define CHIP8_EXECUTE_QUIRKS 15
+#include "chip8_execute.inc"
 
-            chip8_debug_printf(chip8, "8XY6 8%X%X6 Set VX >>= 1", X, Y);
-            break;
+static const Chip8ExecuteFunction chip8_execute_profiles[CHIP8_NUM_QUIRK_PROFILES] = {
+    chip8_execute_0, chip8_execute_1, chip8_execute_2, chip8_execute_3,
+    chip8_execute_4, chip8_execute_5, chip8_execute_6, chip8_execute_7,
+    chip8_execute_8, chip8_execute_9, chip8_execute_10, chip8_execute_11,
+    chip8_execute_12, chip8_execute_13, chip8_execute_14, chip8_execute_15};
 
-        // 8XY7 Subtract with borrow (VY-VX)
-        case 0x7:
-            chip8->V[0xF] = (chip8->V[Y] >= chip8->V[X]) ? 1 : 0;
-            chip8->V[X] = chip8->V[Y] - chip8->V[X];
+// Profiles known by name, anything else is spelled out with the quirk names joined by '+'
+static const struct
+{
+    const char *name;
+    uint8_t quirks;
+} chip8_quirk_names[] = {
+    {"modern", 0},
+    {"cosmac", CHIP8_QUIRK_SHIFT_VY | CHIP8_QUIRK_INCREMENT_I},
+    {"schip", CHIP8_QUIRK_JUMP_VX},
+    {"xochip", CHIP8_QUIRK_SHIFT_VY | CHIP8_QUIRK_INCREMENT_I | CHIP8_QUIRK_WRAP},
+    {"shift_vy", CHIP8_QUIRK_SHIFT_VY},
+    {"jump_vx", CHIP8_QUIRK_JUMP_VX},
+    {"increment_i", CHIP8_QUIRK_INCREMENT_I},
+    {"wrap", CHIP8_QUIRK_WRAP},
+};
 
-            chip8_debug_printf(chip8, "8XY5 8%X%X5 Set VX = VY - VX with borrow", X, Y);
-            break;
+enum
+{
+    CHIP8_NUM_QUIRK_NAMES = sizeof(chip8_quirk_names) / sizeof(chip8_quirk_names[0]),
+    CHIP8_FIRST_QUIRK_FLAG_NAME = 4
+};
 
-        // 8XY6 Shift left
-        case 0xE:
-            chip8->V[0xF] = (chip8->V[X] >> 7) & 1;
-            chip8->V[X] <<= 1;
+// Selects the interpreter once, nothing is checked per instruction
+void chip8_set_quirks(Chip8 *chip8, uint8_t quirks)
+{
+    chip8->quirks = quirks & (CHIP8_NUM_QUIRK_PROFILES - 1);
+    chip8->execute = chip8_execute_profiles[chip8->quirks];
+}
 
-            chip8_debug_printf(chip8, "8XY6 8%X%X6 Set VX <<= 1", X, Y);
-            break;
+void chip8_execute_opcode(Chip8 *chip8, uint16_t opcode)
+{
+    chip8->execute(chip8, opcode);
+}
 
-        default:
-            printf(CHIP8_UNKNOWN_OPCODE);
-            break;
-        }
+// Profile and quirk names joined by '+', e.g. "cosmac" or "schip+wrap"
+// Returns 1 on an unknown name, quirks is left unchanged then
+int chip8_parse_quirks(const char *text, uint8_t *quirks)
+{
+    uint8_t result = 0;
 
-        break;
+    while (*text != '\0')
+    {
+        size_t length = strcspn(text, "+");
+        int found = 0;
 
-    // 9XY0 Skip one instruction if VX != VY
-    case 0x9:
-        if (chip8->V[X] != chip8->V[Y])
+        for (uint32_t i = 0; i < CHIP8_NUM_QUIRK_NAMES; i++)
         {
-            chip8->pc += 2;
+            if (strlen(chip8_quirk_names[i].name) == length && strncmp(text, chip8_quirk_names[i].name, length) == 0)
+            {
+                result |= chip8_quirk_names[i].quirks;
+                found = 1;
+            }
+        }
+        if (!found)
+        {
+            return 1;
         }
 
-        chip8_debug_printf(chip8, "9XY0 9%X%X0 Skip one instruction if VX != VY", X, Y);
-        break;
-
-    // ANNN Set index
-    case 0xA:
-        chip8->I = NNN;
-
-        chip8_debug_printf(chip8, "ANNN A%X Set I = NNN", NNN);
-        break;
-
-    // BNNN Jump to NNN + V0
-    case 0xB:
-        chip8->pc = NNN + chip8->V[0];
+        text += length;
+        if (*text == '+')
+        {
+            text++;
+        }
+    }
 
-        chip8_debug_printf(chip8, "BNNN B%X Jump NNN+V0 - PC set to %X", NNN, NNN + chip8->V[0]);
-        break;
+    *quirks = result;
+    return 0;
+}
 
-    // CXNN Random
-    case 0xC:
+void chip8_format_quirks(uint8_t quirks, char *text, uint32_t size)
+{
+    for (uint32_t i = 0; i < CHIP8_FIRST_QUIRK_FLAG_NAME; i++)
     {
-        uint8_t random_number = (uint8_t)(rand() % 256);
-        chip8->V[X] = random_number & NN;
-
-        chip8_debug_printf(chip8, "CXNN C%X%X Random - VX randomized", X, NN);
-        break;
+        if (chip8_quirk_names[i].quirks == quirks)
+        {
+            snprintf(text, size, "%s", chip8_quirk_names[i].name);
+            return;
+        }
     }
 
-    // DXYN Draw
-    case 0xD:
+    size_t used = 0;
+    text[0] = '\0';
+    for (uint32_t i = CHIP8_FIRST_QUIRK_FLAG_NAME; i < CHIP8_NUM_QUIRK_NAMES; i++)
     {
-        // x=64 should wrap to 0 as input
-        // we can use binary AND to "filter" the width and height, instead of modulo (which is slower)
-        // Example: 64 = 0b01000000, 64-1 = 0b00111111
-        // Since width can only be between 0b00000000 and 0b0011111111, we can mask the input using bin of 63
-        // This only works if width and height are powers of 2.
-        uint8_t x_coord = chip8->V[X] & (CHIP8_SCREEN_WIDTH - 1);
-        uint8_t y_coord = chip8->V[Y] & (CHIP8_SCREEN_HEIGHT - 1);
-
-        chip8_debug_printf(chip8, "DXYN D%X%X%X Draw %X sprite rows drawn at (%X, %X) from memory location %X", X, Y, N, N, x_coord, y_coord, chip8->I);
-
-        chip8->V[0xF] = 0;
-
-        for (uint8_t i = 0; i < N; i++)
+        if ((quirks & chip8_quirk_names[i].quirks) && used < size)
         {
-            if (y_coord >= CHIP8_SCREEN_HEIGHT)
-            {
-                break;
-            }
-
-            uint16_t memory_location = chip8->I + i;
-            uint8_t sprite_row = chip8->memory[memory_location];
-
-            // Skip empty sprite rows
-            if (sprite_row == 0)
-            {
-                y_coord++;
-                continue;
-            }
-
-            uint8_t curr_x_coord = x_coord;
-
-            // Current sprite row: 0b 0011 0010
-            for (int8_t j = 7; j >= 0; j--)
-            {
-                if (curr_x_coord >= CHIP8_SCREEN_WIDTH)
-                {
-                    break;
-                }
-
-                uint8_t sprite_row_pixel = (sprite_row >> j) & 1;
-
-                uint16_t linear_index = y_coord * CHIP8_SCREEN_WIDTH + curr_x_coord;
-                uint8_t screen_pixel = chip8->display[linear_index];
-
-                if (sprite_row_pixel)
-                {
-                    if (screen_pixel)
-                    {
-                        chip8->V[0xF] = 1;
-                    }
-                    // If sprite pixel is on, flip the screen pixel (using XOR with 1)
-                    chip8->display[linear_index] ^= 1;
-                }
-                curr_x_coord++;
-            }
-            y_coord++;
+            used += snprintf(text + used, size - used, "%s%s", used > 0 ? "+" : "", chip8_quirk_names[i].name);
         }
-
-        break;
     }
-    case 0xE:
-
-        switch (NN)
-        {
-        // EX9E Skip if key pressed
-        case 0x9E:
-            if (chip8->keypad[chip8->V[X]] == 1)
-            {
-                chip8->pc += 2;
-            }
-
-            chip8_debug_printf(chip8, "EX9E E%X9E Skip instruction if key VX is pressed", X);
-            break;
+}
 
-        // EXA1 Skip if key not pressed
-        case 0xA1:
-            if (chip8->keypad[chip8->V[X]] == 0)
-            {
-                chip8->pc += 2;
-            }
+// Reads the profile from <rom_file>.quirks, a single line like "cosmac"
+// Returns 1 if there is no such file or it names an unknown quirk
+int chip8_read_quirks_file(const char *rom_filename, uint8_t *quirks)
+{
+    char filename[1024];
+    snprintf(filename, sizeof(filename), "%s.quirks", rom_filename);
 
-            chip8_debug_printf(chip8, "EX9E E%X9E Skip instruction if key VX is not pressed", X);
-            break;
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        return 1;
+    }
 
-        default:
-            printf(CHIP8_UNKNOWN_OPCODE);
-            break;
-        }
+    char line[256];
+    int failed = fgets(line, sizeof(line), file) == NULL;
+    fclose(file);
+    if (failed)
+    {
+        return 1;
+    }
 
-        break;
+    line[strcspn(line, " \t\r\n")] = '\0';
+    return chip8_parse_quirks(line, quirks);
+}
 
-    case 0xF:
+/// ********************
+/// ROM functions      *
+/// ********************
 
-        switch (NN)
-        {
-        // FX07 Set VX to delay timer value
-        case 0x07:
-            chip8->V[X] = chip8->delay_timer;
+int chip8_rom_read(Chip8Rom *rom, const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+    {
+        return 1;
+    }
 
-            chip8_debug_printf(chip8, "FX07 F%X07 Set VX to delay timer value", X);
-            break;
+    rom->data = malloc(CHIP8_MAX_ROM_SIZE);
+    if (rom->data == NULL)
+    {
+        fclose(file);
+        return 1;
+    }
 
-        // FX15 Set delay timer
-        case 0x15:
-            chip8->delay_timer = chip8->V[X];
+    size_t size = fread(rom->data, 1, CHIP8_MAX_ROM_SIZE, file);
+    int failed = ferror(file) || fgetc(file) != EOF; // Or too big
+    fclose(file);
 
-            chip8_debug_printf(chip8, "FX15 F%X15 Set delay timer to VX", X);
-            break;
+    if (failed)
+    {
+        chip8_rom_free(rom);
+        return 1;
+    }
 
-        // FX18 Set sound timer
-        case 0x18:
-            chip8->sound_timer = chip8->V[X];
+    rom->size = (uint16_t)size;
+    rom->hash = chip8_rom_hash(rom->data, rom->size);
 
-            chip8_debug_printf(chip8, "FX18 F%X18 Set sound timmer to VX", X);
-            break;
+    return 0;
+}
 
-        // FX1E Add to index
-        case 0x1E:
-            chip8->I += chip8->V[X];
+void chip8_rom_free(Chip8Rom *rom)
+{
+    free(rom->data);
+    rom->data = NULL;
+    rom->size = 0;
+}
 
-            chip8_debug_printf(chip8, "FX1E F%X1E Set I += VX", X);
-            break;
+uint64_t chip8_rom_hash(const uint8_t *data, uint32_t size)
+{
+    // FNV-1a
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (uint32_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
 
-        // FX0A Get key
-        case 0x0A:
-            // Assume no key is pressed
-            // since we always do +2 after fetch, we need -2 to "block" execution of next instruction
-            chip8->pc -= 2;
+    return hash;
+}
 
-            // Check if a key is pressed
-            // Just take the first occurence of a pressed key (since multiple can be set to 1)
-            for (uint8_t i = 0; i < CHIP8_NUM_KEYS; i++)
-            {
-                if (chip8->keypad[i] == 1)
-                {
-                    chip8->V[X] = i;
-
-                    // If a key was pressed, set it back to the next instruction
-                    chip8->pc += 2;
-                    break;
-                }
-            }
+// Memory right after chip8_init and chip8_load_rom_image (rom can be NULL)
+void chip8_boot_memory(uint8_t memory[], const Chip8Rom *rom)
+{
+    memset(memory, 0, CHIP8_MEMORY_SIZE);
 
-            chip8_debug_printf(chip8, "FX0A F%X0A Set VX to key pressed (blocking)", X);
-            break;
+    // Load fontset into memory
+    for (uint16_t i = 0; i < 80; i++)
+    {
+        // Load at 0x50
+        memory[0x50 + i] = chip8_fontset[i];
+    }
 
-        // FX29 Font character
-        case 0x29:
-            // Font character memory location is 0x50 + vx * 5 (each character is 5 bytes)
-            chip8->I = 0x50 + chip8->V[X] * 5;
+    if (rom != NULL)
+    {
+        memcpy(&memory[CHIP8_PROGRAM_START], rom->data, rom->size);
+    }
+}
 
-            chip8_debug_printf(chip8, "FX29 F%X29 Set I to font character VX", X);
-            break;
+void chip8_load_rom_image(Chip8 *chip8, const Chip8Rom *rom)
+{
+    memcpy(&chip8->memory[CHIP8_PROGRAM_START], rom->data, rom->size);
+    chip8->rom_hash = rom->hash;
+}
 
-        // FX33 Binary-coded decimal conversion
-        case 0x33:
-        {
-            uint8_t operand = chip8->V[X];
-            chip8->memory[chip8->I + 2] = operand % 10;
-            operand /= 10;
-            chip8->memory[chip8->I + 1] = operand % 10;
-            operand /= 10;
-            chip8->memory[chip8->I + 0] = operand % 10;
-
-            chip8_debug_printf(chip8, "FX33 F%X33 Binary-coded decimal conversion of VX into memory at I", X);
-            break;
-        }
+/// ********************
+/// Display functions  *
+/// ********************
 
-        // FX55 Store V memory (from V regs to memory at I)
-        case 0x55:
-            for (uint8_t i = 0; i <= X; i++)
-            {
-                chip8->memory[chip8->I + i] = chip8->V[i];
-            }
+uint8_t chip8_get_pixel(const Chip8 *chip8, uint8_t x, uint8_t y)
+{
+    return (chip8->display[y] >> (CHIP8_SCREEN_WIDTH - 1 - x)) & 1;
+}
 
-            chip8_debug_printf(chip8, "FX55 F%X55 Store V0 through VX to memory at I", X);
-            break;
+// Hash of the packed display, identical on every platform and build
+uint64_t chip8_display_hash(const uint64_t display[])
+{
+    uint64_t hash = 0x9E3779B97F4A7C15ULL;
+    for (uint8_t y = 0; y < CHIP8_SCREEN_HEIGHT; y++)
+    {
+        hash ^= display[y];
+        hash *= 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
+    }
 
-        // FX65 Load V memory (loads from memory at I to V regs)
-        case 0x65:
-            for (uint8_t i = 0; i <= X; i++)
-            {
-                chip8->V[i] = chip8->memory[chip8->I + i];
-            }
+    return hash;
+}
 
-            chip8_debug_printf(chip8, "FX65 F%X65 Load V0 through VX from memory at I", X);
-            break;
+int chip8_display_equal(const uint64_t a[], const uint64_t b[])
+{
+#if defined(__SSE2__)
+    // Two rows per 128-bit compare, accumulate the differences and test once
+    __m128i diff = _mm_setzero_si128();
+    for (uint8_t y = 0; y < CHIP8_SCREEN_HEIGHT; y += 2)
+    {
+        __m128i rows_a = _mm_loadu_si128((const __m128i *)&a[y]);
+        __m128i rows_b = _mm_loadu_si128((const __m128i *)&b[y]);
+        diff = _mm_or_si128(diff, _mm_xor_si128(rows_a, rows_b));
+    }
 
-        default:
-            printf(CHIP8_UNKNOWN_OPCODE);
-            break;
-        }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) == 0xFFFF;
+#else
+    uint64_t diff = 0;
+    for (uint8_t y = 0; y < CHIP8_SCREEN_HEIGHT; y++)
+    {
+        diff |= a[y] ^ b[y];
+    }
 
-        break;
+    return diff == 0;
+#endif
+}
 
-    default:
-        printf(CHIP8_UNKNOWN_OPCODE);
-        break;
+void chip8_display_copy(uint64_t destination[], const uint64_t source[])
+{
+#if defined(__SSE2__)
+    for (uint8_t y = 0; y < CHIP8_SCREEN_HEIGHT; y += 2)
+    {
+        _mm_storeu_si128((__m128i *)&destination[y], _mm_loadu_si128((const __m128i *)&source[y]));
     }
+#else
+    memcpy(destination, source, CHIP8_SCREEN_HEIGHT * sizeof(uint64_t));
+#endif
 }
 
 void chip8_debug_printf(Chip8 *chip8, const char *format, ...)
@@ -567,6 +605,9 @@ void chip8_debug_printf(Chip8 *chip8, const char *format, ...)
         printf("|V%X %X", i, chip8->V[i]);
     }
     printf("|\n\n");
+#else
+    (void)chip8;
+    (void)format;
 #endif
 }
 
@@ -3,7 +3,21 @@
 
 #include <stdint.h>
 
-#define CHIP8_DEBUG 1
+// Can be overridden on the command line, e.g. -DCHIP8_DEBUG=1
+// Prints every executed instruction, use the trace ring buffer (chip8_trace.h) for anything but tiny runs
+#ifndef CHIP8_DEBUG
+#define CHIP8_DEBUG 0
+#endif
+
+// Compiles in the binary trace hook in chip8_cycle, -DCHIP8_TRACE=0 removes it completely
+#ifndef CHIP8_TRACE
+#define CHIP8_TRACE 1
+#endif
+
+// Compiles in the execution profiler hooks (chip8_profile.h), off by default, -DCHIP8_PROFILE=1 to enable
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE 0
+#endif
 
 enum
 {
@@ -12,16 +26,52 @@ enum
     CHIP8_NUM_VAR_REGISTERS = 16,
     CHIP8_SCREEN_WIDTH = 64,
     CHIP8_SCREEN_HEIGHT = 32,
-    CHIP8_NUM_KEYS = 16
+    CHIP8_NUM_KEYS = 16,
+    CHIP8_PROGRAM_START = 0x200,
+    CHIP8_MAX_ROM_SIZE = CHIP8_MEMORY_SIZE - CHIP8_PROGRAM_START
 };
 
+// What an idle loop detected by the core is waiting for
+typedef enum
+{
+    CHIP8_IDLE_NONE,
+    CHIP8_IDLE_TIMER, // FX07 + 3XNN/4XNN + jump back, polling the delay timer
+    CHIP8_IDLE_KEY,   // FX0A with no key pressed
+    CHIP8_IDLE_HALT   // Jump to self (or polling a delay timer that is already 0)
+} Chip8Idle;
+
+// Quirks, the behavior of ambiguous opcodes, none set is the modern behavior
+// A ROM runs with a profile of these, each combination has its own compiled interpreter
+enum
+{
+    CHIP8_QUIRK_SHIFT_VY = 1 << 0,    // 8XY6/8XYE shift VY into VX, instead of shifting VX
+    CHIP8_QUIRK_JUMP_VX = 1 << 1,     // BXNN jumps to XNN + VX, instead of BNNN to NNN + V0
+    CHIP8_QUIRK_INCREMENT_I = 1 << 2, // FX55/FX65 leave I = I + X + 1, instead of unchanged
+    CHIP8_QUIRK_WRAP = 1 << 3,        // DXYN wraps sprites around the edges, instead of clipping
+    CHIP8_NUM_QUIRK_PROFILES = 1 << 4
+};
+
+typedef struct Chip8Trace Chip8Trace;
+typedef struct Chip8Profile Chip8Profile;
+typedef struct Chip8 Chip8;
+
+typedef void (*Chip8ExecuteFunction)(Chip8 *chip8, uint16_t opcode);
+
 typedef struct
 {
     uint16_t arr[CHIP8_STACK_SIZE];
     uint8_t top;
 } Stack;
 
+// ROM image, kept around so save states can be delta-encoded against it
 typedef struct
+{
+    uint8_t *data;
+    uint16_t size;
+    uint64_t hash;
+} Chip8Rom;
+
+struct Chip8
 {
     // Main memory 4 kB
     uint8_t memory[CHIP8_MEMORY_SIZE];
@@ -42,22 +92,94 @@ typedef struct
     uint8_t delay_timer;
     uint8_t sound_timer;
 
-    // Display
-    uint8_t display[CHIP8_SCREEN_WIDTH * CHIP8_SCREEN_HEIGHT];
+    // Display, one bit per pixel, one row per word
+    // Pixel x of a row is bit (63 - x), so the leftmost pixel is the most significant bit
+    uint64_t display[CHIP8_SCREEN_HEIGHT];
+
+    // Rows changed by 00E0/DXYN since the host last cleared it (bit y = row y)
+    // Non-zero means the frame needs to be presented again
+    uint32_t dirty_rows;
+
+    // Memory pages of 256 bytes written by FX33/FX55 since the host last cleared it (bit p = page p)
+    uint16_t dirty_pages;
 
-    // Keypad
-    uint8_t keypad[CHIP8_NUM_KEYS];
+    // Keypad, bit i set while key i is pressed
+    uint16_t keypad;
 
-} Chip8;
+    // Number of executed instructions
+    uint64_t cycles;
+
+    // CXNN random number generator (xorshift64*), never 0, set with chip8_seed
+    uint64_t rng_state;
+
+    // Set by the core when it finishes an iteration of an idle loop, cleared by the host
+    // Until the awaited event, every further iteration of idle_period instructions leaves the
+    // machine exactly as it was, so the host may skip them (see chip8_skip_idle)
+    uint8_t idle;
+    uint8_t idle_period;
+
+    // Quirk profile and the interpreter compiled for it, set with chip8_set_quirks
+    uint8_t quirks;
+    Chip8ExecuteFunction execute;
+
+    // Hash of the loaded ROM image, 0 if none
+    uint64_t rom_hash;
+
+    // Binary trace ring buffer, NULL when tracing is off
+    Chip8Trace *trace;
+
+    // Execution profile, NULL when profiling is off (only used with CHIP8_PROFILE)
+    Chip8Profile *profile;
+
+};
+
+// Reads the opcode at `address`, every engine fetches through here
+// Both bytes wrap like the PC, so an instruction on the last byte of memory takes its low byte
+// from 0x000 instead of reading past the end. Inline, the lanes engine gathers with it every step.
+static inline uint16_t chip8_fetch(const uint8_t memory[], uint16_t address)
+{
+    return (uint16_t)(memory[address & (CHIP8_MEMORY_SIZE - 1)] << 8 |
+                      memory[(address + 1) & (CHIP8_MEMORY_SIZE - 1)]);
+}
 
 // Chip8
 void chip8_init(Chip8 *chip8);
 int chip8_load_rom(Chip8 *chip8, const char *filename);
 void chip8_cycle(Chip8 *chip8);
 void chip8_execute_opcode(Chip8 *chip8, uint16_t opcode);
-void chip8_pass_input(Chip8 *chip8, uint8_t input[]);
+uint16_t chip8_keypad_mask(const Chip8 *chip8);
+void chip8_set_keypad_mask(Chip8 *chip8, uint16_t mask);
+int chip8_waiting_for_key(const Chip8 *chip8);
+void chip8_tick_timers(Chip8 *chip8);
 void chip8_debug_printf(Chip8 *chip8, const char *format, ...);
 
+// Quirks
+void chip8_set_quirks(Chip8 *chip8, uint8_t quirks);
+int chip8_parse_quirks(const char *text, uint8_t *quirks);
+void chip8_format_quirks(uint8_t quirks, char *text, uint32_t size);
+int chip8_read_quirks_file(const char *rom_filename, uint8_t *quirks);
+
+// Random numbers
+void chip8_seed(Chip8 *chip8, uint64_t seed);
+uint8_t chip8_random(Chip8 *chip8);
+
+// Idle loops
+void chip8_detect_idle_loop(Chip8 *chip8, uint16_t address);
+uint64_t chip8_skip_idle(Chip8 *chip8, uint64_t max_cycles);
+
+// ROM
+int chip8_rom_read(Chip8Rom *rom, const char *filename);
+void chip8_rom_free(Chip8Rom *rom);
+uint64_t chip8_rom_hash(const uint8_t *data, uint32_t size);
+void chip8_boot_memory(uint8_t memory[], const Chip8Rom *rom);
+void chip8_load_rom_image(Chip8 *chip8, const Chip8Rom *rom);
+
+// Display
+uint8_t chip8_get_pixel(const Chip8 *chip8, uint8_t x, uint8_t y);
+uint64_t chip8_display_hash(const uint64_t display[]);
+int chip8_display_equal(const uint64_t a[], const uint64_t b[]);
+void chip8_display_copy(uint64_t destination[], const uint64_t source[]);
+
 // Stack
 void stack_init(Stack *stack);
 void stack_push(Stack *stack, uint16_t value);
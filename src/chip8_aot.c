@@ -0,0 +1,140 @@
+#include <string.h>
+
+#include "chip8_aot.h"
+
+#define AOT_PAGE_SIZE 256
+
+/// ********************
+/// Programs           *
+/// ********************
+
+// Returns the compiled program for this ROM and quirk profile, NULL if there is none
+const Chip8AotProgram *chip8_aot_find(uint64_t rom_hash, uint8_t quirks)
+{
+    for (uint32_t i = 0; i < chip8_aot_num_programs; i++)
+    {
+        if (chip8_aot_programs[i]->rom_hash == rom_hash && chip8_aot_programs[i]->quirks == quirks)
+        {
+            return chip8_aot_programs[i];
+        }
+    }
+
+    return NULL;
+}
+
+void chip8_aot_init(Chip8Aot *aot, const Chip8AotProgram *program, const Chip8 *chip8)
+{
+    aot->program = program;
+    chip8_aot_reset(aot, chip8);
+}
+
+// Enables exactly the blocks whose bytes in memory are still the compiled ones
+// Call after the machine's memory was replaced (save state, rewind)
+void chip8_aot_reset(Chip8Aot *aot, const Chip8 *chip8)
+{
+    const Chip8AotProgram *program = aot->program;
+
+    memset(aot->blocks, 0, sizeof(aot->blocks));
+    memset(aot->lengths, 0, sizeof(aot->lengths));
+    memset(aot->page_has_code, 0, sizeof(aot->page_has_code));
+
+    for (uint32_t i = 0; i < program->num_blocks; i++)
+    {
+        const Chip8AotBlockInfo *block = &program->blocks[i];
+        uint16_t size = 2 * block->length;
+
+        // A block wrapping past the end of memory is left to the interpreter
+        if (block->address + size <= CHIP8_MEMORY_SIZE &&
+            memcmp(&chip8->memory[block->address], &program->memory[block->address], size) == 0)
+        {
+            aot->blocks[block->address] = block->run;
+            aot->lengths[block->address] = block->length;
+            aot->page_has_code[block->address / AOT_PAGE_SIZE] = 1;
+        }
+    }
+}
+
+// Disables the blocks overlapping a write, they run through chip8_execute_opcode from now on
+void chip8_aot_invalidate(Chip8Aot *aot, uint16_t address, uint16_t length)
+{
+    uint32_t end = (uint32_t)address + length;
+    if (end > CHIP8_MEMORY_SIZE)
+    {
+        end = CHIP8_MEMORY_SIZE;
+    }
+
+    // A block's last instruction may reach one byte into the next page
+    uint32_t first_page = address > 0 ? (address - 1) / AOT_PAGE_SIZE : 0;
+    uint32_t last_page = (end - 1) / AOT_PAGE_SIZE;
+    int has_code = 0;
+    for (uint32_t page = first_page; page <= last_page && page < CHIP8_MEMORY_SIZE / AOT_PAGE_SIZE; page++)
+    {
+        has_code |= aot->page_has_code[page];
+    }
+    if (!has_code)
+    {
+        return;
+    }
+
+    const Chip8AotProgram *program = aot->program;
+    for (uint32_t i = 0; i < program->num_blocks; i++)
+    {
+        const Chip8AotBlockInfo *block = &program->blocks[i];
+        uint32_t block_end = block->address + 2 * block->length;
+
+        if (block->address < end && address < block_end)
+        {
+            aot->blocks[block->address] = NULL;
+            aot->lengths[block->address] = 0;
+        }
+    }
+}
+
+/// ********************
+/// Execution          *
+/// ********************
+
+// Runs up to `cycles` instructions, returns the number executed
+// Stops early right after an idle loop is detected, like chip8_cache_run.
+// A compiled block only runs if it fits in what is left, the rest goes one instruction
+// at a time so the count is exact.
+uint64_t chip8_aot_run(Chip8 *chip8, Chip8Aot *aot, uint64_t cycles)
+{
+    uint64_t remaining = cycles;
+
+    chip8->idle = CHIP8_IDLE_NONE;
+
+    while (remaining > 0 && chip8->idle == CHIP8_IDLE_NONE)
+    {
+        uint16_t pc = chip8->pc & (CHIP8_MEMORY_SIZE - 1);
+        Chip8AotBlock block = aot->blocks[pc];
+
+        if (block != NULL && aot->lengths[pc] <= remaining)
+        {
+            remaining -= aot->lengths[pc];
+            block(chip8, aot);
+            continue;
+        }
+
+        uint16_t opcode = chip8_fetch(chip8->memory, pc);
+        uint16_t address = chip8->I;
+        chip8->pc = pc + 2;
+        remaining--;
+
+        chip8_execute_opcode(chip8, opcode);
+
+        // FX33 writes 3 bytes, FX55 writes X + 1 bytes
+        if ((opcode & 0xF0FF) == 0xF033)
+        {
+            chip8_aot_invalidate(aot, address, 3);
+        }
+        else if ((opcode & 0xF0FF) == 0xF055)
+        {
+            chip8_aot_invalidate(aot, address, ((opcode >> 8) & 0xF) + 1);
+        }
+    }
+
+    chip8->cycles += cycles - remaining;
+
+    return cycles - remaining;
+}
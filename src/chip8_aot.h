@@ -0,0 +1,63 @@
+#ifndef CHIP8_AOT_H
+#define CHIP8_AOT_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+// Ahead-of-time compiled ROMs
+// The recompile tool turns every basic block reachable in a ROM into a C function, with the
+// operands baked in as constants, so running a block is one indirect call instead of one
+// dispatch per instruction. Blocks are the ones the cache engine finds (chip8_cache_prepare)
+// and the instructions mirror its handlers; everything it leaves to chip8_execute_opcode is
+// a call to chip8_execute_opcode here too.
+//
+// Code the compiler could not see runs one instruction at a time through chip8_execute_opcode:
+// BNNN targets, and any block whose bytes were overwritten (FX33/FX55 into code, or memory
+// restored from somewhere else, see chip8_aot_reset). Instructions run here are not traced.
+//
+// A program is only valid for the ROM (hash) and quirk profile it was compiled for.
+
+typedef struct Chip8Aot Chip8Aot;
+
+typedef void (*Chip8AotBlock)(Chip8 *chip8, Chip8Aot *aot);
+
+typedef struct
+{
+    uint16_t address;
+    uint8_t length; // Instructions
+    Chip8AotBlock run;
+} Chip8AotBlockInfo;
+
+typedef struct
+{
+    uint64_t rom_hash;
+    uint8_t quirks;
+
+    // Boot memory the blocks were compiled from
+    const uint8_t *memory;
+
+    const Chip8AotBlockInfo *blocks;
+    uint32_t num_blocks;
+} Chip8AotProgram;
+
+// Per machine, a compiled block runs while its bytes are the ones it was compiled from
+struct Chip8Aot
+{
+    const Chip8AotProgram *program;
+    Chip8AotBlock blocks[CHIP8_MEMORY_SIZE];
+    uint8_t lengths[CHIP8_MEMORY_SIZE];
+    uint8_t page_has_code[CHIP8_MEMORY_SIZE / 256];
+};
+
+// Emitted by the recompile tool, one entry per ROM it was given
+extern const Chip8AotProgram *const chip8_aot_programs[];
+extern const uint32_t chip8_aot_num_programs;
+
+const Chip8AotProgram *chip8_aot_find(uint64_t rom_hash, uint8_t quirks);
+void chip8_aot_init(Chip8Aot *aot, const Chip8AotProgram *program, const Chip8 *chip8);
+void chip8_aot_reset(Chip8Aot *aot, const Chip8 *chip8);
+void chip8_aot_invalidate(Chip8Aot *aot, uint16_t address, uint16_t length);
+uint64_t chip8_aot_run(Chip8 *chip8, Chip8Aot *aot, uint64_t cycles);
+
+#endif
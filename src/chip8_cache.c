@@ -0,0 +1,528 @@
+#include <string.h>
+
+#include "chip8_cache.h"
+
+/// ********************
+/// Cache functions    *
+/// ********************
+
+void chip8_cache_reset(Chip8Cache *cache)
+{
+    // CHIP8_OP_DECODE is 0, so every entry gets decoded again on first use
+    memset(cache->entries, 0, sizeof(cache->entries));
+    memset(cache->block_length, 0, sizeof(cache->block_length));
+    memset(cache->page_has_code, 0, sizeof(cache->page_has_code));
+    memset(cache->page_spills, 0, sizeof(cache->page_spills));
+}
+
+static void chip8_cache_invalidate_page(Chip8Cache *cache, uint32_t page)
+{
+    if (!cache->page_has_code[page])
+    {
+        return;
+    }
+
+    uint32_t page_start = page * CHIP8_CACHE_PAGE_SIZE;
+    memset(&cache->entries[page_start], 0, CHIP8_CACHE_PAGE_SIZE * sizeof(Chip8CacheEntry));
+    memset(&cache->block_length[page_start], 0, CHIP8_CACHE_PAGE_SIZE);
+    cache->page_has_code[page] = 0;
+    cache->page_spills[page] = 0;
+}
+
+void chip8_cache_invalidate(Chip8Cache *cache, uint16_t address, uint16_t length)
+{
+    uint32_t end = (uint32_t)address + length;
+    if (end > CHIP8_MEMORY_SIZE)
+    {
+        end = CHIP8_MEMORY_SIZE;
+    }
+
+    // Blocks stay within one page, dropping the touched pages drops every block covering the range
+    uint32_t first_page = address / CHIP8_CACHE_PAGE_SIZE;
+    uint32_t last_page = (end - 1) / CHIP8_CACHE_PAGE_SIZE;
+
+    for (uint32_t page = first_page; page <= last_page; page++)
+    {
+        chip8_cache_invalidate_page(cache, page);
+    }
+
+    // An instruction starting on the last byte of the previous page also covers the first written byte,
+    // the page before page 0 is the last one since fetches wrap
+    uint32_t previous_page = (first_page + CHIP8_CACHE_NUM_PAGES - 1) % CHIP8_CACHE_NUM_PAGES;
+    if (address % CHIP8_CACHE_PAGE_SIZE == 0 && cache->page_spills[previous_page])
+    {
+        chip8_cache_invalidate_page(cache, previous_page);
+    }
+}
+
+// The shifts only have a handler for the default behavior, with CHIP8_QUIRK_SHIFT_VY they fall back
+void chip8_cache_decode(Chip8CacheEntry *entry, uint16_t opcode, uint8_t quirks)
+{
+    // Same operand layout as chip8_execute_opcode
+    entry->opcode = opcode;
+    entry->x = (opcode >> 8) & 0xF;
+    entry->y = (opcode >> 4) & 0xF;
+    entry->nn = opcode & 0xFF;
+    entry->nnn = opcode & 0xFFF;
+    entry->handler = CHIP8_OP_FALLBACK;
+
+    switch ((opcode >> 12) & 0xF)
+    {
+    case 0x0:
+        if (opcode == 0x00EE)
+            entry->handler = CHIP8_OP_RET;
+        break;
+    case 0x1:
+        entry->handler = CHIP8_OP_JP;
+        break;
+    case 0x2:
+        entry->handler = CHIP8_OP_CALL;
+        break;
+    case 0x3:
+        entry->handler = CHIP8_OP_SE_VX_NN;
+        break;
+    case 0x4:
+        entry->handler = CHIP8_OP_SNE_VX_NN;
+        break;
+    case 0x5:
+        entry->handler = CHIP8_OP_SE_VX_VY;
+        break;
+    case 0x6:
+        entry->handler = CHIP8_OP_LD_VX_NN;
+        break;
+    case 0x7:
+        entry->handler = CHIP8_OP_ADD_VX_NN;
+        break;
+    case 0x8:
+        switch (opcode & 0xF)
+        {
+        case 0x0:
+            entry->handler = CHIP8_OP_LD_VX_VY;
+            break;
+        case 0x1:
+            entry->handler = CHIP8_OP_OR;
+            break;
+        case 0x2:
+            entry->handler = CHIP8_OP_AND;
+            break;
+        case 0x3:
+            entry->handler = CHIP8_OP_XOR;
+            break;
+        case 0x4:
+            entry->handler = CHIP8_OP_ADD_VX_VY;
+            break;
+        case 0x5:
+            entry->handler = CHIP8_OP_SUB;
+            break;
+        case 0x6:
+            entry->handler = (quirks & CHIP8_QUIRK_SHIFT_VY) ? CHIP8_OP_FALLBACK : CHIP8_OP_SHR;
+            break;
+        case 0x7:
+            entry->handler = CHIP8_OP_SUBN;
+            break;
+        case 0xE:
+            entry->handler = (quirks & CHIP8_QUIRK_SHIFT_VY) ? CHIP8_OP_FALLBACK : CHIP8_OP_SHL;
+            break;
+        }
+        break;
+    case 0x9:
+        entry->handler = CHIP8_OP_SNE_VX_VY;
+        break;
+    case 0xA:
+        entry->handler = CHIP8_OP_LD_I;
+        break;
+    case 0xB:
+    case 0xE:
+        entry->handler = CHIP8_OP_FALLBACK_BRANCH;
+        break;
+    case 0xF:
+        switch (opcode & 0xFF)
+        {
+        case 0x07:
+            entry->handler = CHIP8_OP_LD_VX_DT;
+            break;
+        case 0x15:
+            entry->handler = CHIP8_OP_LD_DT_VX;
+            break;
+        case 0x18:
+            entry->handler = CHIP8_OP_LD_ST_VX;
+            break;
+        case 0x1E:
+            entry->handler = CHIP8_OP_ADD_I;
+            break;
+        case 0x29:
+            entry->handler = CHIP8_OP_LD_F;
+            break;
+        case 0x0A:
+            entry->handler = CHIP8_OP_FALLBACK_BRANCH;
+            break;
+        case 0x33:
+        case 0x55:
+            entry->handler = CHIP8_OP_FALLBACK_WRITE;
+            break;
+        }
+        break;
+    }
+}
+
+
+static int chip8_cache_ends_block(uint8_t handler)
+{
+    switch (handler)
+    {
+    case CHIP8_OP_RET:
+    case CHIP8_OP_JP:
+    case CHIP8_OP_CALL:
+    case CHIP8_OP_SE_VX_NN:
+    case CHIP8_OP_SNE_VX_NN:
+    case CHIP8_OP_SE_VX_VY:
+    case CHIP8_OP_SNE_VX_VY:
+    case CHIP8_OP_FALLBACK_BRANCH:
+    case CHIP8_OP_FALLBACK_WRITE:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Decodes the block starting at pc and returns its length in instructions
+static uint8_t chip8_cache_build_block(const Chip8 *chip8, Chip8Cache *cache, uint16_t pc)
+{
+    // The last instruction of the last page takes its low byte from 0x000, see chip8_fetch
+    uint32_t page_end = (pc / CHIP8_CACHE_PAGE_SIZE + 1) * CHIP8_CACHE_PAGE_SIZE;
+
+    uint8_t length = 0;
+    uint32_t address = pc;
+    for (;;)
+    {
+        Chip8CacheEntry *entry = &cache->entries[address];
+        chip8_cache_decode(entry, chip8_fetch(chip8->memory, (uint16_t)address), chip8->quirks);
+        length++;
+
+        if (address + 1 == page_end)
+        {
+            cache->page_spills[pc / CHIP8_CACHE_PAGE_SIZE] = 1;
+        }
+
+        address += 2;
+
+        if (chip8_cache_ends_block(entry->handler) || address >= page_end || length == CHIP8_CACHE_MAX_BLOCK)
+        {
+            break;
+        }
+    }
+
+    cache->block_length[pc] = length;
+    cache->page_has_code[pc / CHIP8_CACHE_PAGE_SIZE] = 1;
+
+    return length;
+}
+
+// Builds every block reachable from `entry` by following jumps, calls, skips and fall-through
+// BNNN targets depend on V0 and are left to be built on first use. Returns the number of blocks.
+uint32_t chip8_cache_prepare(Chip8Cache *cache, const Chip8 *chip8, uint16_t entry)
+{
+    // At most 2 successors per block built
+    uint16_t pending[2 * CHIP8_MEMORY_SIZE + 1];
+    uint32_t count = 0;
+    uint32_t blocks = 0;
+
+    chip8_cache_reset(cache);
+    pending[count++] = entry;
+
+    while (count > 0)
+    {
+        uint16_t pc = pending[--count];
+        if (pc >= CHIP8_MEMORY_SIZE - 1 || cache->block_length[pc] != 0)
+        {
+            continue;
+        }
+
+        uint8_t length = chip8_cache_build_block(chip8, cache, pc);
+        blocks++;
+
+        const Chip8CacheEntry *last = &cache->entries[pc + 2 * (length - 1)];
+        uint16_t next = pc + 2 * length;
+
+        switch (last->handler)
+        {
+        case CHIP8_OP_RET:
+            break;
+
+        case CHIP8_OP_JP:
+            pending[count++] = last->nnn;
+            break;
+
+        // Returns to the instruction after the call
+        case CHIP8_OP_CALL:
+            pending[count++] = last->nnn;
+            pending[count++] = next;
+            break;
+
+        // Skips, EX9E/EXA1 and FX0A continue at the next instruction or the one after
+        case CHIP8_OP_SE_VX_NN:
+        case CHIP8_OP_SNE_VX_NN:
+        case CHIP8_OP_SE_VX_VY:
+        case CHIP8_OP_SNE_VX_VY:
+        case CHIP8_OP_FALLBACK_BRANCH:
+            pending[count++] = next;
+            pending[count++] = next + 2;
+            break;
+
+        // Memory writes, page ends and full blocks
+        default:
+            pending[count++] = next;
+            break;
+        }
+    }
+
+    return blocks;
+}
+
+// Runs up to `cycles` instructions, returns the number executed
+// Stops early right after an idle loop is detected, chip8->idle tells which one.
+// The handlers mirror chip8_execute_opcode, without the per-opcode debug output.
+// Only the last instruction of a block may read or change the PC, so the PC is set
+// past the executed part of the block up front.
+uint64_t chip8_cache_run(Chip8 *chip8, Chip8Cache *cache, uint64_t cycles)
+{
+    uint8_t *V = chip8->V;
+    uint64_t remaining = cycles;
+
+    chip8->idle = CHIP8_IDLE_NONE;
+    uint32_t left;
+    Chip8CacheEntry *e;
+
+    // Looks up (or builds) the block at PC and executes at most `remaining` of it
+#define ENTER_BLOCK()                                                       \
+    do                                                                      \
+    {                                                                       \
+        if (remaining == 0)                                                 \
+            goto done;                                                      \
+        uint16_t pc = chip8->pc & (CHIP8_MEMORY_SIZE - 1);                  \
+        left = cache->block_length[pc];                                     \
+        if (left == 0)                                                      \
+            left = chip8_cache_build_block(chip8, cache, pc);               \
+        if (left > remaining)                                               \
+            left = (uint32_t)remaining;                                     \
+        remaining -= left;                                                  \
+        e = &cache->entries[pc];                                            \
+        chip8->pc = pc + 2 * left;                                          \
+    } while (0)
+
+#if CHIP8_CACHE_COMPUTED_GOTO
+    // Must follow the order of Chip8CacheHandler
+    static const void *labels[CHIP8_OP_COUNT] = {
+        &&op_CHIP8_OP_DECODE, &&op_CHIP8_OP_RET, &&op_CHIP8_OP_JP, &&op_CHIP8_OP_CALL,
+        &&op_CHIP8_OP_SE_VX_NN, &&op_CHIP8_OP_SNE_VX_NN, &&op_CHIP8_OP_SE_VX_VY,
+        &&op_CHIP8_OP_LD_VX_NN, &&op_CHIP8_OP_ADD_VX_NN, &&op_CHIP8_OP_LD_VX_VY,
+        &&op_CHIP8_OP_OR, &&op_CHIP8_OP_AND, &&op_CHIP8_OP_XOR, &&op_CHIP8_OP_ADD_VX_VY,
+        &&op_CHIP8_OP_SUB, &&op_CHIP8_OP_SHR, &&op_CHIP8_OP_SUBN, &&op_CHIP8_OP_SHL,
+        &&op_CHIP8_OP_SNE_VX_VY, &&op_CHIP8_OP_LD_I, &&op_CHIP8_OP_LD_VX_DT,
+        &&op_CHIP8_OP_LD_DT_VX, &&op_CHIP8_OP_LD_ST_VX, &&op_CHIP8_OP_ADD_I,
+        &&op_CHIP8_OP_LD_F, &&op_CHIP8_OP_FALLBACK, &&op_CHIP8_OP_FALLBACK_BRANCH,
+        &&op_CHIP8_OP_FALLBACK_WRITE};
+
+#define TARGET(handler) op_##handler
+#define REDISPATCH() goto *labels[e->handler]
+#define DISPATCH()                     \
+    do                                 \
+    {                                  \
+        if (--left == 0)               \
+            goto next_block;           \
+        e += 2;                        \
+        goto *labels[e->handler];      \
+    } while (0)
+
+next_block:
+    ENTER_BLOCK();
+    goto *labels[e->handler];
+    {
+#else
+
+#define TARGET(handler) case handler
+#define REDISPATCH() goto redispatch
+#define DISPATCH()           \
+    if (--left == 0)         \
+        goto next_block;     \
+    e += 2;                  \
+    continue
+
+next_block:
+    ENTER_BLOCK();
+    for (;;)
+    {
+    redispatch:
+        switch (e->handler)
+        {
+#endif
+
+        TARGET(CHIP8_OP_DECODE):
+        {
+            // Only reached if an entry was invalidated under a running block
+            uint16_t pc = (uint16_t)(e - cache->entries);
+            chip8_cache_decode(e, chip8_fetch(chip8->memory, pc), chip8->quirks);
+            REDISPATCH();
+        }
+
+        TARGET(CHIP8_OP_RET):
+            chip8->pc = stack_pop(&chip8->stack);
+            DISPATCH();
+
+        TARGET(CHIP8_OP_JP):
+        {
+            // A jump always ends its block, so stopping here leaves the count in `remaining` exact
+            uint16_t address = (uint16_t)(e - cache->entries);
+            chip8->pc = e->nnn;
+            if (e->nnn <= address)
+            {
+                chip8_detect_idle_loop(chip8, address);
+                if (chip8->idle != CHIP8_IDLE_NONE)
+                    goto done;
+            }
+            DISPATCH();
+        }
+
+        TARGET(CHIP8_OP_CALL):
+            stack_push(&chip8->stack, chip8->pc);
+            chip8->pc = e->nnn;
+            DISPATCH();
+
+        TARGET(CHIP8_OP_SE_VX_NN):
+            if (V[e->x] == e->nn)
+                chip8->pc += 2;
+            DISPATCH();
+
+        TARGET(CHIP8_OP_SNE_VX_NN):
+            if (V[e->x] != e->nn)
+                chip8->pc += 2;
+            DISPATCH();
+
+        TARGET(CHIP8_OP_SE_VX_VY):
+            if (V[e->x] == V[e->y])
+                chip8->pc += 2;
+            DISPATCH();
+
+        TARGET(CHIP8_OP_LD_VX_NN):
+            V[e->x] = e->nn;
+            DISPATCH();
+
+        TARGET(CHIP8_OP_ADD_VX_NN):
+            V[e->x] += e->nn;
+            DISPATCH();
+
+        TARGET(CHIP8_OP_LD_VX_VY):
+            V[e->x] = V[e->y];
+            DISPATCH();
+
+        TARGET(CHIP8_OP_OR):
+            V[e->x] |= V[e->y];
+            DISPATCH();
+
+        TARGET(CHIP8_OP_AND):
+            V[e->x] &= V[e->y];
+            DISPATCH();
+
+        TARGET(CHIP8_OP_XOR):
+            V[e->x] ^= V[e->y];
+            DISPATCH();
+
+        TARGET(CHIP8_OP_ADD_VX_VY):
+        {
+            uint16_t sum = V[e->x] + V[e->y];
+            V[0xF] = (sum > 0xFF) ? 1 : 0;
+            V[e->x] = sum & 0xFF;
+            DISPATCH();
+        }
+
+        TARGET(CHIP8_OP_SUB):
+            V[0xF] = (V[e->x] >= V[e->y]) ? 1 : 0;
+            V[e->x] = V[e->x] - V[e->y];
+            DISPATCH();
+
+        TARGET(CHIP8_OP_SHR):
+            V[0xF] = V[e->x] & 0x1;
+            V[e->x] >>= 1;
+            DISPATCH();
+
+        TARGET(CHIP8_OP_SUBN):
+            V[0xF] = (V[e->y] >= V[e->x]) ? 1 : 0;
+            V[e->x] = V[e->y] - V[e->x];
+            DISPATCH();
+
+        TARGET(CHIP8_OP_SHL):
+            V[0xF] = (V[e->x] >> 7) & 1;
+            V[e->x] <<= 1;
+            DISPATCH();
+
+        TARGET(CHIP8_OP_SNE_VX_VY):
+            if (V[e->x] != V[e->y])
+                chip8->pc += 2;
+            DISPATCH();
+
+        TARGET(CHIP8_OP_LD_I):
+            chip8->I = e->nnn;
+            DISPATCH();
+
+        TARGET(CHIP8_OP_LD_VX_DT):
+            V[e->x] = chip8->delay_timer;
+            DISPATCH();
+
+        TARGET(CHIP8_OP_LD_DT_VX):
+            chip8->delay_timer = V[e->x];
+            DISPATCH();
+
+        TARGET(CHIP8_OP_LD_ST_VX):
+            chip8->sound_timer = V[e->x];
+            DISPATCH();
+
+        TARGET(CHIP8_OP_ADD_I):
+            chip8->I += V[e->x];
+            DISPATCH();
+
+        TARGET(CHIP8_OP_LD_F):
+            chip8->I = 0x50 + V[e->x] * 5;
+            DISPATCH();
+
+        TARGET(CHIP8_OP_FALLBACK):
+            chip8_execute_opcode(chip8, e->opcode);
+            DISPATCH();
+
+        TARGET(CHIP8_OP_FALLBACK_BRANCH):
+            // BNNN, EX9E/EXA1 and FX0A, which may be waiting for a key
+            chip8_execute_opcode(chip8, e->opcode);
+            if (chip8->idle != CHIP8_IDLE_NONE)
+                goto done;
+            DISPATCH();
+
+        TARGET(CHIP8_OP_FALLBACK_WRITE):
+        {
+            // FX33 writes 3 bytes, FX55 writes X + 1 bytes
+            uint16_t length = ((e->opcode & 0xFF) == 0x33) ? 3 : e->x + 1;
+            uint16_t address = chip8->I;
+
+            chip8_execute_opcode(chip8, e->opcode);
+            chip8_cache_invalidate(cache, address, length);
+            DISPATCH();
+        }
+
+#if !CHIP8_CACHE_COMPUTED_GOTO
+        default:
+            DISPATCH();
+        }
+    }
+#else
+    }
+#endif
+
+done:
+
+#undef ENTER_BLOCK
+#undef TARGET
+#undef REDISPATCH
+#undef DISPATCH
+
+    chip8->cycles += cycles - remaining;
+
+    return cycles - remaining;
+}
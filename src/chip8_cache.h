@@ -0,0 +1,95 @@
+#ifndef CHIP8_CACHE_H
+#define CHIP8_CACHE_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+// Pre-decoded instruction cache
+// Every 16-bit word is decoded once into a handler and its operands, indexed by PC.
+// Straight-line runs of entries are grouped into basic blocks, ending at the first
+// instruction that can change the PC (jumps, calls, returns, skips) or write memory.
+// A block is dispatched once and its instructions run back to back, with the PC
+// only updated at block entry.
+// Blocks never cross a page, so a write by FX33/FX55 invalidates the whole page(s)
+// it touches, which are decoded again on next use.
+// Instructions run here are not traced and print no CHIP8_DEBUG output.
+// Entries are decoded for the machine's quirk profile, a cache must not be shared between profiles.
+
+// Computed goto dispatch is used where the compiler supports it (GCC, Clang),
+// otherwise the engine falls back to a switch over the handler
+#if !defined(CHIP8_CACHE_COMPUTED_GOTO) && defined(__GNUC__)
+#define CHIP8_CACHE_COMPUTED_GOTO 1
+#endif
+
+typedef enum
+{
+    CHIP8_OP_DECODE = 0, // Not decoded yet (or invalidated)
+    CHIP8_OP_RET,
+    CHIP8_OP_JP,
+    CHIP8_OP_CALL,
+    CHIP8_OP_SE_VX_NN,
+    CHIP8_OP_SNE_VX_NN,
+    CHIP8_OP_SE_VX_VY,
+    CHIP8_OP_LD_VX_NN,
+    CHIP8_OP_ADD_VX_NN,
+    CHIP8_OP_LD_VX_VY,
+    CHIP8_OP_OR,
+    CHIP8_OP_AND,
+    CHIP8_OP_XOR,
+    CHIP8_OP_ADD_VX_VY,
+    CHIP8_OP_SUB,
+    CHIP8_OP_SHR,
+    CHIP8_OP_SUBN,
+    CHIP8_OP_SHL,
+    CHIP8_OP_SNE_VX_VY,
+    CHIP8_OP_LD_I,
+    CHIP8_OP_LD_VX_DT,
+    CHIP8_OP_LD_DT_VX,
+    CHIP8_OP_LD_ST_VX,
+    CHIP8_OP_ADD_I,
+    CHIP8_OP_LD_F,
+    CHIP8_OP_FALLBACK,        // Executed by chip8_execute_opcode
+    CHIP8_OP_FALLBACK_BRANCH, // BNNN/EX9E/EXA1/FX0A, executed by chip8_execute_opcode, may change the PC
+    CHIP8_OP_FALLBACK_WRITE,  // FX33/FX55, executed by chip8_execute_opcode then invalidates
+    CHIP8_OP_COUNT
+} Chip8CacheHandler;
+
+typedef struct
+{
+    uint8_t handler;
+    uint8_t x;
+    uint8_t y;
+    uint8_t nn;
+    uint16_t nnn;
+    uint16_t opcode;
+} Chip8CacheEntry;
+
+enum
+{
+    CHIP8_CACHE_PAGE_SIZE = 256,
+    CHIP8_CACHE_NUM_PAGES = CHIP8_MEMORY_SIZE / CHIP8_CACHE_PAGE_SIZE,
+    CHIP8_CACHE_MAX_BLOCK = 255
+};
+
+typedef struct
+{
+    Chip8CacheEntry entries[CHIP8_MEMORY_SIZE];
+
+    // Number of instructions in the block starting at each PC, 0 if not built yet
+    uint8_t block_length[CHIP8_MEMORY_SIZE];
+
+    // Set for pages holding decoded entries, writes to data-only pages invalidate nothing
+    uint8_t page_has_code[CHIP8_CACHE_NUM_PAGES];
+
+    // Set for pages whose last decoded instruction reaches into the next page
+    uint8_t page_spills[CHIP8_CACHE_NUM_PAGES];
+} Chip8Cache;
+
+void chip8_cache_reset(Chip8Cache *cache);
+void chip8_cache_invalidate(Chip8Cache *cache, uint16_t address, uint16_t length);
+void chip8_cache_decode(Chip8CacheEntry *entry, uint16_t opcode, uint8_t quirks);
+uint32_t chip8_cache_prepare(Chip8Cache *cache, const Chip8 *chip8, uint16_t entry);
+uint64_t chip8_cache_run(Chip8 *chip8, Chip8Cache *cache, uint64_t cycles);
+
+#endif
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_input_log.h"
+
+/// ********************
+/// Encoding           *
+/// ********************
+
+static void write_uint(uint8_t *out, uint64_t value, uint8_t num_bytes)
+{
+    for (uint8_t i = 0; i < num_bytes; i++)
+    {
+        out[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint64_t read_uint(const uint8_t *in, uint8_t num_bytes)
+{
+    uint64_t value = 0;
+    for (uint8_t i = 0; i < num_bytes; i++)
+    {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+
+    return value;
+}
+
+// 7 bits per byte, lowest first, high bit set on all but the last byte
+// Events a frame apart at 700 Hz take 2 bytes
+static uint8_t write_varint(uint8_t *out, uint64_t value)
+{
+    uint8_t length = 0;
+    while (value >= 0x80)
+    {
+        out[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out[length++] = (uint8_t)value;
+
+    return length;
+}
+
+/// ********************
+/// Recording          *
+/// ********************
+
+int chip8_input_log_open(Chip8InputLog *log, const char *filename, uint32_t clock_frequency, uint64_t rom_hash,
+                         uint64_t seed)
+{
+    log->file = fopen(filename, "wb");
+    if (log->file == NULL)
+    {
+        return 1;
+    }
+
+    uint8_t header[CHIP8_INPUT_LOG_HEADER_SIZE] = {0};
+    memcpy(header, CHIP8_INPUT_LOG_MAGIC, 4);
+    write_uint(header + 4, CHIP8_INPUT_LOG_VERSION, 2);
+    write_uint(header + 6, clock_frequency, 4);
+    write_uint(header + 10, rom_hash, 8);
+    write_uint(header + 18, seed, 8);
+    // End cycle and display hash are filled in on close
+
+    log->last_cycle = 0;
+    log->last_keys = 0;
+
+    return fwrite(header, 1, sizeof(header), log->file) != sizeof(header);
+}
+
+// Call whenever input is passed to the machine, only changes are written
+void chip8_input_log_record(Chip8InputLog *log, uint64_t cycle, uint16_t keys)
+{
+    if (log->file == NULL || keys == log->last_keys)
+    {
+        return;
+    }
+
+    uint8_t event[10 + 2];
+    uint8_t length = write_varint(event, cycle - log->last_cycle);
+    write_uint(event + length, keys, 2);
+    fwrite(event, 1, length + 2, log->file);
+
+    log->last_cycle = cycle;
+    log->last_keys = keys;
+}
+
+// Stores where the run ended and what was on screen, so a replay can check itself
+int chip8_input_log_close(Chip8InputLog *log, uint64_t end_cycle, uint64_t display_hash)
+{
+    if (log->file == NULL)
+    {
+        return 1;
+    }
+
+    uint8_t trailer[16];
+    write_uint(trailer, end_cycle, 8);
+    write_uint(trailer + 8, display_hash, 8);
+
+    // End cycle offset in the header
+    int failed = fseek(log->file, 26, SEEK_SET) != 0;
+    failed |= fwrite(trailer, 1, sizeof(trailer), log->file) != sizeof(trailer);
+    failed |= fclose(log->file) != 0;
+    log->file = NULL;
+
+    return failed;
+}
+
+/// ********************
+/// Replay             *
+/// ********************
+
+// Reads the whole log, logs are small
+int chip8_input_replay_open(Chip8InputReplay *replay, const char *filename)
+{
+    memset(replay, 0, sizeof(*replay));
+
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+    {
+        return 1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (size < CHIP8_INPUT_LOG_HEADER_SIZE)
+    {
+        fclose(file);
+        return 1;
+    }
+
+    replay->data = malloc(size);
+    if (replay->data == NULL || fread(replay->data, 1, size, file) != (size_t)size)
+    {
+        fclose(file);
+        chip8_input_replay_close(replay);
+        return 1;
+    }
+    fclose(file);
+
+    if (memcmp(replay->data, CHIP8_INPUT_LOG_MAGIC, 4) != 0 ||
+        read_uint(replay->data + 4, 2) != CHIP8_INPUT_LOG_VERSION)
+    {
+        chip8_input_replay_close(replay);
+        return 1;
+    }
+
+    replay->size = size;
+    replay->position = CHIP8_INPUT_LOG_HEADER_SIZE;
+    replay->clock_frequency = read_uint(replay->data + 6, 4);
+    replay->rom_hash = read_uint(replay->data + 10, 8);
+    replay->seed = read_uint(replay->data + 18, 8);
+    replay->end_cycle = read_uint(replay->data + 26, 8);
+    replay->display_hash = read_uint(replay->data + 34, 8);
+
+    return 0;
+}
+
+// Returns 0 and the next event, 1 at the end of the log (or a truncated event)
+int chip8_input_replay_next(Chip8InputReplay *replay, uint64_t *cycle, uint16_t *keys)
+{
+    uint64_t delta = 0;
+    uint8_t shift = 0;
+
+    for (;;)
+    {
+        if (replay->position >= replay->size || shift > 63)
+        {
+            return 1;
+        }
+
+        uint8_t byte = replay->data[replay->position++];
+        delta |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+
+        if (!(byte & 0x80))
+        {
+            break;
+        }
+    }
+
+    if (replay->position + 2 > replay->size)
+    {
+        return 1;
+    }
+
+    replay->cycle += delta;
+    *cycle = replay->cycle;
+    *keys = read_uint(replay->data + replay->position, 2);
+    replay->position += 2;
+
+    return 0;
+}
+
+void chip8_input_replay_close(Chip8InputReplay *replay)
+{
+    free(replay->data);
+    replay->data = NULL;
+}
@@ -0,0 +1,54 @@
+#ifndef CHIP8_INPUT_LOG_H
+#define CHIP8_INPUT_LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8.h"
+
+// Input logs
+// Records every keypad change with the cycle it took effect at. Together with the ROM, the
+// random seed and the clock frequency (which places the timer ticks) this is all a run
+// depends on, so replaying a log reproduces the run exactly, at any speed.
+//
+// Layout (little-endian):
+//      "C8IN" | u16 version | u32 clock frequency | u64 rom hash | u64 seed
+//      u64 end cycle | u64 display hash at the end cycle (both 0 if never closed)
+//      { varint cycles since the previous event | u16 keypad bitmask }*
+
+#define CHIP8_INPUT_LOG_MAGIC "C8IN"
+#define CHIP8_INPUT_LOG_VERSION 1
+#define CHIP8_INPUT_LOG_HEADER_SIZE 42
+
+typedef struct
+{
+    FILE *file;
+    uint64_t last_cycle;
+    uint16_t last_keys;
+} Chip8InputLog;
+
+typedef struct
+{
+    uint8_t *data;
+    size_t size;
+    size_t position;
+
+    uint32_t clock_frequency;
+    uint64_t rom_hash;
+    uint64_t seed;
+    uint64_t end_cycle;
+    uint64_t display_hash;
+
+    uint64_t cycle;
+} Chip8InputReplay;
+
+int chip8_input_log_open(Chip8InputLog *log, const char *filename, uint32_t clock_frequency, uint64_t rom_hash,
+                         uint64_t seed);
+void chip8_input_log_record(Chip8InputLog *log, uint64_t cycle, uint16_t keys);
+int chip8_input_log_close(Chip8InputLog *log, uint64_t end_cycle, uint64_t display_hash);
+
+int chip8_input_replay_open(Chip8InputReplay *replay, const char *filename);
+int chip8_input_replay_next(Chip8InputReplay *replay, uint64_t *cycle, uint16_t *keys);
+void chip8_input_replay_close(Chip8InputReplay *replay);
+
+#endif
@@ -0,0 +1,700 @@
+#include <string.h>
+
+#include "chip8_lanes.h"
+
+// Every lane loop below has a fixed trip count and no early exits, so it vectorizes.
+// Masked writes are written as selects, which compile to blends instead of branches.
+#define FOR_EACH_LANE(l) for (uint32_t l = 0; l < CHIP8_LANES; l++)
+
+/// ********************
+/// Lane functions     *
+/// ********************
+
+// Lanes past count stay inactive and are never executed
+// All machines must have the same quirk profile
+void chip8_lanes_init(Chip8Lanes *lanes, Chip8 *machines[], uint32_t count)
+{
+    memset(lanes, 0, sizeof(*lanes));
+    lanes->count = count < CHIP8_LANES ? count : CHIP8_LANES;
+    lanes->quirks = lanes->count > 0 ? machines[0]->quirks : 0;
+
+    for (uint32_t l = 0; l < lanes->count; l++)
+    {
+        lanes->machines[l] = machines[l];
+        lanes->active[l] = 0xFF;
+        chip8_lanes_load(lanes, l);
+    }
+}
+
+// Copies the registers of a lane's machine into the lane arrays
+void chip8_lanes_load(Chip8Lanes *lanes, uint32_t lane)
+{
+    const Chip8 *chip8 = lanes->machines[lane];
+
+    for (uint8_t r = 0; r < CHIP8_NUM_VAR_REGISTERS; r++)
+    {
+        lanes->V[r][lane] = chip8->V[r];
+    }
+    lanes->pc[lane] = chip8->pc;
+    lanes->I[lane] = chip8->I;
+
+    // Only the live entries, the rest of the stack is never read
+    lanes->stack_top[lane] = chip8->stack.top;
+    for (uint32_t d = 0; d < (uint8_t)(chip8->stack.top + 1) && d < CHIP8_STACK_SIZE; d++)
+    {
+        lanes->stack[d][lane] = chip8->stack.arr[d];
+    }
+
+    lanes->delay_timer[lane] = chip8->delay_timer;
+    lanes->sound_timer[lane] = chip8->sound_timer;
+}
+
+// Copies the registers of a lane back into its machine
+void chip8_lanes_store(Chip8Lanes *lanes, uint32_t lane)
+{
+    Chip8 *chip8 = lanes->machines[lane];
+
+    for (uint8_t r = 0; r < CHIP8_NUM_VAR_REGISTERS; r++)
+    {
+        chip8->V[r] = lanes->V[r][lane];
+    }
+    chip8->pc = lanes->pc[lane];
+    chip8->I = lanes->I[lane];
+
+    chip8->stack.top = lanes->stack_top[lane];
+    for (uint32_t d = 0; d < (uint8_t)(chip8->stack.top + 1) && d < CHIP8_STACK_SIZE; d++)
+    {
+        chip8->stack.arr[d] = lanes->stack[d][lane];
+    }
+
+    chip8->delay_timer = lanes->delay_timer[lane];
+    chip8->sound_timer = lanes->sound_timer[lane];
+}
+
+// Lanes with their mask set run the opcode through chip8_execute_opcode, with every register synced
+static void lanes_fallback(Chip8Lanes *lanes, uint16_t opcode, const uint8_t mask[])
+{
+    for (uint32_t l = 0; l < lanes->count; l++)
+    {
+        if (mask[l])
+        {
+            chip8_lanes_store(lanes, l);
+            chip8_execute_opcode(lanes->machines[l], opcode);
+            chip8_lanes_load(lanes, l);
+        }
+    }
+}
+
+// DXYN, the display is per machine, the drawing as in chip8_execute_opcode
+static void lanes_draw(Chip8Lanes *lanes, uint16_t opcode, const uint8_t mask[])
+{
+    uint8_t X = (opcode >> 8) & 0xF;
+    uint8_t Y = (opcode >> 4) & 0xF;
+    uint8_t N = opcode & 0xF;
+    int wrap = (lanes->quirks & CHIP8_QUIRK_WRAP) != 0;
+
+    for (uint32_t l = 0; l < lanes->count; l++)
+    {
+        if (!mask[l])
+        {
+            continue;
+        }
+
+        Chip8 *chip8 = lanes->machines[l];
+        uint8_t x_coord = lanes->V[X][l] & (CHIP8_SCREEN_WIDTH - 1);
+        uint8_t y_coord = lanes->V[Y][l] & (CHIP8_SCREEN_HEIGHT - 1);
+        uint16_t index = lanes->I[l];
+        uint64_t collision = 0;
+
+        for (uint8_t i = 0; i < N; i++)
+        {
+            if (wrap)
+            {
+                y_coord &= CHIP8_SCREEN_HEIGHT - 1;
+            }
+            else if (y_coord >= CHIP8_SCREEN_HEIGHT)
+            {
+                break;
+            }
+
+            uint16_t memory_location = index + i;
+            uint64_t sprite_row = (uint64_t)chip8->memory[memory_location] << 56;
+            uint64_t sprite = sprite_row >> x_coord;
+            if (wrap && x_coord > 0)
+            {
+                sprite |= sprite_row << (CHIP8_SCREEN_WIDTH - x_coord);
+            }
+
+            collision |= chip8->display[y_coord] & sprite;
+            chip8->display[y_coord] ^= sprite;
+            chip8->dirty_rows |= (uint32_t)(sprite != 0) << y_coord;
+
+            y_coord++;
+        }
+
+        lanes->V[0xF][l] = collision != 0;
+    }
+}
+
+// Stack depth shared by every lane of the mask, or -1 if they differ
+// Lanes that called together return together, so this is the common case.
+static int lanes_stack_depth(const Chip8Lanes *lanes, const uint8_t mask[])
+{
+    uint8_t lowest = 0xFF;
+    uint8_t highest = 0;
+
+    FOR_EACH_LANE(l)
+    {
+        uint8_t top = mask[l] ? lanes->stack_top[l] : lowest;
+        lowest = top < lowest ? top : lowest;
+        top = mask[l] ? lanes->stack_top[l] : highest;
+        highest = top > highest ? top : highest;
+    }
+
+    return lowest == highest ? lowest : -1;
+}
+
+// True if a push (or pop) would overflow (or underflow) the stack in any lane of the mask
+// Those lanes are left to chip8_execute_opcode, so they fail the way the interpreter does.
+static int lanes_stack_fault(const Chip8Lanes *lanes, const uint8_t mask[], int push)
+{
+    uint8_t fault = 0;
+
+    FOR_EACH_LANE(l)
+    {
+        uint8_t top = lanes->stack_top[l];
+        fault |= mask[l] & (push ? (uint8_t)(top + 1) >= CHIP8_STACK_SIZE : top == 0xFF);
+    }
+
+    return fault != 0;
+}
+
+// 2NNN, pushes the return address of every lane of the mask
+static void lanes_call(Chip8Lanes *lanes, uint16_t NNN, const uint8_t mask[])
+{
+    uint16_t *pc = lanes->pc;
+    uint8_t *stack_top = lanes->stack_top;
+    int depth = lanes_stack_depth(lanes, mask);
+
+    if (depth >= 0)
+    {
+        uint16_t *row = lanes->stack[(uint8_t)(depth + 1)];
+        FOR_EACH_LANE(l)
+        {
+            row[l] = mask[l] ? pc[l] : row[l];
+            stack_top[l] = mask[l] ? (uint8_t)(depth + 1) : stack_top[l];
+        }
+    }
+    else
+    {
+        for (uint32_t l = 0; l < lanes->count; l++)
+        {
+            if (mask[l])
+            {
+                stack_top[l]++;
+                lanes->stack[stack_top[l]][l] = pc[l];
+            }
+        }
+    }
+
+    FOR_EACH_LANE(l)
+    {
+        pc[l] = mask[l] ? NNN : pc[l];
+    }
+}
+
+// 00EE, pops the return address of every lane of the mask
+static void lanes_return(Chip8Lanes *lanes, const uint8_t mask[])
+{
+    uint16_t *pc = lanes->pc;
+    uint8_t *stack_top = lanes->stack_top;
+    int depth = lanes_stack_depth(lanes, mask);
+
+    if (depth >= 0)
+    {
+        const uint16_t *row = lanes->stack[depth];
+        FOR_EACH_LANE(l)
+        {
+            pc[l] = mask[l] ? row[l] : pc[l];
+            stack_top[l] = mask[l] ? (uint8_t)(depth - 1) : stack_top[l];
+        }
+    }
+    else
+    {
+        for (uint32_t l = 0; l < lanes->count; l++)
+        {
+            if (mask[l])
+            {
+                pc[l] = lanes->stack[stack_top[l]][l];
+                stack_top[l]--;
+            }
+        }
+    }
+}
+
+// VF is written before VX, like in chip8_execute_opcode, so with X = F the result wins
+static void lanes_set_flag(Chip8Lanes *lanes, const uint8_t flag[], const uint8_t mask[])
+{
+    uint8_t *VF = lanes->V[0xF];
+
+    FOR_EACH_LANE(l)
+    {
+        VF[l] = mask[l] ? flag[l] : VF[l];
+    }
+}
+
+// Executes one opcode in every lane of the mask
+// Mirrors chip8_execute_opcode for the instructions it handles itself.
+static void lanes_execute(Chip8Lanes *lanes, uint16_t opcode, const uint8_t mask[])
+{
+    uint8_t X = (opcode >> 8) & 0xF;
+    uint8_t Y = (opcode >> 4) & 0xF;
+    uint8_t N = opcode & 0xF;
+    uint8_t NN = opcode & 0xFF;
+    uint16_t NNN = opcode & 0xFFF;
+
+    uint8_t *VX = lanes->V[X];
+    uint8_t *VY = lanes->V[Y];
+    uint16_t *pc = lanes->pc;
+    uint8_t flag[CHIP8_LANES];
+    uint8_t result[CHIP8_LANES];
+
+    switch (opcode >> 12)
+    {
+    case 0x0:
+        // 00E0 Clear screen
+        if (opcode == 0x00E0)
+        {
+            for (uint32_t l = 0; l < lanes->count; l++)
+            {
+                if (mask[l])
+                {
+                    memset(lanes->machines[l]->display, 0, sizeof(lanes->machines[l]->display));
+                    lanes->machines[l]->dirty_rows = 0xFFFFFFFF;
+                }
+            }
+            return;
+        }
+
+        // 00EE Return
+        if (opcode == 0x00EE && !lanes_stack_fault(lanes, mask, 0))
+        {
+            lanes_return(lanes, mask);
+            return;
+        }
+        break;
+
+    // 1NNN Jump
+    case 0x1:
+        FOR_EACH_LANE(l)
+        {
+            pc[l] = mask[l] ? NNN : pc[l];
+        }
+        return;
+
+    // 2NNN Call
+    case 0x2:
+        if (lanes_stack_fault(lanes, mask, 1))
+        {
+            break;
+        }
+        lanes_call(lanes, NNN, mask);
+        return;
+
+    // 3XNN 4XNN 5XY0 9XY0 Skips
+    case 0x3:
+        FOR_EACH_LANE(l)
+        {
+            pc[l] += (mask[l] && VX[l] == NN) ? 2 : 0;
+        }
+        return;
+
+    case 0x4:
+        FOR_EACH_LANE(l)
+        {
+            pc[l] += (mask[l] && VX[l] != NN) ? 2 : 0;
+        }
+        return;
+
+    case 0x5:
+        FOR_EACH_LANE(l)
+        {
+            pc[l] += (mask[l] && VX[l] == VY[l]) ? 2 : 0;
+        }
+        return;
+
+    case 0x9:
+        FOR_EACH_LANE(l)
+        {
+            pc[l] += (mask[l] && VX[l] != VY[l]) ? 2 : 0;
+        }
+        return;
+
+    // 6XNN Set
+    case 0x6:
+        FOR_EACH_LANE(l)
+        {
+            VX[l] = mask[l] ? NN : VX[l];
+        }
+        return;
+
+    // 7XNN Add, no carry
+    case 0x7:
+        FOR_EACH_LANE(l)
+        {
+            VX[l] = mask[l] ? (uint8_t)(VX[l] + NN) : VX[l];
+        }
+        return;
+
+    case 0x8:
+        switch (N)
+        {
+        case 0x0:
+            FOR_EACH_LANE(l)
+            {
+                VX[l] = mask[l] ? VY[l] : VX[l];
+            }
+            return;
+
+        case 0x1:
+            FOR_EACH_LANE(l)
+            {
+                VX[l] = mask[l] ? (VX[l] | VY[l]) : VX[l];
+            }
+            return;
+
+        case 0x2:
+            FOR_EACH_LANE(l)
+            {
+                VX[l] = mask[l] ? (VX[l] & VY[l]) : VX[l];
+            }
+            return;
+
+        case 0x3:
+            FOR_EACH_LANE(l)
+            {
+                VX[l] = mask[l] ? (VX[l] ^ VY[l]) : VX[l];
+            }
+            return;
+
+        // The sum is taken before VF changes
+        case 0x4:
+            FOR_EACH_LANE(l)
+            {
+                uint16_t sum = VX[l] + VY[l];
+                flag[l] = sum > 0xFF;
+                result[l] = sum & 0xFF;
+            }
+            lanes_set_flag(lanes, flag, mask);
+            FOR_EACH_LANE(l)
+            {
+                VX[l] = mask[l] ? result[l] : VX[l];
+            }
+            return;
+
+        // The difference and shifts read VX and VY after VF changed, see chip8_execute_opcode
+        case 0x5:
+            FOR_EACH_LANE(l)
+            {
+                flag[l] = VX[l] >= VY[l];
+            }
+            lanes_set_flag(lanes, flag, mask);
+            FOR_EACH_LANE(l)
+            {
+                VX[l] = mask[l] ? (uint8_t)(VX[l] - VY[l]) : VX[l];
+            }
+            return;
+
+        // CHIP8_QUIRK_SHIFT_VY shifts VY: it is copied into VX first, the lanes share one quirk profile
+        case 0x6:
+            if (lanes->quirks & CHIP8_QUIRK_SHIFT_VY)
+            {
+                FOR_EACH_LANE(l)
+                {
+                    VX[l] = mask[l] ? VY[l] : VX[l];
+                }
+            }
+            FOR_EACH_LANE(l)
+            {
+                flag[l] = VX[l] & 0x1;
+            }
+            lanes_set_flag(lanes, flag, mask);
+            FOR_EACH_LANE(l)
+            {
+                VX[l] = mask[l] ? (VX[l] >> 1) : VX[l];
+            }
+            return;
+
+        case 0x7:
+            FOR_EACH_LANE(l)
+            {
+                flag[l] = VY[l] >= VX[l];
+            }
+            lanes_set_flag(lanes, flag, mask);
+            FOR_EACH_LANE(l)
+            {
+                VX[l] = mask[l] ? (uint8_t)(VY[l] - VX[l]) : VX[l];
+            }
+            return;
+
+        case 0xE:
+            if (lanes->quirks & CHIP8_QUIRK_SHIFT_VY)
+            {
+                FOR_EACH_LANE(l)
+                {
+                    VX[l] = mask[l] ? VY[l] : VX[l];
+                }
+            }
+            FOR_EACH_LANE(l)
+            {
+                flag[l] = (VX[l] >> 7) & 1;
+            }
+            lanes_set_flag(lanes, flag, mask);
+            FOR_EACH_LANE(l)
+            {
+                VX[l] = mask[l] ? (uint8_t)(VX[l] << 1) : VX[l];
+            }
+            return;
+
+        default:
+            break;
+        }
+        break;
+
+    // ANNN Set index
+    case 0xA:
+        FOR_EACH_LANE(l)
+        {
+            lanes->I[l] = mask[l] ? NNN : lanes->I[l];
+        }
+        return;
+
+    // BNNN Jump to NNN + V0, CHIP8_QUIRK_JUMP_VX: BXNN to XNN + VX
+    case 0xB:
+    {
+        const uint8_t *offset = (lanes->quirks & CHIP8_QUIRK_JUMP_VX) ? VX : lanes->V[0];
+        FOR_EACH_LANE(l)
+        {
+            pc[l] = mask[l] ? (uint16_t)(NNN + offset[l]) : pc[l];
+        }
+        return;
+    }
+
+    // CXNN Random, every machine has its own generator
+    case 0xC:
+        for (uint32_t l = 0; l < lanes->count; l++)
+        {
+            if (mask[l])
+            {
+                VX[l] = chip8_random(lanes->machines[l]) & NN;
+            }
+        }
+        return;
+
+    // DXYN Draw
+    case 0xD:
+        lanes_draw(lanes, opcode, mask);
+        return;
+
+    // EX9E EXA1 Skip on key, the keypad is per machine
+    case 0xE:
+        if (NN != 0x9E && NN != 0xA1)
+        {
+            break;
+        }
+        for (uint32_t l = 0; l < lanes->count; l++)
+        {
+            uint8_t pressed = (lanes->machines[l]->keypad >> (VX[l] & 0xF)) & 1;
+            pc[l] += (mask[l] && pressed == (NN == 0x9E)) ? 2 : 0;
+        }
+        return;
+
+    case 0xF:
+        switch (NN)
+        {
+        case 0x07:
+            FOR_EACH_LANE(l)
+            {
+                VX[l] = mask[l] ? lanes->delay_timer[l] : VX[l];
+            }
+            return;
+
+        case 0x15:
+            FOR_EACH_LANE(l)
+            {
+                lanes->delay_timer[l] = mask[l] ? VX[l] : lanes->delay_timer[l];
+            }
+            return;
+
+        case 0x18:
+            FOR_EACH_LANE(l)
+            {
+                lanes->sound_timer[l] = mask[l] ? VX[l] : lanes->sound_timer[l];
+            }
+            return;
+
+        case 0x1E:
+            FOR_EACH_LANE(l)
+            {
+                lanes->I[l] = mask[l] ? (uint16_t)(lanes->I[l] + VX[l]) : lanes->I[l];
+            }
+            return;
+
+        case 0x29:
+            FOR_EACH_LANE(l)
+            {
+                lanes->I[l] = mask[l] ? (uint16_t)(0x50 + VX[l] * 5) : lanes->I[l];
+            }
+            return;
+
+        // FX33 FX55 FX65 Memory is per machine, the addresses and dirty pages as in chip8_execute_opcode
+        case 0x33:
+            for (uint32_t l = 0; l < lanes->count; l++)
+            {
+                if (mask[l])
+                {
+                    Chip8 *chip8 = lanes->machines[l];
+                    uint16_t index = lanes->I[l];
+                    uint8_t operand = VX[l];
+                    chip8->memory[index + 2] = operand % 10;
+                    chip8->memory[index + 1] = operand / 10 % 10;
+                    chip8->memory[index + 0] = operand / 100;
+                    chip8->dirty_pages |= 1u << ((index >> 8) & 0xF) | 1u << (((index + 2) >> 8) & 0xF);
+                }
+            }
+            return;
+
+        case 0x55:
+            for (uint32_t l = 0; l < lanes->count; l++)
+            {
+                if (mask[l])
+                {
+                    Chip8 *chip8 = lanes->machines[l];
+                    uint16_t index = lanes->I[l];
+                    for (uint8_t i = 0; i <= X; i++)
+                    {
+                        chip8->memory[index + i] = lanes->V[i][l];
+                    }
+                    chip8->dirty_pages |= 1u << ((index >> 8) & 0xF) | 1u << (((index + X) >> 8) & 0xF);
+                }
+            }
+            if (lanes->quirks & CHIP8_QUIRK_INCREMENT_I)
+            {
+                FOR_EACH_LANE(l)
+                {
+                    lanes->I[l] = mask[l] ? (uint16_t)(lanes->I[l] + X + 1) : lanes->I[l];
+                }
+            }
+            return;
+
+        case 0x65:
+            for (uint32_t l = 0; l < lanes->count; l++)
+            {
+                if (mask[l])
+                {
+                    const uint8_t *memory = &lanes->machines[l]->memory[lanes->I[l]];
+                    for (uint8_t i = 0; i <= X; i++)
+                    {
+                        lanes->V[i][l] = memory[i];
+                    }
+                }
+            }
+            if (lanes->quirks & CHIP8_QUIRK_INCREMENT_I)
+            {
+                FOR_EACH_LANE(l)
+                {
+                    lanes->I[l] = mask[l] ? (uint16_t)(lanes->I[l] + X + 1) : lanes->I[l];
+                }
+            }
+            return;
+
+        default:
+            break;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    // FX0A, unknown opcodes, and calls or returns that overflow or underflow the stack
+    lanes_fallback(lanes, opcode, mask);
+}
+
+// Executes one instruction in every active lane
+void chip8_lanes_step(Chip8Lanes *lanes)
+{
+    uint8_t pending[CHIP8_LANES];
+    uint8_t mask[CHIP8_LANES];
+
+    // Fetch, memory is per machine so this is a gather
+    for (uint32_t l = 0; l < lanes->count; l++)
+    {
+        lanes->opcode[l] = chip8_fetch(lanes->machines[l]->memory, lanes->pc[l]);
+    }
+
+    FOR_EACH_LANE(l)
+    {
+        lanes->pc[l] += lanes->active[l] ? 2 : 0;
+    }
+
+    // Lanes in lockstep all fetched the same opcode, which is one execution over the active mask
+    uint16_t first = lanes->opcode[0];
+    uint16_t diverged = 0;
+    FOR_EACH_LANE(l)
+    {
+        diverged |= (lanes->opcode[l] ^ first) & (uint16_t)-(lanes->active[l] != 0);
+    }
+    if (diverged == 0)
+    {
+        lanes_execute(lanes, first, lanes->active);
+        return;
+    }
+
+    FOR_EACH_LANE(l)
+    {
+        pending[l] = lanes->active[l];
+    }
+
+    // Otherwise one masked execution per distinct opcode
+    for (uint32_t leader = 0; leader < lanes->count; leader++)
+    {
+        if (!pending[leader])
+        {
+            continue;
+        }
+
+        uint16_t opcode = lanes->opcode[leader];
+        FOR_EACH_LANE(l)
+        {
+            mask[l] = (pending[l] && lanes->opcode[l] == opcode) ? 0xFF : 0;
+            pending[l] &= ~mask[l];
+        }
+
+        lanes_execute(lanes, opcode, mask);
+    }
+}
+
+// Runs `cycles` instructions in every active lane, then writes the registers back
+void chip8_lanes_run(Chip8Lanes *lanes, uint64_t cycles)
+{
+    for (uint64_t i = 0; i < cycles; i++)
+    {
+        chip8_lanes_step(lanes);
+    }
+
+    for (uint32_t l = 0; l < lanes->count; l++)
+    {
+        chip8_lanes_store(lanes, l);
+        lanes->machines[l]->cycles += cycles;
+    }
+}
+
+void chip8_lanes_tick_timers(Chip8Lanes *lanes)
+{
+    FOR_EACH_LANE(l)
+    {
+        lanes->delay_timer[l] -= (lanes->delay_timer[l] > 0) ? 1 : 0;
+        lanes->sound_timer[l] -= (lanes->sound_timer[l] > 0) ? 1 : 0;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef CHIP8_LANES_H
+#define CHIP8_LANES_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+// Lockstep lanes engine
+// Runs up to CHIP8_LANES machines one instruction at a time, all together.
+// V, pc, I, the stack and the timers live in lane arrays (structure of arrays), so an
+// instruction executed by many lanes at once is a loop over contiguous bytes the compiler turns
+// into SSE2 (or AVX2 with -mavx2) vector code. Memory, display, keypad and the random number
+// generator stay in each lane's Chip8.
+//
+// Every step, the lanes are grouped by the opcode they fetched. Lanes in lockstep are one group,
+// executed over the active mask; lanes on a different PC or running a different ROM simply take
+// more groups, each executed with its own lane mask.
+// Register, skip, jump, call, return and timer instructions are vectorized. Calls and returns
+// of lanes at the same stack depth are one row of the stack arrays.
+// Draw, memory, random, key and clear instructions run lane by lane, straight on the lane
+// arrays and the lane's machine. FX0A and unknown opcodes sync every register and go through
+// chip8_execute_opcode.
+// Like the cache engine, no tracing, profiling or idle detection.
+
+enum
+{
+    CHIP8_LANES = 32
+};
+
+typedef struct
+{
+    Chip8 *machines[CHIP8_LANES];
+    uint32_t count;
+    uint8_t quirks;
+
+    // 0xFF for lanes in use
+    uint8_t active[CHIP8_LANES];
+
+    uint8_t V[CHIP8_NUM_VAR_REGISTERS][CHIP8_LANES];
+    uint16_t pc[CHIP8_LANES];
+    uint16_t I[CHIP8_LANES];
+
+    // Row d holds every lane's entry d, stack_top is -1 (0xFF) when empty, like Stack
+    uint16_t stack[CHIP8_STACK_SIZE][CHIP8_LANES];
+    uint8_t stack_top[CHIP8_LANES];
+    uint8_t delay_timer[CHIP8_LANES];
+    uint8_t sound_timer[CHIP8_LANES];
+
+    // Opcode each lane executed in the last step
+    uint16_t opcode[CHIP8_LANES];
+} Chip8Lanes;
+
+void chip8_lanes_init(Chip8Lanes *lanes, Chip8 *machines[], uint32_t count);
+void chip8_lanes_load(Chip8Lanes *lanes, uint32_t lane);
+void chip8_lanes_store(Chip8Lanes *lanes, uint32_t lane);
+void chip8_lanes_step(Chip8Lanes *lanes);
+void chip8_lanes_run(Chip8Lanes *lanes, uint64_t cycles);
+void chip8_lanes_tick_timers(Chip8Lanes *lanes);
+
+#endif
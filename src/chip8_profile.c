@@ -0,0 +1,306 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_profile.h"
+
+// Darkest to brightest, index 0 is never executed
+static const char heat_levels[] = " .:-=+*#%@";
+
+#define CHIP8_HEAT_LEVELS (sizeof(heat_levels) - 1)
+#define CHIP8_HEATMAP_ROW 64
+
+static const char *family_names[CHIP8_NUM_FAMILIES] = {
+    "00E0", "00EE", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN",
+    "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE",
+    "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1",
+    "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29", "FX33", "FX55", "FX65",
+    "????"};
+
+// Backward jump found in the profile, covering [start, end]
+typedef struct
+{
+    uint16_t start;
+    uint16_t end;
+    uint64_t iterations;
+    uint64_t instructions;
+} ProfileLoop;
+
+/// ********************
+/// Profile functions  *
+/// ********************
+
+void chip8_profile_reset(Chip8Profile *profile)
+{
+    memset(profile, 0, sizeof(*profile));
+}
+
+void chip8_profile_count(Chip8Profile *profile, uint16_t address, uint16_t opcode)
+{
+    profile->family_counts[chip8_opcode_family(opcode)]++;
+    profile->pc_counts[address & (CHIP8_MEMORY_SIZE - 1)]++;
+    profile->total++;
+}
+
+// Counts `count` executions at once, for idle loop iterations the scheduler skipped
+void chip8_profile_count_repeated(Chip8Profile *profile, uint16_t address, uint16_t opcode, uint64_t count)
+{
+    profile->family_counts[chip8_opcode_family(opcode)] += count;
+    profile->pc_counts[address & (CHIP8_MEMORY_SIZE - 1)] += count;
+    profile->total += count;
+}
+
+Chip8OpFamily chip8_opcode_family(uint16_t opcode)
+{
+    uint8_t N = opcode & 0xF;
+    uint8_t NN = opcode & 0xFF;
+
+    switch (opcode >> 12)
+    {
+    case 0x0:
+        if (opcode == 0x00E0)
+            return CHIP8_FAMILY_00E0;
+        if (opcode == 0x00EE)
+            return CHIP8_FAMILY_00EE;
+        return CHIP8_FAMILY_UNKNOWN;
+    case 0x1:
+        return CHIP8_FAMILY_1NNN;
+    case 0x2:
+        return CHIP8_FAMILY_2NNN;
+    case 0x3:
+        return CHIP8_FAMILY_3XNN;
+    case 0x4:
+        return CHIP8_FAMILY_4XNN;
+    case 0x5:
+        return CHIP8_FAMILY_5XY0;
+    case 0x6:
+        return CHIP8_FAMILY_6XNN;
+    case 0x7:
+        return CHIP8_FAMILY_7XNN;
+    case 0x8:
+        if (N <= 0x7)
+            return CHIP8_FAMILY_8XY0 + N;
+        if (N == 0xE)
+            return CHIP8_FAMILY_8XYE;
+        return CHIP8_FAMILY_UNKNOWN;
+    case 0x9:
+        return CHIP8_FAMILY_9XY0;
+    case 0xA:
+        return CHIP8_FAMILY_ANNN;
+    case 0xB:
+        return CHIP8_FAMILY_BNNN;
+    case 0xC:
+        return CHIP8_FAMILY_CXNN;
+    case 0xD:
+        return CHIP8_FAMILY_DXYN;
+    case 0xE:
+        if (NN == 0x9E)
+            return CHIP8_FAMILY_EX9E;
+        if (NN == 0xA1)
+            return CHIP8_FAMILY_EXA1;
+        return CHIP8_FAMILY_UNKNOWN;
+    default:
+        switch (NN)
+        {
+        case 0x07:
+            return CHIP8_FAMILY_FX07;
+        case 0x0A:
+            return CHIP8_FAMILY_FX0A;
+        case 0x15:
+            return CHIP8_FAMILY_FX15;
+        case 0x18:
+            return CHIP8_FAMILY_FX18;
+        case 0x1E:
+            return CHIP8_FAMILY_FX1E;
+        case 0x29:
+            return CHIP8_FAMILY_FX29;
+        case 0x33:
+            return CHIP8_FAMILY_FX33;
+        case 0x55:
+            return CHIP8_FAMILY_FX55;
+        case 0x65:
+            return CHIP8_FAMILY_FX65;
+        default:
+            return CHIP8_FAMILY_UNKNOWN;
+        }
+    }
+}
+
+const char *chip8_family_name(Chip8OpFamily family)
+{
+    return family < CHIP8_NUM_FAMILIES ? family_names[family] : family_names[CHIP8_FAMILY_UNKNOWN];
+}
+
+// One line per executed address: address,count,share of all executed instructions
+void chip8_profile_write_heatmap(const Chip8Profile *profile, FILE *file)
+{
+    fprintf(file, "address,count,share\n");
+    for (uint32_t address = 0; address < CHIP8_MEMORY_SIZE; address++)
+    {
+        if (profile->pc_counts[address] != 0)
+        {
+            fprintf(file, "0x%03X,%llu,%.6f\n", address, (unsigned long long)profile->pc_counts[address],
+                    (double)profile->pc_counts[address] / (double)profile->total);
+        }
+    }
+}
+
+static int compare_loops(const void *a, const void *b)
+{
+    const ProfileLoop *loop_a = a;
+    const ProfileLoop *loop_b = b;
+
+    if (loop_a->instructions != loop_b->instructions)
+    {
+        return loop_a->instructions < loop_b->instructions ? 1 : -1;
+    }
+    return (int)loop_a->start - (int)loop_b->start;
+}
+
+// qsort has no context argument in C99
+static const uint64_t *sort_counts;
+
+// Hottest first, then by address
+static int compare_hot_addresses(const void *a, const void *b)
+{
+    uint16_t address_a = *(const uint16_t *)a;
+    uint16_t address_b = *(const uint16_t *)b;
+
+    if (sort_counts[address_a] != sort_counts[address_b])
+    {
+        return sort_counts[address_a] < sort_counts[address_b] ? 1 : -1;
+    }
+    return (int)address_a - (int)address_b;
+}
+
+static void write_heat_strip(const Chip8Profile *profile, FILE *file)
+{
+    uint64_t hottest = 0;
+    for (uint32_t address = 0; address < CHIP8_MEMORY_SIZE; address++)
+    {
+        if (profile->pc_counts[address] > hottest)
+        {
+            hottest = profile->pc_counts[address];
+        }
+    }
+
+    for (uint32_t row = 0; row < CHIP8_MEMORY_SIZE; row += CHIP8_HEATMAP_ROW)
+    {
+        // Rows nothing ran in are left out, most of memory is data or empty
+        int executed = 0;
+        for (uint32_t i = 0; i < CHIP8_HEATMAP_ROW; i++)
+        {
+            executed |= profile->pc_counts[row + i] != 0;
+        }
+        if (!executed)
+        {
+            continue;
+        }
+
+        fprintf(file, "  %03X |", row);
+        for (uint32_t i = 0; i < CHIP8_HEATMAP_ROW; i++)
+        {
+            uint64_t count = profile->pc_counts[row + i];
+            uint32_t level = 0;
+            if (count != 0)
+            {
+                // Linear in the count, but anything executed gets at least the first level
+                level = 1 + (uint32_t)((count * (CHIP8_HEAT_LEVELS - 2)) / hottest);
+            }
+            fputc(heat_levels[level], file);
+        }
+        fprintf(file, "|\n");
+    }
+}
+
+// Text report: instruction mix, DXYN time, a heat strip of memory, the hottest addresses
+// and the hottest loops. Loops are found from backward 1NNN jumps in chip8's current memory.
+void chip8_profile_write_report(const Chip8Profile *profile, const Chip8 *chip8, FILE *file, uint32_t top_n)
+{
+    fprintf(file, "Profile: %llu instructions\n\n", (unsigned long long)profile->total);
+    if (profile->total == 0)
+    {
+        return;
+    }
+
+    fprintf(file, "Instruction mix:\n");
+    for (uint32_t f = 0; f < CHIP8_NUM_FAMILIES; f++)
+    {
+        if (profile->family_counts[f] != 0)
+        {
+            fprintf(file, "  %s %12llu %6.2f%%\n", family_names[f], (unsigned long long)profile->family_counts[f],
+                    100.0 * (double)profile->family_counts[f] / (double)profile->total);
+        }
+    }
+
+    uint64_t draws = profile->family_counts[CHIP8_FAMILY_DXYN];
+    fprintf(file, "\nDXYN: %llu draws, %.3f ms total, %.1f ns per draw\n",
+            (unsigned long long)draws, (double)profile->draw_ns / 1e6,
+            draws ? (double)profile->draw_ns / (double)draws : 0.0);
+
+    fprintf(file, "\nHeatmap (%u bytes per row):\n", CHIP8_HEATMAP_ROW);
+    write_heat_strip(profile, file);
+
+    // Hottest addresses
+    uint16_t addresses[CHIP8_MEMORY_SIZE];
+    uint32_t num_addresses = 0;
+    for (uint32_t address = 0; address < CHIP8_MEMORY_SIZE; address++)
+    {
+        if (profile->pc_counts[address] != 0)
+        {
+            addresses[num_addresses++] = address;
+        }
+    }
+    sort_counts = profile->pc_counts;
+    qsort(addresses, num_addresses, sizeof(addresses[0]), compare_hot_addresses);
+
+    fprintf(file, "\nHot addresses:\n");
+    for (uint32_t i = 0; i < num_addresses && i < top_n; i++)
+    {
+        uint16_t address = addresses[i];
+        uint16_t opcode = chip8_fetch(chip8->memory, address);
+        fprintf(file, "  %03X: %04X %s %12llu %6.2f%%\n", address, opcode,
+                family_names[chip8_opcode_family(opcode)], (unsigned long long)profile->pc_counts[address],
+                100.0 * (double)profile->pc_counts[address] / (double)profile->total);
+    }
+
+    // Hot loops: every executed jump back to itself or an earlier address closes a loop
+    ProfileLoop *loops = malloc(num_addresses * sizeof(ProfileLoop));
+    uint32_t num_loops = 0;
+    for (uint32_t i = 0; loops != NULL && i < num_addresses; i++)
+    {
+        uint16_t address = addresses[i];
+        uint16_t opcode = chip8_fetch(chip8->memory, address);
+        uint16_t target = opcode & 0xFFF;
+        if ((opcode >> 12) != 0x1 || target > address)
+        {
+            continue;
+        }
+
+        ProfileLoop *loop = &loops[num_loops++];
+        loop->start = target;
+        loop->end = address;
+        loop->iterations = profile->pc_counts[address];
+        loop->instructions = 0;
+        for (uint32_t a = target; a <= address; a++)
+        {
+            loop->instructions += profile->pc_counts[a];
+        }
+    }
+    if (loops != NULL)
+    {
+        qsort(loops, num_loops, sizeof(ProfileLoop), compare_loops);
+    }
+
+    fprintf(file, "\nHot loops:\n");
+    for (uint32_t i = 0; i < num_loops && i < top_n; i++)
+    {
+        const ProfileLoop *loop = &loops[i];
+        fprintf(file, "  %03X-%03X %12llu iterations %12llu instructions %6.2f%%%s\n",
+                loop->start, loop->end, (unsigned long long)loop->iterations,
+                (unsigned long long)loop->instructions,
+                100.0 * (double)loop->instructions / (double)profile->total,
+                loop->start == loop->end ? " (self jump)" : "");
+    }
+
+    free(loops);
+}
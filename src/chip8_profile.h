@@ -0,0 +1,71 @@
+#ifndef CHIP8_PROFILE_H
+#define CHIP8_PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8.h"
+
+// Execution profiler
+// Counts executions per opcode family and per PC address, and the host time spent in DXYN.
+// Only compiled in with -DCHIP8_PROFILE=1, and only active when chip8->profile is set.
+
+typedef enum
+{
+    CHIP8_FAMILY_00E0,
+    CHIP8_FAMILY_00EE,
+    CHIP8_FAMILY_1NNN,
+    CHIP8_FAMILY_2NNN,
+    CHIP8_FAMILY_3XNN,
+    CHIP8_FAMILY_4XNN,
+    CHIP8_FAMILY_5XY0,
+    CHIP8_FAMILY_6XNN,
+    CHIP8_FAMILY_7XNN,
+    CHIP8_FAMILY_8XY0,
+    CHIP8_FAMILY_8XY1,
+    CHIP8_FAMILY_8XY2,
+    CHIP8_FAMILY_8XY3,
+    CHIP8_FAMILY_8XY4,
+    CHIP8_FAMILY_8XY5,
+    CHIP8_FAMILY_8XY6,
+    CHIP8_FAMILY_8XY7,
+    CHIP8_FAMILY_8XYE,
+    CHIP8_FAMILY_9XY0,
+    CHIP8_FAMILY_ANNN,
+    CHIP8_FAMILY_BNNN,
+    CHIP8_FAMILY_CXNN,
+    CHIP8_FAMILY_DXYN,
+    CHIP8_FAMILY_EX9E,
+    CHIP8_FAMILY_EXA1,
+    CHIP8_FAMILY_FX07,
+    CHIP8_FAMILY_FX0A,
+    CHIP8_FAMILY_FX15,
+    CHIP8_FAMILY_FX18,
+    CHIP8_FAMILY_FX1E,
+    CHIP8_FAMILY_FX29,
+    CHIP8_FAMILY_FX33,
+    CHIP8_FAMILY_FX55,
+    CHIP8_FAMILY_FX65,
+    CHIP8_FAMILY_UNKNOWN,
+    CHIP8_NUM_FAMILIES
+} Chip8OpFamily;
+
+struct Chip8Profile
+{
+    uint64_t family_counts[CHIP8_NUM_FAMILIES];
+    uint64_t pc_counts[CHIP8_MEMORY_SIZE];
+    uint64_t total;
+
+    // Host time spent inside DXYN
+    uint64_t draw_ns;
+};
+
+void chip8_profile_reset(Chip8Profile *profile);
+void chip8_profile_count(Chip8Profile *profile, uint16_t address, uint16_t opcode);
+void chip8_profile_count_repeated(Chip8Profile *profile, uint16_t address, uint16_t opcode, uint64_t count);
+Chip8OpFamily chip8_opcode_family(uint16_t opcode);
+const char *chip8_family_name(Chip8OpFamily family);
+void chip8_profile_write_heatmap(const Chip8Profile *profile, FILE *file);
+void chip8_profile_write_report(const Chip8Profile *profile, const Chip8 *chip8, FILE *file, uint32_t top_n);
+
+#endif
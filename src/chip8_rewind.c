@@ -0,0 +1,223 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "chip8_rewind.h"
+
+// Equal bytes shorter than this between two changed runs are cheaper to store than a new run header
+#define CHIP8_REWIND_MIN_GAP 4
+
+// Parts of the Chip8 that are journaled
+// Keypad, dirty rows and the trace pointer belong to the host and are left alone
+typedef struct
+{
+    uint16_t offset;
+    uint16_t size;
+} RewindRegion;
+
+static const RewindRegion rewind_regions[] = {
+    {offsetof(Chip8, memory), sizeof(((Chip8 *)0)->memory)},
+    {offsetof(Chip8, V), sizeof(((Chip8 *)0)->V)},
+    {offsetof(Chip8, pc), sizeof(((Chip8 *)0)->pc)},
+    {offsetof(Chip8, I), sizeof(((Chip8 *)0)->I)},
+    {offsetof(Chip8, stack), sizeof(((Chip8 *)0)->stack)},
+    {offsetof(Chip8, delay_timer), sizeof(((Chip8 *)0)->delay_timer)},
+    {offsetof(Chip8, sound_timer), sizeof(((Chip8 *)0)->sound_timer)},
+    {offsetof(Chip8, display), sizeof(((Chip8 *)0)->display)},
+    {offsetof(Chip8, cycles), sizeof(((Chip8 *)0)->cycles)},
+    {offsetof(Chip8, rng_state), sizeof(((Chip8 *)0)->rng_state)},
+};
+
+#define CHIP8_REWIND_NUM_REGIONS (sizeof(rewind_regions) / sizeof(rewind_regions[0]))
+
+/// ********************
+/// Rewind functions   *
+/// ********************
+
+int chip8_rewind_init(Chip8Rewind *rewind, uint8_t *arena, uint32_t arena_size, const Chip8 *chip8)
+{
+    if (arena_size < 4 * CHIP8_REWIND_MAX_RECORD)
+    {
+        return 1;
+    }
+
+    rewind->arena = arena;
+    rewind->arena_size = arena_size;
+    chip8_rewind_reset(rewind, chip8);
+
+    return 0;
+}
+
+// Drops every recorded frame and starts over from the current state (e.g. after loading a save state)
+void chip8_rewind_reset(Chip8Rewind *rewind, const Chip8 *chip8)
+{
+    rewind->write_position = 0;
+    rewind->oldest = 0;
+    rewind->count = 0;
+    rewind->previous = *chip8;
+}
+
+static void rewind_drop_oldest(Chip8Rewind *rewind)
+{
+    rewind->oldest = (rewind->oldest + 1) % CHIP8_REWIND_MAX_FRAMES;
+    rewind->count--;
+}
+
+// Writes the runs of one region where current differs from previous, returns the bytes written
+static uint32_t rewind_diff_region(uint8_t *out, const uint8_t *current, const uint8_t *previous,
+                                   const RewindRegion *region)
+{
+    const uint8_t *a = current + region->offset;
+    const uint8_t *b = previous + region->offset;
+    uint32_t written = 0;
+    uint32_t i = 0;
+
+    while (i < region->size)
+    {
+        // Skip equal words quickly, most of memory never changes
+        if (i + 8 <= region->size)
+        {
+            uint64_t word_a, word_b;
+            memcpy(&word_a, a + i, 8);
+            memcpy(&word_b, b + i, 8);
+            if (word_a == word_b)
+            {
+                i += 8;
+                continue;
+            }
+        }
+
+        if (a[i] == b[i])
+        {
+            i++;
+            continue;
+        }
+
+        // Extend the run while the next change is less than a run header away
+        uint32_t start = i;
+        uint32_t end = i + 1;
+        for (uint32_t j = end; j < region->size && j < end + CHIP8_REWIND_MIN_GAP; j++)
+        {
+            if (a[j] != b[j])
+            {
+                end = j + 1;
+            }
+        }
+
+        // Run: u16 offset into Chip8, u16 length, XOR of old and new bytes
+        uint16_t offset = region->offset + start;
+        uint16_t length = end - start;
+        memcpy(out + written, &offset, 2);
+        memcpy(out + written + 2, &length, 2);
+        written += 4;
+
+        for (uint32_t j = start; j < end; j++)
+        {
+            out[written++] = a[j] ^ b[j];
+        }
+
+        i = end;
+    }
+
+    return written;
+}
+
+void chip8_rewind_record(Chip8Rewind *rewind, const Chip8 *chip8)
+{
+    // Make room for a worst case record, wrapping to the start of the arena if needed
+    if (rewind->write_position + CHIP8_REWIND_MAX_RECORD > rewind->arena_size)
+    {
+        // Frames past the write position are the oldest ones, they would be skipped over
+        while (rewind->count > 0 && rewind->frame_offset[rewind->oldest] >= rewind->write_position)
+        {
+            rewind_drop_oldest(rewind);
+        }
+        rewind->write_position = 0;
+    }
+
+    uint32_t start = rewind->write_position;
+    uint32_t end = start + CHIP8_REWIND_MAX_RECORD;
+
+    // Drop the oldest frames overlapping the space we may write into
+    while (rewind->count > 0)
+    {
+        uint32_t oldest_start = rewind->frame_offset[rewind->oldest];
+        uint32_t oldest_end = oldest_start + rewind->frame_size[rewind->oldest];
+        if (oldest_end <= start || oldest_start >= end)
+        {
+            break;
+        }
+        rewind_drop_oldest(rewind);
+    }
+
+    if (rewind->count == CHIP8_REWIND_MAX_FRAMES)
+    {
+        rewind_drop_oldest(rewind);
+    }
+
+    uint32_t size = 0;
+    for (uint32_t r = 0; r < CHIP8_REWIND_NUM_REGIONS; r++)
+    {
+        size += rewind_diff_region(rewind->arena + start + size, (const uint8_t *)chip8,
+                                   (const uint8_t *)&rewind->previous, &rewind_regions[r]);
+    }
+
+    uint32_t newest = (rewind->oldest + rewind->count) % CHIP8_REWIND_MAX_FRAMES;
+    rewind->frame_offset[newest] = start;
+    rewind->frame_size[newest] = size;
+    rewind->count++;
+    rewind->write_position = start + size;
+
+    // Only the journaled regions matter in previous
+    for (uint32_t r = 0; r < CHIP8_REWIND_NUM_REGIONS; r++)
+    {
+        const RewindRegion *region = &rewind_regions[r];
+        memcpy((uint8_t *)&rewind->previous + region->offset, (const uint8_t *)chip8 + region->offset, region->size);
+    }
+}
+
+// Returns the number of frames actually stepped back (fewer if the journal runs out)
+uint32_t chip8_rewind_step_back(Chip8Rewind *rewind, Chip8 *chip8, uint32_t frames)
+{
+    uint8_t *live = (uint8_t *)chip8;
+    uint8_t *previous = (uint8_t *)&rewind->previous;
+
+    // Anything executed since the last record is discarded first
+    for (uint32_t r = 0; r < CHIP8_REWIND_NUM_REGIONS; r++)
+    {
+        const RewindRegion *region = &rewind_regions[r];
+        memcpy(live + region->offset, previous + region->offset, region->size);
+    }
+
+    uint32_t stepped = 0;
+    while (stepped < frames && rewind->count > 0)
+    {
+        uint32_t newest = (rewind->oldest + rewind->count - 1) % CHIP8_REWIND_MAX_FRAMES;
+        const uint8_t *record = rewind->arena + rewind->frame_offset[newest];
+        uint32_t size = rewind->frame_size[newest];
+        uint32_t position = 0;
+
+        while (position < size)
+        {
+            uint16_t offset, length;
+            memcpy(&offset, record + position, 2);
+            memcpy(&length, record + position + 2, 2);
+            position += 4;
+
+            for (uint16_t j = 0; j < length; j++)
+            {
+                live[offset + j] ^= record[position + j];
+                previous[offset + j] ^= record[position + j];
+            }
+            position += length;
+        }
+
+        rewind->count--;
+        rewind->write_position = rewind->frame_offset[newest];
+        stepped++;
+    }
+
+    chip8->dirty_rows = 0xFFFFFFFF;
+    chip8->dirty_pages = 0xFFFF;
+
+    return stepped;
+}
@@ -0,0 +1,46 @@
+#ifndef CHIP8_REWIND_H
+#define CHIP8_REWIND_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+// Rewind journal
+// Once per emulated frame, chip8_rewind_record stores only the bytes of memory, registers,
+// stack, timers, display and random state that changed since the previous frame, into a fixed-size
+// circular arena provided by the caller. When the arena is full the oldest frames are dropped.
+//
+// Changes are stored XOR-ed with the previous value, which makes every record its own inverse:
+// stepping back applies the newest records to the live state, newest first.
+// That is why no keyframes are needed, stepping back N frames costs N small records.
+
+enum
+{
+    CHIP8_REWIND_MAX_FRAMES = 60 * 60, // One minute at 60 frames per second
+
+    // Worst case size of one frame record, the arena must hold at least a few of these
+    CHIP8_REWIND_MAX_RECORD = 2 * sizeof(Chip8)
+};
+
+typedef struct
+{
+    uint8_t *arena;
+    uint32_t arena_size;
+    uint32_t write_position;
+
+    // Ring of recorded frames, oldest first
+    uint32_t frame_offset[CHIP8_REWIND_MAX_FRAMES];
+    uint32_t frame_size[CHIP8_REWIND_MAX_FRAMES];
+    uint32_t oldest;
+    uint32_t count;
+
+    // State at the last recorded frame
+    Chip8 previous;
+} Chip8Rewind;
+
+int chip8_rewind_init(Chip8Rewind *rewind, uint8_t *arena, uint32_t arena_size, const Chip8 *chip8);
+void chip8_rewind_reset(Chip8Rewind *rewind, const Chip8 *chip8);
+void chip8_rewind_record(Chip8Rewind *rewind, const Chip8 *chip8);
+uint32_t chip8_rewind_step_back(Chip8Rewind *rewind, Chip8 *chip8, uint32_t frames);
+
+#endif
@@ -0,0 +1,209 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "chip8_rom_store.h"
+
+/// ********************
+/// Mapping            *
+/// ********************
+
+// Maps a whole ROM file read-only, an empty file gives no mapping and size 0
+// Fails on files that do not fit in memory after 0x200
+static int rom_store_map(const char *filename, void **mapping, size_t *size)
+{
+    *mapping = NULL;
+    *size = 0;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return 1;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart > CHIP8_MAX_ROM_SIZE)
+    {
+        CloseHandle(file);
+        return 1;
+    }
+
+    if (file_size.QuadPart > 0)
+    {
+        // The view keeps the file mapped after both handles are closed
+        HANDLE file_mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (file_mapping != NULL)
+        {
+            *mapping = MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(file_mapping);
+        }
+        if (*mapping == NULL)
+        {
+            CloseHandle(file);
+            return 1;
+        }
+    }
+
+    CloseHandle(file);
+    *size = (size_t)file_size.QuadPart;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size > CHIP8_MAX_ROM_SIZE)
+    {
+        close(fd);
+        return 1;
+    }
+
+    if (info.st_size > 0)
+    {
+        void *view = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view == MAP_FAILED)
+        {
+            close(fd);
+            return 1;
+        }
+        *mapping = view;
+    }
+
+    close(fd);
+    *size = (size_t)info.st_size;
+#endif
+
+    return 0;
+}
+
+static void rom_store_unmap(void *mapping, size_t size)
+{
+    if (mapping == NULL)
+    {
+        return;
+    }
+
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(mapping);
+#else
+    munmap(mapping, size);
+#endif
+}
+
+/// ********************
+/// Store functions    *
+/// ********************
+
+void chip8_rom_store_init(Chip8RomStore *store)
+{
+    memset(store, 0, sizeof(*store));
+}
+
+static Chip8RomEntry *rom_store_lookup(const Chip8RomStore *store, uint64_t hash, uint8_t quirks, const uint8_t *data,
+                                       size_t size)
+{
+    for (Chip8RomEntry *entry = store->buckets[hash % CHIP8_ROM_STORE_BUCKETS]; entry != NULL; entry = entry->next)
+    {
+        if (entry->rom.hash == hash && entry->quirks == quirks && entry->rom.size == size &&
+            (size == 0 || memcmp(entry->rom.data, data, size) == 0))
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+// Returns the entry for the file's content and quirks, adding and analysing it if it is new
+// The quirks come from <filename>.quirks, or default_quirks without one.
+// Returns NULL if the file cannot be mapped or is too big.
+const Chip8RomEntry *chip8_rom_store_add(Chip8RomStore *store, const char *filename, uint8_t default_quirks)
+{
+    void *mapping;
+    size_t size;
+    if (rom_store_map(filename, &mapping, &size) != 0)
+    {
+        return NULL;
+    }
+
+    uint64_t hash = chip8_rom_hash(mapping, (uint32_t)size);
+
+    uint8_t quirks;
+    if (chip8_read_quirks_file(filename, &quirks) != 0)
+    {
+        quirks = default_quirks;
+    }
+
+    Chip8RomEntry *entry = rom_store_lookup(store, hash, quirks, mapping, size);
+    if (entry != NULL)
+    {
+        rom_store_unmap(mapping, size);
+        return entry;
+    }
+
+    entry = malloc(sizeof(Chip8RomEntry));
+    if (entry == NULL)
+    {
+        rom_store_unmap(mapping, size);
+        return NULL;
+    }
+
+    entry->rom.data = mapping;
+    entry->rom.size = (uint16_t)size;
+    entry->rom.hash = hash;
+    entry->mapping = mapping;
+    entry->mapping_size = size;
+    entry->quirks = quirks;
+
+    chip8_boot_memory(entry->memory, &entry->rom);
+
+    // Code reachable from the start of the program, decoded once for every cache engine instance
+    Chip8 machine;
+    chip8_rom_store_boot(entry, &machine);
+    entry->num_blocks = chip8_cache_prepare(&entry->cache, &machine, CHIP8_PROGRAM_START);
+
+    uint32_t bucket = hash % CHIP8_ROM_STORE_BUCKETS;
+    entry->next = store->buckets[bucket];
+    store->buckets[bucket] = entry;
+    store->count++;
+
+    return entry;
+}
+
+// Same state as chip8_init followed by chip8_load_rom, without touching the file
+void chip8_rom_store_boot(const Chip8RomEntry *entry, Chip8 *chip8)
+{
+    chip8_init(chip8);
+    memcpy(chip8->memory, entry->memory, CHIP8_MEMORY_SIZE);
+    chip8->rom_hash = entry->rom.hash;
+    chip8_set_quirks(chip8, entry->quirks);
+}
+
+void chip8_rom_store_free(Chip8RomStore *store)
+{
+    for (uint32_t bucket = 0; bucket < CHIP8_ROM_STORE_BUCKETS; bucket++)
+    {
+        Chip8RomEntry *entry = store->buckets[bucket];
+        while (entry != NULL)
+        {
+            Chip8RomEntry *next = entry->next;
+            rom_store_unmap(entry->mapping, entry->mapping_size);
+            free(entry);
+            entry = next;
+        }
+    }
+
+    memset(store, 0, sizeof(*store));
+}
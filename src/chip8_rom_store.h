@@ -0,0 +1,52 @@
+#ifndef CHIP8_ROM_STORE_H
+#define CHIP8_ROM_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "chip8_cache.h"
+
+// Content-addressed ROM store
+// Every ROM file is memory-mapped read-only once and keyed by its content hash and quirk
+// profile, so any number of paths (and instances) with the same content and profile share one
+// entry. The same bytes with another profile are a separate entry: the profile changes what
+// the code does and how it decodes. An entry holds everything a new instance needs, prepared once:
+//      - the boot memory image (fontset and ROM), an instance is a chip8_init and one memcpy
+//      - the quirk profile, from <rom_file>.quirks, or the default without one
+//      - a cache template with the ROM's reachable code already decoded into basic blocks
+//
+// Entries are only added from one thread, before instances start. After that the store is
+// read-only and shared by all worker threads without locking.
+
+enum
+{
+    CHIP8_ROM_STORE_BUCKETS = 256
+};
+
+typedef struct Chip8RomEntry
+{
+    Chip8Rom rom; // data points into the mapping
+    uint8_t memory[CHIP8_MEMORY_SIZE];
+    uint8_t quirks;
+    Chip8Cache cache;
+    uint32_t num_blocks;
+
+    void *mapping;
+    size_t mapping_size;
+
+    struct Chip8RomEntry *next;
+} Chip8RomEntry;
+
+typedef struct
+{
+    Chip8RomEntry *buckets[CHIP8_ROM_STORE_BUCKETS];
+    uint32_t count;
+} Chip8RomStore;
+
+void chip8_rom_store_init(Chip8RomStore *store);
+const Chip8RomEntry *chip8_rom_store_add(Chip8RomStore *store, const char *filename, uint8_t default_quirks);
+void chip8_rom_store_boot(const Chip8RomEntry *entry, Chip8 *chip8);
+void chip8_rom_store_free(Chip8RomStore *store);
+
+#endif
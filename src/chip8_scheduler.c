@@ -0,0 +1,131 @@
+#include <stddef.h>
+
+#include "chip8_scheduler.h"
+
+#define NS_PER_SECOND 1000000000ULL
+
+/// *********************
+/// Scheduler functions *
+/// *********************
+
+// Default engine, stops right after an idle loop iteration like chip8_cache_run
+static uint64_t scheduler_run_interpreter(Chip8 *chip8, void *engine, uint64_t cycles)
+{
+    (void)engine;
+
+    for (uint64_t i = 0; i < cycles; i++)
+    {
+        chip8_cycle(chip8);
+
+        if (chip8->idle != CHIP8_IDLE_NONE)
+        {
+            return i + 1;
+        }
+    }
+
+    return cycles;
+}
+
+void chip8_scheduler_init(Chip8Scheduler *scheduler, uint32_t clock_frequency, uint64_t now_ns)
+{
+    scheduler->clock_frequency = clock_frequency > 0 ? clock_frequency : 1;
+    scheduler->last_ns = now_ns;
+    scheduler->carry = 0;
+    scheduler->max_catch_up_ns = CHIP8_SCHEDULER_MAX_CATCH_UP_NS;
+    scheduler->timer_phase = 0;
+    scheduler->dropped_ns = 0;
+    scheduler->run = scheduler_run_interpreter;
+    scheduler->engine = NULL;
+}
+
+// Forgets the host time since the last update (e.g. while paused)
+void chip8_scheduler_resync(Chip8Scheduler *scheduler, uint64_t now_ns)
+{
+    scheduler->last_ns = now_ns;
+}
+
+// Returns the number of cycles owed for the host time since the last call
+uint64_t chip8_scheduler_advance(Chip8Scheduler *scheduler, uint64_t now_ns)
+{
+    uint64_t elapsed = now_ns > scheduler->last_ns ? now_ns - scheduler->last_ns : 0;
+    scheduler->last_ns = now_ns;
+
+    if (elapsed > scheduler->max_catch_up_ns)
+    {
+        scheduler->dropped_ns += elapsed - scheduler->max_catch_up_ns;
+        elapsed = scheduler->max_catch_up_ns;
+    }
+
+    // Fixed point in 1/1e9 cycles, at most 1e8 ns * 2^32 Hz, far from overflowing
+    uint64_t owed = scheduler->carry + elapsed * scheduler->clock_frequency;
+    scheduler->carry = owed % NS_PER_SECOND;
+
+    return owed / NS_PER_SECOND;
+}
+
+// Re-derives the timer phase of a machine at `cycles` (after a load or a rewind)
+// Ticks fall on fixed cycle boundaries from cycle 0, so the phase only depends on the count.
+void chip8_scheduler_sync_phase(Chip8Scheduler *scheduler, uint64_t cycles)
+{
+    scheduler->timer_phase = cycles * CHIP8_TIMER_FREQUENCY % scheduler->clock_frequency;
+}
+
+// Cycles left until the next timer tick, at least 1
+uint64_t chip8_scheduler_cycles_to_tick(const Chip8Scheduler *scheduler)
+{
+    return (scheduler->clock_frequency - scheduler->timer_phase + CHIP8_TIMER_FREQUENCY - 1) / CHIP8_TIMER_FREQUENCY;
+}
+
+// Accounts for `cycles` executed cycles, returns the number of timer ticks that are due
+// More than one tick per cycle below 60 Hz
+uint32_t chip8_scheduler_elapse(Chip8Scheduler *scheduler, uint64_t cycles)
+{
+    uint32_t ticks = 0;
+
+    scheduler->timer_phase += cycles * CHIP8_TIMER_FREQUENCY;
+    while (scheduler->timer_phase >= scheduler->clock_frequency)
+    {
+        scheduler->timer_phase -= scheduler->clock_frequency;
+        ticks++;
+    }
+
+    return ticks;
+}
+
+// Runs exactly `cycles` cycles, ticking the timers on their exact cycle boundaries
+// Idle loops are fast-forwarded up to the next tick, with the same result as running them.
+uint64_t chip8_scheduler_run_cycles(Chip8Scheduler *scheduler, Chip8 *chip8, uint64_t cycles)
+{
+    uint64_t remaining = cycles;
+
+    while (remaining > 0)
+    {
+        uint64_t until_tick = chip8_scheduler_cycles_to_tick(scheduler);
+        uint64_t budget = remaining < until_tick ? remaining : until_tick;
+
+        chip8->idle = CHIP8_IDLE_NONE;
+        uint64_t executed = scheduler->run(chip8, scheduler->engine, budget);
+        executed += chip8_skip_idle(chip8, budget - executed);
+        remaining -= executed;
+
+        for (uint32_t ticks = chip8_scheduler_elapse(scheduler, executed); ticks > 0; ticks--)
+        {
+            chip8_tick_timers(chip8);
+        }
+    }
+
+    return cycles;
+}
+
+// Runs up to and including the next timer tick, one frame of emulated time
+// Used where the host clock does not matter (turbo), returns the number of cycles run
+uint64_t chip8_scheduler_run_frame(Chip8Scheduler *scheduler, Chip8 *chip8)
+{
+    return chip8_scheduler_run_cycles(scheduler, chip8, chip8_scheduler_cycles_to_tick(scheduler));
+}
+
+// Runs the cycles owed for the host time since the last update, returns how many
+uint64_t chip8_scheduler_update(Chip8Scheduler *scheduler, Chip8 *chip8, uint64_t now_ns)
+{
+    return chip8_scheduler_run_cycles(scheduler, chip8, chip8_scheduler_advance(scheduler, now_ns));
+}
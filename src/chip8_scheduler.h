@@ -0,0 +1,56 @@
+#ifndef CHIP8_SCHEDULER_H
+#define CHIP8_SCHEDULER_H
+
+#include <stdint.h>
+
+#include "chip8.h"
+
+// Fixed-step scheduler
+// Converts host time into a number of cycles owed at the configured clock frequency,
+// keeping the fraction of a cycle between calls, so no time is lost to rounding.
+// The 60 Hz timers tick on exact cycle boundaries (tick k happens after cycle
+// ceil(k * clock / 60)), independent of how the cycles are split into batches.
+// The emulated machine therefore only depends on the number of cycles run, never on
+// host frame times, which makes runs with the same input bit-exact.
+//
+// After a stall (window dragged, debugger, suspended laptop) at most max_catch_up_ns of
+// host time is made up for, the rest is dropped instead of running a huge burst.
+
+#define CHIP8_TIMER_FREQUENCY 60
+#define CHIP8_SCHEDULER_MAX_CATCH_UP_NS 100000000ULL // 100 ms
+
+// Runs up to `cycles` instructions and returns the number executed
+// May return early after an idle loop is detected (chip8->idle set), see chip8_cache_run
+typedef uint64_t (*Chip8RunFunction)(Chip8 *chip8, void *engine, uint64_t cycles);
+
+typedef struct
+{
+    uint32_t clock_frequency;
+
+    // Host time of the last update, and the fraction of a cycle not run yet (in 1/1e9 cycle)
+    uint64_t last_ns;
+    uint64_t carry;
+    uint64_t max_catch_up_ns;
+
+    // Cycles since the last timer tick, times CHIP8_TIMER_FREQUENCY
+    uint64_t timer_phase;
+
+    // Host time dropped after stalls, for diagnostics
+    uint64_t dropped_ns;
+
+    // Execution engine, chip8_cycle when NULL
+    Chip8RunFunction run;
+    void *engine;
+} Chip8Scheduler;
+
+void chip8_scheduler_init(Chip8Scheduler *scheduler, uint32_t clock_frequency, uint64_t now_ns);
+void chip8_scheduler_resync(Chip8Scheduler *scheduler, uint64_t now_ns);
+uint64_t chip8_scheduler_advance(Chip8Scheduler *scheduler, uint64_t now_ns);
+void chip8_scheduler_sync_phase(Chip8Scheduler *scheduler, uint64_t cycles);
+uint64_t chip8_scheduler_cycles_to_tick(const Chip8Scheduler *scheduler);
+uint32_t chip8_scheduler_elapse(Chip8Scheduler *scheduler, uint64_t cycles);
+uint64_t chip8_scheduler_run_cycles(Chip8Scheduler *scheduler, Chip8 *chip8, uint64_t cycles);
+uint64_t chip8_scheduler_run_frame(Chip8Scheduler *scheduler, Chip8 *chip8);
+uint64_t chip8_scheduler_update(Chip8Scheduler *scheduler, Chip8 *chip8, uint64_t now_ns);
+
+#endif
@@ -0,0 +1,599 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8_search.h"
+
+typedef struct
+{
+    Chip8Search *search;
+    uint32_t index;
+} SearchTask;
+
+typedef struct
+{
+    double score;
+    uint32_t index;
+} SearchRank;
+
+static uint64_t search_run_cache(Chip8 *chip8, void *engine, uint64_t cycles)
+{
+    return chip8_cache_run(chip8, engine, cycles);
+}
+
+/// ********************
+/// Page arena         *
+/// ********************
+
+// Adds a block of pages to the free list, called with the lock held
+static int search_grow(Chip8Search *search)
+{
+    if (search->num_blocks == search->max_blocks)
+    {
+        uint32_t max_blocks = search->max_blocks > 0 ? 2 * search->max_blocks : 16;
+        Chip8SearchPage **blocks = realloc(search->blocks, max_blocks * sizeof(Chip8SearchPage *));
+        if (blocks == NULL)
+        {
+            search->out_of_memory = 1;
+            return 1;
+        }
+        search->blocks = blocks;
+        search->max_blocks = max_blocks;
+    }
+
+    Chip8SearchPage *block = malloc(CHIP8_SEARCH_PAGE_BLOCK * sizeof(Chip8SearchPage));
+    if (block == NULL)
+    {
+        search->out_of_memory = 1;
+        return 1;
+    }
+    search->blocks[search->num_blocks++] = block;
+
+    for (uint32_t i = CHIP8_SEARCH_PAGE_BLOCK; i > 0; i--)
+    {
+        block[i - 1].next_free = search->free_pages;
+        search->free_pages = &block[i - 1];
+    }
+
+    return 0;
+}
+
+// Takes a page from the worker's free list, refilled from the arena a batch at a time
+// Returns NULL when out of memory
+static Chip8SearchPage *search_page_alloc(Chip8Search *search, Chip8SearchWorker *worker)
+{
+    if (worker->free_pages == NULL)
+    {
+        pthread_mutex_lock(&search->lock);
+        if (search->free_pages == NULL)
+        {
+            search_grow(search);
+        }
+        for (uint32_t i = 0; i < CHIP8_SEARCH_PAGE_BATCH && search->free_pages != NULL; i++)
+        {
+            Chip8SearchPage *page = search->free_pages;
+            search->free_pages = page->next_free;
+            page->next_free = worker->free_pages;
+            worker->free_pages = page;
+        }
+        pthread_mutex_unlock(&search->lock);
+
+        if (worker->free_pages == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    Chip8SearchPage *page = worker->free_pages;
+    worker->free_pages = page->next_free;
+    page->id = worker->next_id++;
+    atomic_store_explicit(&page->references, 1, memory_order_relaxed);
+
+    return page;
+}
+
+// Drops the node's references, pages nobody references any more go to `free_pages`
+static void search_release(Chip8SearchPage **free_pages, Chip8SearchNode *node, uint32_t num_pages)
+{
+    for (uint32_t p = 0; p < num_pages; p++)
+    {
+        Chip8SearchPage *page = node->pages[p];
+        if (atomic_fetch_sub_explicit(&page->references, 1, memory_order_acq_rel) == 1)
+        {
+            page->next_free = *free_pages;
+            *free_pages = page;
+        }
+    }
+}
+
+/// ********************
+/// States             *
+/// ********************
+
+// FNV-1a, continued from `hash`
+static uint64_t search_hash(uint64_t hash, const void *data, uint32_t size)
+{
+    const uint8_t *bytes = data;
+    for (uint32_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+static uint32_t search_stack_depth(const Stack *stack)
+{
+    uint8_t depth = (uint8_t)(stack->top + 1);
+
+    return depth < CHIP8_STACK_SIZE ? depth : CHIP8_STACK_SIZE;
+}
+
+// Of everything a fork's future depends on, with the pages by contents, never 0
+static uint64_t search_node_hash(const Chip8SearchNode *node)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    hash = search_hash(hash, node->display, sizeof(node->display));
+    hash = search_hash(hash, node->V, sizeof(node->V));
+    hash = search_hash(hash, &node->pc, sizeof(node->pc));
+    hash = search_hash(hash, &node->I, sizeof(node->I));
+    hash = search_hash(hash, &node->stack.top, sizeof(node->stack.top));
+    hash = search_hash(hash, node->stack.arr, search_stack_depth(&node->stack) * sizeof(node->stack.arr[0]));
+    hash = search_hash(hash, &node->delay_timer, sizeof(node->delay_timer));
+    hash = search_hash(hash, &node->sound_timer, sizeof(node->sound_timer));
+    hash = search_hash(hash, &node->rng_state, sizeof(node->rng_state));
+    hash = search_hash(hash, &node->timer_phase, sizeof(node->timer_phase));
+    for (uint32_t p = 0; p < CHIP8_SEARCH_NUM_PAGES; p++)
+    {
+        hash = search_hash(hash, &node->pages[p]->hash, sizeof(node->pages[p]->hash));
+    }
+
+    return hash != 0 ? hash : 1;
+}
+
+static int search_same_state(const Chip8SearchNode *a, const Chip8SearchNode *b)
+{
+    if (a->hash != b->hash || a->pc != b->pc || a->I != b->I || a->delay_timer != b->delay_timer ||
+        a->sound_timer != b->sound_timer || a->rng_state != b->rng_state || a->timer_phase != b->timer_phase ||
+        a->stack.top != b->stack.top || memcmp(a->V, b->V, sizeof(a->V)) != 0 ||
+        memcmp(a->stack.arr, b->stack.arr, search_stack_depth(&a->stack) * sizeof(a->stack.arr[0])) != 0 ||
+        !chip8_display_equal(a->display, b->display))
+    {
+        return 0;
+    }
+
+    for (uint32_t p = 0; p < CHIP8_SEARCH_NUM_PAGES; p++)
+    {
+        if (a->pages[p] != b->pages[p] && memcmp(a->pages[p]->data, b->pages[p]->data, CHIP8_SEARCH_PAGE_SIZE) != 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void search_save_registers(Chip8SearchNode *node, const Chip8 *chip8)
+{
+    chip8_display_copy(node->display, chip8->display);
+    memcpy(node->V, chip8->V, sizeof(node->V));
+    node->pc = chip8->pc;
+    node->I = chip8->I;
+    node->stack = chip8->stack;
+    node->delay_timer = chip8->delay_timer;
+    node->sound_timer = chip8->sound_timer;
+    node->cycles = chip8->cycles;
+    node->rng_state = chip8->rng_state;
+}
+
+static void search_load_registers(Chip8 *chip8, const Chip8SearchNode *node)
+{
+    chip8_display_copy(chip8->display, node->display);
+    memcpy(chip8->V, node->V, sizeof(chip8->V));
+    chip8->pc = node->pc;
+    chip8->I = node->I;
+    chip8->stack = node->stack;
+    chip8->delay_timer = node->delay_timer;
+    chip8->sound_timer = node->sound_timer;
+    chip8->cycles = node->cycles;
+    chip8->rng_state = node->rng_state;
+    chip8->idle = CHIP8_IDLE_NONE;
+    chip8->dirty_rows = 0xFFFFFFFF;
+}
+
+// Switches the worker's machine to the node, copying only the pages it does not hold already
+static void search_load(Chip8SearchWorker *worker, const Chip8SearchNode *node)
+{
+    Chip8 *chip8 = &worker->chip8;
+
+    for (uint32_t p = 0; p < CHIP8_SEARCH_NUM_PAGES; p++)
+    {
+        const Chip8SearchPage *page = node->pages[p];
+        if (worker->loaded[p] != page->id)
+        {
+            memcpy(&chip8->memory[p * CHIP8_SEARCH_PAGE_SIZE], page->data, CHIP8_SEARCH_PAGE_SIZE);
+            chip8_cache_invalidate(&worker->cache, p * CHIP8_SEARCH_PAGE_SIZE, CHIP8_SEARCH_PAGE_SIZE);
+            worker->loaded[p] = page->id;
+        }
+    }
+    chip8->dirty_pages = 0;
+
+    search_load_registers(chip8, node);
+    worker->scheduler.timer_phase = node->timer_phase;
+}
+
+// Stores the worker's machine as a fork of `parent`, sharing the pages it did not change
+// Returns 1 when out of memory, the fork is then left without pages (hash 0)
+static int search_store(Chip8Search *search, Chip8SearchWorker *worker, const Chip8SearchNode *parent,
+                        Chip8SearchNode *fork)
+{
+    const Chip8 *chip8 = &worker->chip8;
+
+    for (uint32_t p = 0; p < CHIP8_SEARCH_NUM_PAGES; p++)
+    {
+        Chip8SearchPage *page = parent->pages[p];
+        const uint8_t *data = &chip8->memory[p * CHIP8_SEARCH_PAGE_SIZE];
+
+        // Most writes (score digits, FX55 scratch) store what was there already
+        if (((chip8->dirty_pages >> p) & 1) && memcmp(data, page->data, CHIP8_SEARCH_PAGE_SIZE) != 0)
+        {
+            page = search_page_alloc(search, worker);
+            if (page == NULL)
+            {
+                // Live memory no longer matches what the worker thinks it holds
+                for (uint32_t q = p; q < CHIP8_SEARCH_NUM_PAGES; q++)
+                {
+                    if ((chip8->dirty_pages >> q) & 1)
+                    {
+                        worker->loaded[q] = 0;
+                    }
+                }
+                search_release(&worker->free_pages, fork, p);
+                fork->hash = 0;
+                return 1;
+            }
+
+            memcpy(page->data, data, CHIP8_SEARCH_PAGE_SIZE);
+            page->hash = chip8_rom_hash(page->data, CHIP8_SEARCH_PAGE_SIZE);
+            worker->loaded[p] = page->id;
+            worker->pages_written++;
+        }
+        else
+        {
+            atomic_fetch_add_explicit(&page->references, 1, memory_order_relaxed);
+            worker->pages_shared++;
+        }
+
+        fork->pages[p] = page;
+    }
+
+    search_save_registers(fork, chip8);
+    fork->timer_phase = worker->scheduler.timer_phase;
+    fork->hash = search_node_hash(fork);
+
+    return 0;
+}
+
+/// ********************
+/// Expansion          *
+/// ********************
+
+// There is one worker per pool thread plus one for the submitting thread, which runs a task inline
+// when it cannot be queued, so one is always idle when a task starts
+static Chip8SearchWorker *search_checkout(Chip8Search *search)
+{
+    pthread_mutex_lock(&search->lock);
+    Chip8SearchWorker *worker = search->idle_workers;
+    search->idle_workers = worker->next_idle;
+    pthread_mutex_unlock(&search->lock);
+
+    return worker;
+}
+
+static void search_checkin(Chip8Search *search, Chip8SearchWorker *worker)
+{
+    pthread_mutex_lock(&search->lock);
+    worker->next_idle = search->idle_workers;
+    search->idle_workers = worker;
+    pthread_mutex_unlock(&search->lock);
+}
+
+// Runs every input from one state of the beam
+static void search_expand(void *arg)
+{
+    SearchTask *task = arg;
+    Chip8Search *search = task->search;
+    const Chip8SearchConfig *config = &search->config;
+    const Chip8SearchNode *node = &search->beam[task->index];
+    Chip8SearchWorker *worker = search_checkout(search);
+
+    for (uint32_t input = 0; input < CHIP8_SEARCH_NUM_INPUTS; input++)
+    {
+        Chip8SearchNode *fork = &search->forks[task->index * CHIP8_SEARCH_NUM_INPUTS + input];
+        uint16_t keys = input == 0 ? 0 : (uint16_t)(1u << (input - 1));
+
+        search_load(worker, node);
+        chip8_set_keypad_mask(&worker->chip8, keys);
+        for (uint32_t frame = 0; frame < config->frames_per_input; frame++)
+        {
+            chip8_scheduler_run_frame(&worker->scheduler, &worker->chip8);
+        }
+
+        fork->parent = task->index;
+        fork->keys = keys;
+        if (search_store(search, worker, node, fork) == 0)
+        {
+            fork->score = config->score(&worker->chip8, config->context);
+        }
+    }
+
+    search_checkin(search, worker);
+}
+
+// Best first, ties in fork order so the result does not depend on the thread timing
+static int search_compare_ranks(const void *a, const void *b)
+{
+    const SearchRank *x = a;
+    const SearchRank *y = b;
+
+    if (x->score != y->score)
+    {
+        return x->score > y->score ? -1 : 1;
+    }
+
+    return x->index < y->index ? -1 : (x->index > y->index);
+}
+
+// Keeps the best beam_width distinct forks as the next beam, and releases everything else
+// `table` has `table_size` slots (a power of 2 above beam_width), for finding duplicates
+static void search_select(Chip8Search *search, SearchRank ranks[], uint32_t table[], uint32_t table_size)
+{
+    uint32_t beam_width = search->config.beam_width;
+    uint32_t num_forks = search->beam_size * CHIP8_SEARCH_NUM_INPUTS;
+    uint32_t *parents = &search->path_parents[search->depth_reached * beam_width];
+    uint16_t *keys = &search->path_keys[search->depth_reached * beam_width];
+
+    for (uint32_t i = 0; i < num_forks; i++)
+    {
+        ranks[i].score = search->forks[i].score;
+        ranks[i].index = i;
+    }
+    qsort(ranks, num_forks, sizeof(SearchRank), search_compare_ranks);
+
+    memset(table, 0, table_size * sizeof(uint32_t));
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < num_forks; i++)
+    {
+        Chip8SearchNode *fork = &search->forks[ranks[i].index];
+        if (fork->hash == 0)
+        {
+            continue;
+        }
+
+        // Slots hold the beam index + 1, 0 is empty
+        int duplicate = 0;
+        uint32_t slot = (uint32_t)fork->hash & (table_size - 1);
+        while (table[slot] != 0)
+        {
+            if (search_same_state(&search->next_beam[table[slot] - 1], fork))
+            {
+                duplicate = 1;
+                break;
+            }
+            slot = (slot + 1) & (table_size - 1);
+        }
+
+        if (duplicate || kept == beam_width)
+        {
+            search->duplicates += duplicate;
+            search_release(&search->free_pages, fork, CHIP8_SEARCH_NUM_PAGES);
+            continue;
+        }
+
+        table[slot] = kept + 1;
+        parents[kept] = fork->parent;
+        keys[kept] = fork->keys;
+        search->next_beam[kept++] = *fork;
+    }
+
+    for (uint32_t i = 0; i < search->beam_size; i++)
+    {
+        search_release(&search->free_pages, &search->beam[i], CHIP8_SEARCH_NUM_PAGES);
+    }
+
+    Chip8SearchNode *beam = search->beam;
+    search->beam = search->next_beam;
+    search->next_beam = beam;
+    search->beam_size = kept;
+}
+
+/// ********************
+/// Search             *
+/// ********************
+
+// The root is taken to be at a timer tick, e.g. right after boot or chip8_scheduler_run_frame
+int chip8_search_init(Chip8Search *search, const Chip8 *root, const Chip8SearchConfig *config, ThreadPool *pool)
+{
+    memset(search, 0, sizeof(Chip8Search));
+    if (config->beam_width == 0 || config->score == NULL)
+    {
+        return 1;
+    }
+
+    search->config = *config;
+    search->pool = pool;
+    search->root = *root;
+    search->root.trace = NULL;
+    search->root.profile = NULL;
+    pthread_mutex_init(&search->lock, NULL);
+
+    uint32_t beam_width = config->beam_width;
+    search->num_workers = pool->num_threads + 1;
+    search->workers = malloc(search->num_workers * sizeof(Chip8SearchWorker));
+    search->beam = malloc(beam_width * sizeof(Chip8SearchNode));
+    search->next_beam = malloc(beam_width * sizeof(Chip8SearchNode));
+    search->forks = malloc(beam_width * CHIP8_SEARCH_NUM_INPUTS * sizeof(Chip8SearchNode));
+    search->path_parents = malloc(((size_t)config->depth * beam_width + 1) * sizeof(uint32_t));
+    search->path_keys = malloc(((size_t)config->depth * beam_width + 1) * sizeof(uint16_t));
+    if (search->workers == NULL || search->beam == NULL || search->next_beam == NULL || search->forks == NULL ||
+        search->path_parents == NULL || search->path_keys == NULL)
+    {
+        chip8_search_free(search);
+        return 1;
+    }
+
+    for (uint32_t w = 0; w < search->num_workers; w++)
+    {
+        Chip8SearchWorker *worker = &search->workers[w];
+
+        worker->chip8 = search->root;
+        chip8_cache_reset(&worker->cache);
+        chip8_scheduler_init(&worker->scheduler, config->clock_frequency, 0);
+        worker->scheduler.run = search_run_cache;
+        worker->scheduler.engine = &worker->cache;
+
+        memset(worker->loaded, 0, sizeof(worker->loaded));
+        worker->free_pages = NULL;
+        worker->next_id = (uint64_t)(w + 1) << 48 | 1;
+        worker->next_idle = search->idle_workers;
+        search->idle_workers = worker;
+        worker->pages_written = 0;
+        worker->pages_shared = 0;
+    }
+
+    // The root's pages are the first ones, its memory is what every worker starts with
+    Chip8SearchNode *node = &search->beam[0];
+    for (uint32_t p = 0; p < CHIP8_SEARCH_NUM_PAGES; p++)
+    {
+        Chip8SearchPage *page = search_page_alloc(search, &search->workers[0]);
+        if (page == NULL)
+        {
+            chip8_search_free(search);
+            return 1;
+        }
+        memcpy(page->data, &root->memory[p * CHIP8_SEARCH_PAGE_SIZE], CHIP8_SEARCH_PAGE_SIZE);
+        page->hash = chip8_rom_hash(page->data, CHIP8_SEARCH_PAGE_SIZE);
+        node->pages[p] = page;
+
+        for (uint32_t w = 0; w < search->num_workers; w++)
+        {
+            search->workers[w].loaded[p] = page->id;
+        }
+    }
+    search_save_registers(node, root);
+    node->timer_phase = 0;
+    node->hash = search_node_hash(node);
+    node->score = config->score(root, config->context);
+    node->parent = 0;
+    node->keys = chip8_keypad_mask(root);
+    search->beam_size = 1;
+
+    return 0;
+}
+
+// Runs the search to the configured depth, returns 1 if it ran out of memory on the way
+int chip8_search_run(Chip8Search *search)
+{
+    uint32_t beam_width = search->config.beam_width;
+    uint32_t num_forks = beam_width * CHIP8_SEARCH_NUM_INPUTS;
+    uint32_t table_size = 1;
+    while (table_size < 2 * beam_width)
+    {
+        table_size *= 2;
+    }
+
+    SearchTask *tasks = malloc(beam_width * sizeof(SearchTask));
+    SearchRank *ranks = malloc(num_forks * sizeof(SearchRank));
+    uint32_t *table = malloc(table_size * sizeof(uint32_t));
+    if (tasks == NULL || ranks == NULL || table == NULL)
+    {
+        free(tasks);
+        free(ranks);
+        free(table);
+        return 1;
+    }
+
+    while (search->depth_reached < search->config.depth && !search->out_of_memory)
+    {
+        for (uint32_t i = 0; i < search->beam_size; i++)
+        {
+            tasks[i].search = search;
+            tasks[i].index = i;
+            if (thread_pool_submit(search->pool, search_expand, &tasks[i]) != 0)
+            {
+                search_expand(&tasks[i]);
+            }
+        }
+        thread_pool_wait(search->pool);
+
+        search->forks_run += search->beam_size * CHIP8_SEARCH_NUM_INPUTS;
+        search_select(search, ranks, table, table_size);
+        search->depth_reached++;
+    }
+
+    for (uint32_t w = 0; w < search->num_workers; w++)
+    {
+        search->pages_written += search->workers[w].pages_written;
+        search->pages_shared += search->workers[w].pages_shared;
+        search->workers[w].pages_written = 0;
+        search->workers[w].pages_shared = 0;
+    }
+
+    free(tasks);
+    free(ranks);
+    free(table);
+
+    return search->out_of_memory;
+}
+
+// Rebuilds the best state found into `chip8` and its inputs into `keys` (depth_reached entries)
+// Returns its score
+double chip8_search_best(const Chip8Search *search, Chip8 *chip8, uint16_t keys[])
+{
+    uint32_t beam_width = search->config.beam_width;
+    const Chip8SearchNode *node = &search->beam[0];
+
+    *chip8 = search->root;
+    for (uint32_t p = 0; p < CHIP8_SEARCH_NUM_PAGES; p++)
+    {
+        memcpy(&chip8->memory[p * CHIP8_SEARCH_PAGE_SIZE], node->pages[p]->data, CHIP8_SEARCH_PAGE_SIZE);
+    }
+    chip8->dirty_pages = 0xFFFF;
+    search_load_registers(chip8, node);
+    chip8_set_keypad_mask(chip8, node->keys);
+
+    uint32_t slot = 0;
+    for (uint32_t depth = search->depth_reached; depth > 0; depth--)
+    {
+        keys[depth - 1] = search->path_keys[(depth - 1) * beam_width + slot];
+        slot = search->path_parents[(depth - 1) * beam_width + slot];
+    }
+
+    return node->score;
+}
+
+// Size of the page arena, in pages
+uint64_t chip8_search_pool_pages(const Chip8Search *search)
+{
+    return (uint64_t)search->num_blocks * CHIP8_SEARCH_PAGE_BLOCK;
+}
+
+void chip8_search_free(Chip8Search *search)
+{
+    for (uint32_t i = 0; i < search->num_blocks; i++)
+    {
+        free(search->blocks[i]);
+    }
+    free(search->blocks);
+    free(search->workers);
+    free(search->beam);
+    free(search->next_beam);
+    free(search->forks);
+    free(search->path_parents);
+    free(search->path_keys);
+    pthread_mutex_destroy(&search->lock);
+
+    memset(search, 0, sizeof(Chip8Search));
+}
@@ -0,0 +1,165 @@
+#ifndef CHIP8_SEARCH_H
+#define CHIP8_SEARCH_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "chip8.h"
+#include "chip8_cache.h"
+#include "chip8_scheduler.h"
+#include "thread_pool.h"
+
+// State-space search
+// Beam search over keypad inputs, for automated game testing and bots. Every state of the beam
+// is forked once per input (no key, or one of the 16 keys held alone), each fork runs
+// frames_per_input frames, the forks are scored by a callback and the best beam_width distinct
+// ones form the next beam. The forks of one state are one task on the thread pool, so idle
+// workers steal whole states from busy ones.
+//
+// Forking does not copy memory. A stored state keeps its registers and display, and 16 pointers
+// to reference counted pages of 256 bytes of memory. A fork shares every page of its parent
+// except the ones its instructions wrote (chip8->dirty_pages) with a different result, which
+// get a page from a pooled arena. Each worker runs one live Chip8, and when it switches to
+// another state it only copies in the pages that differ from the ones it holds, invalidating
+// just those pages of its instruction cache.
+//
+// The result only depends on the root state and the configuration, not on the number of threads.
+
+enum
+{
+    CHIP8_SEARCH_PAGE_SIZE = 256,
+    CHIP8_SEARCH_NUM_PAGES = CHIP8_MEMORY_SIZE / CHIP8_SEARCH_PAGE_SIZE,
+    CHIP8_SEARCH_NUM_INPUTS = CHIP8_NUM_KEYS + 1, // No key, then keys 0 to F
+
+    // Pages the arena grows by when its free list runs dry, and pages a worker takes at once
+    CHIP8_SEARCH_PAGE_BLOCK = 1024,
+    CHIP8_SEARCH_PAGE_BATCH = 64
+};
+
+// Higher is better, called from the worker threads with the machine right after a fork ran
+typedef double (*Chip8SearchScore)(const Chip8 *chip8, void *context);
+
+typedef struct
+{
+    uint32_t beam_width;       // States kept per depth
+    uint32_t depth;            // Number of inputs in a path
+    uint32_t frames_per_input; // Frames (timer ticks) each input is held for
+    uint32_t clock_frequency;
+
+    Chip8SearchScore score;
+    void *context;
+} Chip8SearchConfig;
+
+typedef struct Chip8SearchPage Chip8SearchPage;
+
+struct Chip8SearchPage
+{
+    atomic_uint references;
+
+    // Never reused, tells a worker whether its live memory still holds this page
+    uint64_t id;
+
+    // Of the contents, for finding duplicate states
+    uint64_t hash;
+
+    Chip8SearchPage *next_free;
+    uint8_t data[CHIP8_SEARCH_PAGE_SIZE];
+};
+
+// A stored state, everything not in here (quirks, ROM hash) is the root's
+typedef struct
+{
+    Chip8SearchPage *pages[CHIP8_SEARCH_NUM_PAGES];
+    uint64_t display[CHIP8_SCREEN_HEIGHT];
+    uint8_t V[CHIP8_NUM_VAR_REGISTERS];
+    uint16_t pc;
+    uint16_t I;
+    Stack stack;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint64_t cycles;
+    uint64_t rng_state;
+    uint64_t timer_phase;
+
+    // Of the state above, 0 for forks that could not be stored (out of memory)
+    uint64_t hash;
+
+    double score;
+
+    // Index of the state it was forked from in the previous beam, and the keys held since
+    uint32_t parent;
+    uint16_t keys;
+} Chip8SearchNode;
+
+// Machine and instruction cache of one worker thread, or of the thread running the search
+typedef struct Chip8SearchWorker Chip8SearchWorker;
+
+struct Chip8SearchWorker
+{
+    Chip8 chip8;
+    Chip8Cache cache;
+    Chip8Scheduler scheduler;
+
+    // Id of the page held in each page of live memory, 0 if unknown
+    uint64_t loaded[CHIP8_SEARCH_NUM_PAGES];
+
+    // Pages taken from the arena, and the next page id (the worker number is in the high bits)
+    Chip8SearchPage *free_pages;
+    uint64_t next_id;
+
+    Chip8SearchWorker *next_idle;
+
+    // Statistics
+    uint64_t pages_written;
+    uint64_t pages_shared;
+};
+
+typedef struct
+{
+    Chip8SearchConfig config;
+    ThreadPool *pool;
+
+    // Template for the live machines
+    Chip8 root;
+
+    // Guards the arena and the idle workers
+    pthread_mutex_t lock;
+
+    // Page arena, the blocks are only freed with the search
+    Chip8SearchPage *free_pages;
+    Chip8SearchPage **blocks;
+    uint32_t num_blocks;
+    uint32_t max_blocks;
+    int out_of_memory;
+
+    Chip8SearchWorker *workers;
+    uint32_t num_workers;
+    Chip8SearchWorker *idle_workers;
+
+    // Current beam, sorted best first, its forks (CHIP8_SEARCH_NUM_INPUTS per state) and the
+    // beam being selected from them
+    Chip8SearchNode *beam;
+    uint32_t beam_size;
+    Chip8SearchNode *forks;
+    Chip8SearchNode *next_beam;
+
+    // Per depth and beam slot, the parent slot and the keys, to rebuild the best path
+    uint32_t *path_parents;
+    uint16_t *path_keys;
+    uint32_t depth_reached;
+
+    // Statistics
+    uint64_t forks_run;
+    uint64_t duplicates;
+    uint64_t pages_written;
+    uint64_t pages_shared;
+} Chip8Search;
+
+int chip8_search_init(Chip8Search *search, const Chip8 *root, const Chip8SearchConfig *config, ThreadPool *pool);
+int chip8_search_run(Chip8Search *search);
+double chip8_search_best(const Chip8Search *search, Chip8 *chip8, uint16_t keys[]);
+uint64_t chip8_search_pool_pages(const Chip8Search *search);
+void chip8_search_free(Chip8Search *search);
+
+#endif
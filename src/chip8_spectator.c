@@ -0,0 +1,569 @@
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "chip8_spectator.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define SPECTATOR_NO_SOCKET ((intptr_t)-1)
+
+/// ********************
+/// Encoding           *
+/// ********************
+
+static void put_uint(uint8_t *buffer, uint64_t value, uint32_t bytes)
+{
+    for (uint32_t i = 0; i < bytes; i++)
+    {
+        buffer[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint64_t get_uint(const uint8_t *buffer, uint32_t bytes)
+{
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < bytes; i++)
+    {
+        value |= (uint64_t)buffer[i] << (8 * i);
+    }
+    return value;
+}
+
+// Byte i of the display as sent, 8 per row with the leftmost pixels first
+static uint8_t display_byte(const uint64_t display[], uint32_t i)
+{
+    return (uint8_t)(display[i / 8] >> (56 - 8 * (i % 8)));
+}
+
+// Returns the payload size, 0 if nothing changed
+// payload needs room for CHIP8_SPECTATOR_MAX_MESSAGE_SIZE bytes, more than
+// CHIP8_SPECTATOR_DISPLAY_SIZE means a keyframe is smaller
+size_t chip8_spectator_encode_delta(const uint64_t previous[], const uint64_t display[], uint8_t payload[])
+{
+    uint8_t changes[CHIP8_SPECTATOR_DISPLAY_SIZE];
+    for (uint32_t i = 0; i < CHIP8_SPECTATOR_DISPLAY_SIZE; i++)
+    {
+        changes[i] = display_byte(previous, i) ^ display_byte(display, i);
+    }
+
+    size_t size = 0;
+    uint32_t i = 0;
+    while (i < CHIP8_SPECTATOR_DISPLAY_SIZE)
+    {
+        uint32_t skip = 0;
+        while (i < CHIP8_SPECTATOR_DISPLAY_SIZE && changes[i] == 0 && skip < 255)
+        {
+            i++;
+            skip++;
+        }
+
+        // Unchanged to the end
+        uint32_t rest = i;
+        while (rest < CHIP8_SPECTATOR_DISPLAY_SIZE && changes[rest] == 0)
+        {
+            rest++;
+        }
+        if (rest == CHIP8_SPECTATOR_DISPLAY_SIZE)
+        {
+            break;
+        }
+
+        // Gaps of up to 2 unchanged bytes cost no more inside the run than a new run
+        uint32_t start = i;
+        uint32_t count = 0;
+        while (i < CHIP8_SPECTATOR_DISPLAY_SIZE && count < 255)
+        {
+            uint32_t gap = 0;
+            while (i + gap < CHIP8_SPECTATOR_DISPLAY_SIZE && changes[i + gap] == 0 && gap < 3)
+            {
+                gap++;
+            }
+            if (gap == 3 || i + gap == CHIP8_SPECTATOR_DISPLAY_SIZE)
+            {
+                break;
+            }
+            i++;
+            count++;
+        }
+
+        payload[size++] = (uint8_t)skip;
+        payload[size++] = (uint8_t)count;
+        memcpy(&payload[size], &changes[start], count);
+        size += count;
+    }
+
+    return size;
+}
+
+// Returns 0 on success, 1 on a malformed payload (the display is then undefined)
+int chip8_spectator_apply(uint64_t display[], uint8_t type, const uint8_t payload[], size_t size)
+{
+    if (type == CHIP8_SPECTATOR_KEYFRAME)
+    {
+        if (size != CHIP8_SPECTATOR_DISPLAY_SIZE)
+        {
+            return 1;
+        }
+        for (uint32_t y = 0; y < CHIP8_SCREEN_HEIGHT; y++)
+        {
+            display[y] = 0;
+            for (uint32_t b = 0; b < 8; b++)
+            {
+                display[y] = (display[y] << 8) | payload[y * 8 + b];
+            }
+        }
+        return 0;
+    }
+
+    if (type != CHIP8_SPECTATOR_DELTA)
+    {
+        return 1;
+    }
+
+    uint32_t offset = 0;
+    size_t i = 0;
+    while (i < size)
+    {
+        if (i + 2 > size)
+        {
+            return 1;
+        }
+        offset += payload[i];
+        uint32_t count = payload[i + 1];
+        i += 2;
+
+        if (i + count > size || offset + count > CHIP8_SPECTATOR_DISPLAY_SIZE)
+        {
+            return 1;
+        }
+        for (uint32_t c = 0; c < count; c++, offset++)
+        {
+            display[offset / 8] ^= (uint64_t)payload[i + c] << (56 - 8 * (offset % 8));
+        }
+        i += count;
+    }
+
+    return 0;
+}
+
+// Builds a whole message, returns its size
+static size_t spectator_message(uint8_t message[], uint8_t type, uint32_t frame, const uint8_t payload[], size_t size)
+{
+    message[0] = type;
+    put_uint(&message[1], frame, 4);
+    put_uint(&message[5], size, 2);
+    memcpy(&message[CHIP8_SPECTATOR_MESSAGE_HEADER_SIZE], payload, size);
+
+    return CHIP8_SPECTATOR_MESSAGE_HEADER_SIZE + size;
+}
+
+static size_t spectator_keyframe(uint8_t message[], uint32_t frame, const uint64_t display[])
+{
+    uint8_t payload[CHIP8_SPECTATOR_DISPLAY_SIZE];
+    for (uint32_t i = 0; i < CHIP8_SPECTATOR_DISPLAY_SIZE; i++)
+    {
+        payload[i] = display_byte(display, i);
+    }
+
+    return spectator_message(message, CHIP8_SPECTATOR_KEYFRAME, frame, payload, sizeof(payload));
+}
+
+/// ********************
+/// Sockets            *
+/// ********************
+
+static void spectator_close(intptr_t socket)
+{
+#ifdef _WIN32
+    closesocket((SOCKET)socket);
+#else
+    close((int)socket);
+#endif
+}
+
+static int spectator_set_nonblocking(intptr_t socket)
+{
+#ifdef _WIN32
+    u_long enable = 1;
+    return ioctlsocket((SOCKET)socket, FIONBIO, &enable) != 0;
+#else
+    int flags = fcntl((int)socket, F_GETFL, 0);
+    return flags < 0 || fcntl((int)socket, F_SETFL, flags | O_NONBLOCK) != 0;
+#endif
+}
+
+static int spectator_would_block(void)
+{
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+static int spectator_address(struct sockaddr_un *address, const char *path)
+{
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path))
+    {
+        return 1;
+    }
+    strcpy(address->sun_path, path);
+
+    return 0;
+}
+
+// Sends what the socket takes without blocking
+// Returns the number of bytes sent, -1 if the viewer is gone
+static int spectator_send(intptr_t socket, const uint8_t *data, uint32_t size)
+{
+#ifdef _WIN32
+    int sent = send((SOCKET)socket, (const char *)data, (int)size, 0);
+#else
+    int sent = (int)send((int)socket, data, size, MSG_NOSIGNAL);
+#endif
+    if (sent < 0)
+    {
+        return spectator_would_block() ? 0 : -1;
+    }
+
+    return sent;
+}
+
+/// ********************
+/// Publishing         *
+/// ********************
+
+// Returns 1 if the viewer is gone
+static int client_flush(Chip8SpectatorClient *client, uint64_t *bytes_sent)
+{
+    if (client->pending_size == 0)
+    {
+        return 0;
+    }
+
+    int sent = spectator_send(client->socket, &client->pending[client->pending_start], client->pending_size);
+    if (sent < 0)
+    {
+        return 1;
+    }
+
+    client->pending_start += sent;
+    client->pending_size -= sent;
+    *bytes_sent += sent;
+    if (client->pending_size == 0)
+    {
+        client->pending_start = 0;
+    }
+
+    return 0;
+}
+
+// Only called with nothing pending
+static int client_send(Chip8SpectatorClient *client, const uint8_t *data, size_t size, uint64_t *bytes_sent)
+{
+    memcpy(&client->pending[client->pending_size], data, size);
+    client->pending_size += size;
+
+    return client_flush(client, bytes_sent);
+}
+
+static void spectator_remove(Chip8Spectator *spectator, uint32_t index)
+{
+    spectator_close(spectator->clients[index].socket);
+    spectator->clients[index] = spectator->clients[--spectator->num_clients];
+}
+
+// New viewers get the header and a keyframe of what the others have
+static void spectator_accept(Chip8Spectator *spectator)
+{
+    for (;;)
+    {
+#ifdef _WIN32
+        SOCKET accepted = accept((SOCKET)spectator->listener, NULL, NULL);
+        intptr_t socket = accepted == INVALID_SOCKET ? SPECTATOR_NO_SOCKET : (intptr_t)accepted;
+#else
+        intptr_t socket = accept((int)spectator->listener, NULL, NULL);
+#endif
+        if (socket == SPECTATOR_NO_SOCKET)
+        {
+            return;
+        }
+
+        if (spectator->num_clients == CHIP8_SPECTATOR_MAX_CLIENTS || spectator_set_nonblocking(socket) != 0)
+        {
+            spectator_close(socket);
+            continue;
+        }
+
+#if defined(SO_NOSIGPIPE)
+        int enable = 1;
+        setsockopt((int)socket, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+
+        Chip8SpectatorClient *client = &spectator->clients[spectator->num_clients++];
+        client->socket = socket;
+        client->pending_start = 0;
+        client->pending_size = CHIP8_SPECTATOR_HEADER_SIZE;
+        client->needs_keyframe = 0;
+
+        memcpy(client->pending, CHIP8_SPECTATOR_MAGIC, 4);
+        put_uint(&client->pending[4], CHIP8_SPECTATOR_VERSION, 2);
+        client->pending_size += spectator_keyframe(&client->pending[CHIP8_SPECTATOR_HEADER_SIZE], spectator->frame,
+                                                   spectator->display);
+    }
+}
+
+// Returns 0 on success, viewers connect to path
+int chip8_spectator_init(Chip8Spectator *spectator, const char *path)
+{
+    memset(spectator, 0, sizeof(*spectator));
+    spectator->listener = SPECTATOR_NO_SOCKET;
+
+    struct sockaddr_un address;
+    if (spectator_address(&address, path) != 0)
+    {
+        return 1;
+    }
+    snprintf(spectator->path, sizeof(spectator->path), "%s", path);
+
+#ifdef _WIN32
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+    {
+        return 1;
+    }
+    DeleteFileA(path);
+    SOCKET listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    spectator->listener = listener == INVALID_SOCKET ? SPECTATOR_NO_SOCKET : (intptr_t)listener;
+#else
+    // A socket file left behind by a previous run
+    unlink(path);
+    spectator->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+#endif
+    if (spectator->listener == SPECTATOR_NO_SOCKET)
+    {
+        chip8_spectator_free(spectator);
+        return 1;
+    }
+
+#ifdef _WIN32
+    int failed = bind((SOCKET)spectator->listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+                 listen((SOCKET)spectator->listener, SOMAXCONN) != 0;
+#else
+    int failed = bind((int)spectator->listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+                 listen((int)spectator->listener, SOMAXCONN) != 0;
+#endif
+    if (failed || spectator_set_nonblocking(spectator->listener) != 0)
+    {
+        chip8_spectator_free(spectator);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Sends the display to every viewer, call once per presented frame whether it changed or not
+// A viewer still busy with an earlier message skips this one and gets a keyframe later.
+void chip8_spectator_publish(Chip8Spectator *spectator, const uint64_t display[])
+{
+    spectator_accept(spectator);
+
+    spectator->frame++;
+    int keyframe_due = spectator->frame - spectator->last_keyframe >= CHIP8_SPECTATOR_KEYFRAME_INTERVAL;
+
+    uint8_t payload[CHIP8_SPECTATOR_MAX_MESSAGE_SIZE];
+    uint8_t delta[CHIP8_SPECTATOR_MAX_MESSAGE_SIZE];
+    size_t delta_size = 0;
+
+    size_t payload_size = chip8_spectator_encode_delta(spectator->display, display, payload);
+    if (payload_size > CHIP8_SPECTATOR_DISPLAY_SIZE)
+    {
+        keyframe_due = 1;
+    }
+    else if (payload_size > 0)
+    {
+        delta_size = spectator_message(delta, CHIP8_SPECTATOR_DELTA, spectator->frame, payload, payload_size);
+    }
+
+    memcpy(spectator->display, display, sizeof(spectator->display));
+    if (keyframe_due)
+    {
+        spectator->last_keyframe = spectator->frame;
+    }
+
+    uint8_t keyframe[CHIP8_SPECTATOR_MAX_MESSAGE_SIZE];
+    size_t keyframe_size = spectator_keyframe(keyframe, spectator->frame, display);
+
+    uint32_t i = 0;
+    while (i < spectator->num_clients)
+    {
+        Chip8SpectatorClient *client = &spectator->clients[i];
+        int gone = client_flush(client, &spectator->bytes_sent);
+
+        if (!gone && client->pending_size > 0)
+        {
+            client->needs_keyframe = 1;
+        }
+        else if (!gone && (keyframe_due || client->needs_keyframe))
+        {
+            client->needs_keyframe = 0;
+            gone = client_send(client, keyframe, keyframe_size, &spectator->bytes_sent);
+        }
+        else if (!gone && delta_size > 0)
+        {
+            gone = client_send(client, delta, delta_size, &spectator->bytes_sent);
+        }
+
+        if (gone)
+        {
+            spectator_remove(spectator, i);
+            continue;
+        }
+        i++;
+    }
+}
+
+void chip8_spectator_free(Chip8Spectator *spectator)
+{
+    while (spectator->num_clients > 0)
+    {
+        spectator_remove(spectator, 0);
+    }
+
+    if (spectator->listener != SPECTATOR_NO_SOCKET)
+    {
+        spectator_close(spectator->listener);
+        spectator->listener = SPECTATOR_NO_SOCKET;
+#ifdef _WIN32
+        DeleteFileA(spectator->path);
+#else
+        unlink(spectator->path);
+#endif
+    }
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+/// ********************
+/// Viewing            *
+/// ********************
+
+// Blocks until size bytes arrived, returns 1 if the stream ended
+static int viewer_read(Chip8SpectatorViewer *viewer, uint8_t *data, size_t size)
+{
+    while (size > 0)
+    {
+#ifdef _WIN32
+        int received = recv((SOCKET)viewer->socket, (char *)data, (int)size, 0);
+#else
+        int received = (int)recv((int)viewer->socket, data, size, 0);
+#endif
+        if (received <= 0)
+        {
+            return 1;
+        }
+        data += received;
+        size -= received;
+        viewer->bytes_received += received;
+    }
+
+    return 0;
+}
+
+// Returns 0 once connected to a spectator stream
+int chip8_spectator_connect(Chip8SpectatorViewer *viewer, const char *path)
+{
+    memset(viewer, 0, sizeof(*viewer));
+    viewer->socket = SPECTATOR_NO_SOCKET;
+
+    struct sockaddr_un address;
+    if (spectator_address(&address, path) != 0)
+    {
+        return 1;
+    }
+
+#ifdef _WIN32
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+    {
+        return 1;
+    }
+    SOCKET connected = socket(AF_UNIX, SOCK_STREAM, 0);
+    viewer->socket = connected == INVALID_SOCKET ? SPECTATOR_NO_SOCKET : (intptr_t)connected;
+    int failed = viewer->socket == SPECTATOR_NO_SOCKET ||
+                 connect((SOCKET)viewer->socket, (struct sockaddr *)&address, sizeof(address)) != 0;
+#else
+    viewer->socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    int failed = viewer->socket == SPECTATOR_NO_SOCKET ||
+                 connect((int)viewer->socket, (struct sockaddr *)&address, sizeof(address)) != 0;
+#endif
+
+    uint8_t header[CHIP8_SPECTATOR_HEADER_SIZE];
+    if (failed || viewer_read(viewer, header, sizeof(header)) != 0 ||
+        memcmp(header, CHIP8_SPECTATOR_MAGIC, 4) != 0 || get_uint(&header[4], 2) != CHIP8_SPECTATOR_VERSION)
+    {
+        chip8_spectator_disconnect(viewer);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Blocks for the next message and applies it to viewer->display
+// Returns 1 when the stream ended or broke
+int chip8_spectator_receive(Chip8SpectatorViewer *viewer)
+{
+    uint8_t header[CHIP8_SPECTATOR_MESSAGE_HEADER_SIZE];
+    uint8_t payload[CHIP8_SPECTATOR_MAX_MESSAGE_SIZE];
+
+    if (viewer_read(viewer, header, sizeof(header)) != 0)
+    {
+        return 1;
+    }
+    viewer->type = header[0];
+    viewer->frame = (uint32_t)get_uint(&header[1], 4);
+    viewer->size = (uint32_t)get_uint(&header[5], 2);
+
+    if (viewer->size > CHIP8_SPECTATOR_DISPLAY_SIZE || viewer_read(viewer, payload, viewer->size) != 0)
+    {
+        return 1;
+    }
+
+    // Until the next keyframe after a bad delta, there is nothing to apply deltas to
+    if (viewer->type == CHIP8_SPECTATOR_KEYFRAME || viewer->synced)
+    {
+        viewer->synced = chip8_spectator_apply(viewer->display, viewer->type, payload, viewer->size) == 0;
+    }
+
+    return 0;
+}
+
+void chip8_spectator_disconnect(Chip8SpectatorViewer *viewer)
+{
+    if (viewer->socket != SPECTATOR_NO_SOCKET)
+    {
+        spectator_close(viewer->socket);
+        viewer->socket = SPECTATOR_NO_SOCKET;
+    }
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
@@ -0,0 +1,95 @@
+#ifndef CHIP8_SPECTATOR_H
+#define CHIP8_SPECTATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+// Spectator stream over a local (Unix domain) socket, to any number of viewers
+// A frame goes out as a delta against the previous one: the XOR of both displays with the
+// runs of unchanged bytes skipped, so a moving sprite costs a few bytes and a still screen
+// costs nothing. A keyframe (the whole display) goes out every CHIP8_SPECTATOR_KEYFRAME_INTERVAL
+// frames, to a viewer when it connects and to a viewer that fell behind, so every viewer
+// starts and recovers from a keyframe. The emulator never waits for a viewer.
+//
+// Stream, little endian: "C8SP", version u16, then one message per frame
+//      type u8 ('K' keyframe, 'D' delta), frame number u32, payload size u16, payload
+// Keyframe payload: the 256 display bytes, row after row, leftmost pixel in the top bit
+// Delta payload: runs of (skip u8, count u8, count bytes XORed into the display) over those
+// 256 bytes. A delta is never bigger than a keyframe, a keyframe is sent instead.
+
+#define CHIP8_SPECTATOR_MAGIC "C8SP"
+#define CHIP8_SPECTATOR_VERSION 1
+#define CHIP8_SPECTATOR_KEYFRAME 'K'
+#define CHIP8_SPECTATOR_DELTA 'D'
+
+enum
+{
+    CHIP8_SPECTATOR_DISPLAY_SIZE = CHIP8_SCREEN_HEIGHT * sizeof(uint64_t),
+    CHIP8_SPECTATOR_HEADER_SIZE = 6,
+    CHIP8_SPECTATOR_MESSAGE_HEADER_SIZE = 7,
+    CHIP8_SPECTATOR_MAX_MESSAGE_SIZE = CHIP8_SPECTATOR_MESSAGE_HEADER_SIZE + CHIP8_SPECTATOR_DISPLAY_SIZE,
+    CHIP8_SPECTATOR_MAX_CLIENTS = 64,
+    CHIP8_SPECTATOR_KEYFRAME_INTERVAL = 120
+};
+
+typedef struct
+{
+    intptr_t socket;
+
+    // Unsent rest of the last message, a viewer gets nothing new until this is gone
+    uint8_t pending[CHIP8_SPECTATOR_HEADER_SIZE + CHIP8_SPECTATOR_MAX_MESSAGE_SIZE];
+    uint32_t pending_start;
+    uint32_t pending_size;
+
+    // Missed a frame, its next message is a keyframe
+    int needs_keyframe;
+} Chip8SpectatorClient;
+
+// Publishing side
+typedef struct
+{
+    intptr_t listener;
+    char path[256];
+
+    Chip8SpectatorClient clients[CHIP8_SPECTATOR_MAX_CLIENTS];
+    uint32_t num_clients;
+
+    // What the viewers were last sent
+    uint64_t display[CHIP8_SCREEN_HEIGHT];
+    uint32_t frame;
+    uint32_t last_keyframe;
+
+    uint64_t bytes_sent;
+} Chip8Spectator;
+
+// Viewing side
+typedef struct
+{
+    intptr_t socket;
+    uint64_t display[CHIP8_SCREEN_HEIGHT];
+
+    // Set once a keyframe arrived, deltas before that are skipped
+    int synced;
+
+    // Last message
+    uint8_t type;
+    uint32_t frame;
+    uint32_t size;
+
+    uint64_t bytes_received;
+} Chip8SpectatorViewer;
+
+int chip8_spectator_init(Chip8Spectator *spectator, const char *path);
+void chip8_spectator_publish(Chip8Spectator *spectator, const uint64_t display[]);
+void chip8_spectator_free(Chip8Spectator *spectator);
+
+int chip8_spectator_connect(Chip8SpectatorViewer *viewer, const char *path);
+int chip8_spectator_receive(Chip8SpectatorViewer *viewer);
+void chip8_spectator_disconnect(Chip8SpectatorViewer *viewer);
+
+size_t chip8_spectator_encode_delta(const uint64_t previous[], const uint64_t display[], uint8_t payload[]);
+int chip8_spectator_apply(uint64_t display[], uint8_t type, const uint8_t payload[], size_t size);
+
+#endif
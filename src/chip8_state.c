@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "chip8_state.h"
+
+// Equal bytes shorter than this between two differing runs are cheaper to store than a new run header
+#define CHIP8_STATE_MIN_GAP 4
+
+/// ********************
+/// Byte stream        *
+/// ********************
+
+typedef struct
+{
+    uint8_t *data;
+    size_t capacity;
+    size_t length;
+    int overflow;
+} StateWriter;
+
+typedef struct
+{
+    const uint8_t *data;
+    size_t size;
+    size_t position;
+    int underflow;
+} StateReader;
+
+static void put_bytes(StateWriter *writer, const void *bytes, size_t count)
+{
+    if (writer->length + count > writer->capacity)
+    {
+        writer->overflow = 1;
+        return;
+    }
+
+    memcpy(writer->data + writer->length, bytes, count);
+    writer->length += count;
+}
+
+static void put_uint(StateWriter *writer, uint64_t value, uint8_t num_bytes)
+{
+    uint8_t bytes[8];
+    for (uint8_t i = 0; i < num_bytes; i++)
+    {
+        bytes[i] = (value >> (8 * i)) & 0xFF;
+    }
+
+    put_bytes(writer, bytes, num_bytes);
+}
+
+static const uint8_t *get_bytes(StateReader *reader, size_t count)
+{
+    if (reader->position + count > reader->size)
+    {
+        reader->underflow = 1;
+        return NULL;
+    }
+
+    const uint8_t *bytes = reader->data + reader->position;
+    reader->position += count;
+
+    return bytes;
+}
+
+static uint64_t get_uint(StateReader *reader, uint8_t num_bytes)
+{
+    const uint8_t *bytes = get_bytes(reader, num_bytes);
+    if (bytes == NULL)
+    {
+        return 0;
+    }
+
+    uint64_t value = 0;
+    for (uint8_t i = 0; i < num_bytes; i++)
+    {
+        value |= (uint64_t)bytes[i] << (8 * i);
+    }
+
+    return value;
+}
+
+/// ********************
+/// State functions    *
+/// ********************
+
+// Returns the encoded size, 0 if the buffer is too small
+size_t chip8_state_encode(const Chip8 *chip8, const Chip8Rom *rom, uint8_t *buffer, size_t capacity)
+{
+    StateWriter writer = {buffer, capacity, 0, 0};
+
+    put_bytes(&writer, CHIP8_STATE_MAGIC, 4);
+    put_uint(&writer, CHIP8_STATE_VERSION, 2);
+    put_uint(&writer, rom->hash, 8);
+    put_uint(&writer, rom->size, 2);
+
+    // Registers and timers
+    put_uint(&writer, chip8->pc, 2);
+    put_uint(&writer, chip8->I, 2);
+    put_bytes(&writer, chip8->V, CHIP8_NUM_VAR_REGISTERS);
+    put_uint(&writer, chip8->delay_timer, 1);
+    put_uint(&writer, chip8->sound_timer, 1);
+    put_uint(&writer, chip8->cycles, 8);
+    put_uint(&writer, chip8->rng_state, 8);
+
+    put_uint(&writer, chip8_keypad_mask(chip8), 2);
+
+    // Only the used part of the stack (top is -1 when empty)
+    uint8_t depth = (uint8_t)(chip8->stack.top + 1);
+    put_uint(&writer, depth, 1);
+    for (uint8_t i = 0; i < depth; i++)
+    {
+        put_uint(&writer, chip8->stack.arr[i], 2);
+    }
+
+    // Non-empty display rows
+    uint32_t row_mask = 0;
+    for (uint8_t y = 0; y < CHIP8_SCREEN_HEIGHT; y++)
+    {
+        if (chip8->display[y] != 0)
+        {
+            row_mask |= 1u << y;
+        }
+    }
+    put_uint(&writer, row_mask, 4);
+    for (uint8_t y = 0; y < CHIP8_SCREEN_HEIGHT; y++)
+    {
+        if (chip8->display[y] != 0)
+        {
+            put_uint(&writer, chip8->display[y], 8);
+        }
+    }
+
+    // Memory runs that differ from the boot image
+    uint8_t boot[CHIP8_MEMORY_SIZE];
+    chip8_boot_memory(boot, rom);
+
+    uint32_t i = 0;
+    while (i < CHIP8_MEMORY_SIZE)
+    {
+        if (chip8->memory[i] == boot[i])
+        {
+            i++;
+            continue;
+        }
+
+        // Extend the run while the next difference is less than a run header away
+        uint32_t start = i;
+        uint32_t end = i + 1;
+        for (uint32_t j = end; j < CHIP8_MEMORY_SIZE && j < end + CHIP8_STATE_MIN_GAP; j++)
+        {
+            if (chip8->memory[j] != boot[j])
+            {
+                end = j + 1;
+            }
+        }
+
+        put_uint(&writer, start, 2);
+        put_uint(&writer, end - start, 2);
+        put_bytes(&writer, &chip8->memory[start], end - start);
+
+        i = end;
+    }
+    put_uint(&writer, 0, 2);
+    put_uint(&writer, 0, 2);
+
+    return writer.overflow ? 0 : writer.length;
+}
+
+// Returns 0 on success, chip8 is left untouched on failure
+int chip8_state_decode(Chip8 *chip8, const Chip8Rom *rom, const uint8_t *buffer, size_t size)
+{
+    StateReader reader = {buffer, size, 0, 0};
+
+    const uint8_t *magic = get_bytes(&reader, 4);
+    if (magic == NULL || memcmp(magic, CHIP8_STATE_MAGIC, 4) != 0)
+    {
+        return 1;
+    }
+    uint16_t version = get_uint(&reader, 2);
+    if (version < 1 || version > CHIP8_STATE_VERSION)
+    {
+        return 1;
+    }
+
+    // The snapshot is only meaningful against the ROM it was taken with
+    if (get_uint(&reader, 8) != rom->hash || get_uint(&reader, 2) != rom->size)
+    {
+        return 1;
+    }
+
+    // Decode into a copy, so a corrupt file does not leave a half-loaded machine
+    Chip8 state = *chip8;
+
+    state.pc = get_uint(&reader, 2);
+    state.I = get_uint(&reader, 2);
+    const uint8_t *V = get_bytes(&reader, CHIP8_NUM_VAR_REGISTERS);
+    if (V != NULL)
+    {
+        memcpy(state.V, V, CHIP8_NUM_VAR_REGISTERS);
+    }
+    state.delay_timer = get_uint(&reader, 1);
+    state.sound_timer = get_uint(&reader, 1);
+    state.cycles = get_uint(&reader, 8);
+    if (version >= 2)
+    {
+        state.rng_state = get_uint(&reader, 8);
+    }
+
+    chip8_set_keypad_mask(&state, get_uint(&reader, 2));
+
+    uint8_t depth = get_uint(&reader, 1);
+    if (depth > CHIP8_STACK_SIZE)
+    {
+        return 1;
+    }
+    stack_init(&state.stack);
+    for (uint8_t i = 0; i < depth; i++)
+    {
+        state.stack.arr[i] = get_uint(&reader, 2);
+    }
+    state.stack.top = depth - 1;
+
+    uint32_t row_mask = get_uint(&reader, 4);
+    for (uint8_t y = 0; y < CHIP8_SCREEN_HEIGHT; y++)
+    {
+        state.display[y] = ((row_mask >> y) & 1) ? get_uint(&reader, 8) : 0;
+    }
+    state.dirty_rows = 0xFFFFFFFF;
+    state.dirty_pages = 0xFFFF;
+
+    chip8_boot_memory(state.memory, rom);
+    for (;;)
+    {
+        uint16_t offset = get_uint(&reader, 2);
+        uint16_t length = get_uint(&reader, 2);
+        if (reader.underflow || length == 0)
+        {
+            break;
+        }
+        if ((uint32_t)offset + length > CHIP8_MEMORY_SIZE)
+        {
+            return 1;
+        }
+
+        const uint8_t *bytes = get_bytes(&reader, length);
+        if (bytes != NULL)
+        {
+            memcpy(&state.memory[offset], bytes, length);
+        }
+    }
+
+    if (reader.underflow)
+    {
+        return 1;
+    }
+
+    state.rom_hash = rom->hash;
+    *chip8 = state;
+
+    return 0;
+}
+
+int chip8_save_state(const Chip8 *chip8, const Chip8Rom *rom, const char *filename)
+{
+    uint8_t buffer[CHIP8_STATE_MAX_SIZE];
+    size_t size = chip8_state_encode(chip8, rom, buffer, sizeof(buffer));
+    if (size == 0)
+    {
+        return 1;
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL)
+    {
+        return 1;
+    }
+
+    int failed = fwrite(buffer, 1, size, file) != size;
+    failed |= fclose(file) != 0;
+
+    return failed;
+}
+
+// The file is memory-mapped and decoded in place, without reading it into a buffer first
+int chip8_load_state(Chip8 *chip8, const Chip8Rom *rom, const char *filename)
+{
+    int failed = 1;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return 1;
+    }
+
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+
+    if (mapping != NULL)
+    {
+        const uint8_t *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (data != NULL)
+        {
+            failed = chip8_state_decode(chip8, rom, data, (size_t)size.QuadPart);
+            UnmapViewOfFile(data);
+        }
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            failed = chip8_state_decode(chip8, rom, data, info.st_size);
+            munmap(data, info.st_size);
+        }
+    }
+    close(fd);
+#endif
+
+    return failed;
+}
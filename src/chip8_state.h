@@ -0,0 +1,33 @@
+#ifndef CHIP8_STATE_H
+#define CHIP8_STATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "chip8.h"
+
+// Save states
+// Compact, versioned, little-endian binary snapshot of a Chip8.
+// Memory is stored as runs of bytes that differ from the boot image (fontset + ROM),
+// the display as its non-empty rows only. A typical snapshot is a few hundred bytes.
+//
+// Layout (version 2):
+//      "C8SS" | u16 version | u64 rom hash | u16 rom size
+//      u16 pc | u16 I | V[16] | u8 delay timer | u8 sound timer | u64 cycles | u64 random state
+//      u16 keypad bitmask | u8 stack depth | u16 stack[depth]
+//      u32 non-empty row mask | u64 row per set bit
+//      { u16 offset | u16 length | length bytes }* | u16 0 | u16 0
+// Version 1 is the same without the random state, it still loads (the generator is left as is).
+
+#define CHIP8_STATE_MAGIC "C8SS"
+#define CHIP8_STATE_VERSION 2
+
+// Upper bound for an encoded snapshot (every memory byte differing in the worst pattern)
+#define CHIP8_STATE_MAX_SIZE (16 * 1024)
+
+size_t chip8_state_encode(const Chip8 *chip8, const Chip8Rom *rom, uint8_t *buffer, size_t capacity);
+int chip8_state_decode(Chip8 *chip8, const Chip8Rom *rom, const uint8_t *buffer, size_t size);
+int chip8_save_state(const Chip8 *chip8, const Chip8Rom *rom, const char *filename);
+int chip8_load_state(Chip8 *chip8, const Chip8Rom *rom, const char *filename);
+
+#endif
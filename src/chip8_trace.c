@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "chip8_trace.h"
+
+/// ********************
+/// Trace functions    *
+/// ********************
+
+int chip8_trace_init(Chip8Trace *trace, uint32_t capacity, uint8_t quirks)
+{
+    // Round up to a power of 2, so the ring index is a mask instead of a modulo
+    uint32_t rounded = 1;
+    while (rounded < capacity)
+    {
+        rounded <<= 1;
+    }
+
+    trace->records = calloc(rounded, sizeof(Chip8TraceRecord));
+    if (trace->records == NULL)
+    {
+        return 1;
+    }
+
+    trace->capacity = rounded;
+    trace->quirks = quirks;
+    atomic_init(&trace->head, 0);
+    atomic_init(&trace->frozen, 0);
+
+    return 0;
+}
+
+void chip8_trace_free(Chip8Trace *trace)
+{
+    free(trace->records);
+    trace->records = NULL;
+    trace->capacity = 0;
+}
+
+void chip8_trace_record(Chip8Trace *trace, const Chip8 *chip8, uint16_t address, uint16_t opcode, uint8_t flag)
+{
+    if (atomic_load_explicit(&trace->frozen, memory_order_relaxed))
+    {
+        return;
+    }
+
+    // Only the producer writes head, a relaxed load of our own value is enough
+    uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    Chip8TraceRecord *record = &trace->records[head & (trace->capacity - 1)];
+
+    record->cycle = chip8->cycles;
+    record->address = address;
+    record->opcode = opcode;
+    record->pc = chip8->pc;
+    record->I = chip8->I;
+    memcpy(record->V, chip8->V, sizeof(record->V));
+    record->flag = flag;
+
+    atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+}
+
+int chip8_trace_dump(Chip8Trace *trace, const char *filename)
+{
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL)
+    {
+        return 1;
+    }
+
+    uint64_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+    uint64_t count = head < trace->capacity ? head : trace->capacity;
+
+    Chip8TraceHeader header;
+    memcpy(header.magic, CHIP8_TRACE_MAGIC, sizeof(header.magic));
+    header.version = CHIP8_TRACE_VERSION;
+    header.record_size = sizeof(Chip8TraceRecord);
+    header.count = (uint32_t)count;
+    header.quirks = trace->quirks;
+    memset(header.reserved, 0, sizeof(header.reserved));
+
+    int failed = fwrite(&header, sizeof(header), 1, file) != 1;
+
+    // Oldest record first, in at most two contiguous pieces
+    uint32_t first = (uint32_t)((head - count) & (trace->capacity - 1));
+    uint32_t until_end = trace->capacity - first;
+    uint32_t part = count < until_end ? (uint32_t)count : until_end;
+
+    failed |= fwrite(&trace->records[first], sizeof(Chip8TraceRecord), part, file) != part;
+    failed |= fwrite(&trace->records[0], sizeof(Chip8TraceRecord), count - part, file) != count - part;
+
+    fclose(file);
+
+    return failed;
+}
+
+static int write_all(int fd, const void *data, size_t size)
+{
+    const char *bytes = data;
+    while (size > 0)
+    {
+        int chunk = size < (1u << 30) ? (int)size : (1 << 30);
+        int written = (int)write(fd, bytes, chunk);
+        if (written <= 0)
+        {
+            return 1;
+        }
+        bytes += written;
+        size -= (size_t)written;
+    }
+
+    return 0;
+}
+
+// Dump for signal handlers: no stdio or allocation, only write(2) to a file opened up front
+// Freezes the ring first. A record the producer was writing at that moment may be torn, so
+// the slot after the head (the oldest, once the ring is full) is left out.
+int chip8_trace_dump_fd(Chip8Trace *trace, int fd)
+{
+    atomic_store_explicit(&trace->frozen, 1, memory_order_relaxed);
+
+    uint64_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+    uint64_t count = head < trace->capacity ? head : trace->capacity - 1;
+
+    Chip8TraceHeader header;
+    memcpy(header.magic, CHIP8_TRACE_MAGIC, sizeof(header.magic));
+    header.version = CHIP8_TRACE_VERSION;
+    header.record_size = sizeof(Chip8TraceRecord);
+    header.count = (uint32_t)count;
+    header.quirks = trace->quirks;
+    memset(header.reserved, 0, sizeof(header.reserved));
+
+    uint32_t first = (uint32_t)((head - count) & (trace->capacity - 1));
+    uint32_t until_end = trace->capacity - first;
+    uint32_t part = count < until_end ? (uint32_t)count : until_end;
+
+    int failed = write_all(fd, &header, sizeof(header));
+    failed |= write_all(fd, &trace->records[first], part * sizeof(Chip8TraceRecord));
+    failed |= write_all(fd, &trace->records[0], (count - part) * sizeof(Chip8TraceRecord));
+
+    return failed;
+}
+
+// Formats a record the same way chip8_debug_printf prints an instruction
+// `quirks` is the profile from the dump header, the interpreter it stands for names BNNN differently
+// Returns the number of characters written (excluding the terminator)
+int chip8_trace_format(const Chip8TraceRecord *record, uint8_t quirks, char *buffer, size_t size)
+{
+    uint16_t opcode = record->opcode;
+    uint8_t X = (opcode >> 8) & 0xF;
+    uint8_t Y = (opcode >> 4) & 0xF;
+    uint8_t N = opcode & 0xF;
+    uint8_t NN = opcode & 0xFF;
+    uint16_t NNN = opcode & 0xFFF;
+
+    // The register line shows VF as chip8_debug_printf saw it
+    uint8_t VF = record->V[0xF];
+
+    int length = 0;
+
+#define APPEND(...)                                                                        \
+    do                                                                                     \
+    {                                                                                      \
+        int written = snprintf(buffer + length, (size_t)length < size ? size - length : 0, \
+                               __VA_ARGS__);                                               \
+        if (written > 0)                                                                   \
+            length += written;                                                             \
+    } while (0)
+
+    switch ((opcode >> 12) & 0xF)
+    {
+    case 0x0:
+        if (opcode == 0x00E0)
+            APPEND("00E0 Clear screen");
+        else if (opcode == 0x00EE)
+            APPEND("00EE Return (pop stack) - PC set to %X", record->pc);
+        else
+            APPEND("Error: Unknown instruction encountered.");
+        break;
+    case 0x1:
+        APPEND("1NNN 1%X Jump - PC set to %X", NNN, NNN);
+        break;
+    case 0x2:
+        APPEND("2NNN 2%X Subroutine (push stack) then PC set to %X", NNN, NNN);
+        break;
+    case 0x3:
+        APPEND("3XNN 3%X%X Skip one instruction if VX == NN", X, NN);
+        break;
+    case 0x4:
+        APPEND("4XNN 4%X%X Skip one instruction if VX != NN", X, NN);
+        break;
+    case 0x5:
+        APPEND("5XY0 5%X%X0 Skip one instruction if VX == VY", X, Y);
+        break;
+    case 0x6:
+        APPEND("6XNN 6%X%X Set VX to NN", X, NN);
+        break;
+    case 0x7:
+        APPEND("7XNN 7%X%X Add NN to VX", X, NN);
+        break;
+    case 0x8:
+        switch (N)
+        {
+        case 0x0:
+            APPEND("8XY0 8%X%X0 Set VX = VY", X, Y);
+            break;
+        case 0x1:
+            APPEND("8XY1 8%X%X1 Set VX |= VY", X, Y);
+            break;
+        case 0x2:
+            APPEND("8XY2 8%X%X2 Set VX &= VY", X, Y);
+            break;
+        case 0x3:
+            APPEND("8XY3 8%X%X3 Set VX ^= VY", X, Y);
+            break;
+        case 0x4:
+            APPEND("8XY4 8%X%X4 Set VX = VX + VY with carry", X, Y);
+            break;
+        case 0x5:
+            APPEND("8XY5 8%X%X5 Set VX = VX - VY with borrow", X, Y);
+            break;
+        case 0x6:
+            APPEND("8XY6 8%X%X6 Set VX >>= 1", X, Y);
+            break;
+        case 0x7:
+            APPEND("8XY5 8%X%X5 Set VX = VY - VX with borrow", X, Y);
+            break;
+        case 0xE:
+            APPEND("8XY6 8%X%X6 Set VX <<= 1", X, Y);
+            break;
+        default:
+            APPEND("Error: Unknown instruction encountered.");
+            break;
+        }
+        break;
+    case 0x9:
+        APPEND("9XY0 9%X%X0 Skip one instruction if VX != VY", X, Y);
+        break;
+    case 0xA:
+        APPEND("ANNN A%X Set I = NNN", NNN);
+        break;
+    case 0xB:
+        if (quirks & CHIP8_QUIRK_JUMP_VX)
+            APPEND("BXNN B%X Jump XNN+VX - PC set to %X", NNN, record->pc);
+        else
+            APPEND("BNNN B%X Jump NNN+V0 - PC set to %X", NNN, record->pc);
+        break;
+    case 0xC:
+        APPEND("CXNN C%X%X Random - VX randomized", X, NN);
+        break;
+    case 0xD:
+    {
+        // DXYN prints before it draws, so its coordinates and VF are the ones before the collision flag
+        VF = record->flag;
+        uint8_t x = X == 0xF ? VF : record->V[X];
+        uint8_t y = Y == 0xF ? VF : record->V[Y];
+        APPEND("DXYN D%X%X%X Draw %X sprite rows drawn at (%X, %X) from memory location %X", X, Y, N, N,
+               x & (CHIP8_SCREEN_WIDTH - 1), y & (CHIP8_SCREEN_HEIGHT - 1), record->I);
+        break;
+    }
+    case 0xE:
+        if (NN == 0x9E)
+            APPEND("EX9E E%X9E Skip instruction if key VX is pressed", X);
+        else if (NN == 0xA1)
+            APPEND("EX9E E%X9E Skip instruction if key VX is not pressed", X);
+        else
+            APPEND("Error: Unknown instruction encountered.");
+        break;
+    case 0xF:
+        switch (NN)
+        {
+        case 0x07:
+            APPEND("FX07 F%X07 Set VX to delay timer value", X);
+            break;
+        case 0x15:
+            APPEND("FX15 F%X15 Set delay timer to VX", X);
+            break;
+        case 0x18:
+            APPEND("FX18 F%X18 Set sound timmer to VX", X);
+            break;
+        case 0x1E:
+            APPEND("FX1E F%X1E Set I += VX", X);
+            break;
+        case 0x0A:
+            APPEND("FX0A F%X0A Set VX to key pressed (blocking)", X);
+            break;
+        case 0x29:
+            APPEND("FX29 F%X29 Set I to font character VX", X);
+            break;
+        case 0x33:
+            APPEND("FX33 F%X33 Binary-coded decimal conversion of VX into memory at I", X);
+            break;
+        case 0x55:
+            APPEND("FX55 F%X55 Store V0 through VX to memory at I", X);
+            break;
+        case 0x65:
+            APPEND("FX65 F%X65 Load V0 through VX from memory at I", X);
+            break;
+        default:
+            APPEND("Error: Unknown instruction encountered.");
+            break;
+        }
+        break;
+    }
+
+    APPEND("\n|PC %X|I %X", record->pc, record->I);
+    for (uint8_t i = 0; i < CHIP8_NUM_VAR_REGISTERS; i++)
+    {
+        APPEND("|V%X %X", i, i == 0xF ? VF : record->V[i]);
+    }
+    APPEND("|\n\n");
+
+#undef APPEND
+
+    return length;
+}
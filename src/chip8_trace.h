@@ -0,0 +1,64 @@
+#ifndef CHIP8_TRACE_H
+#define CHIP8_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "chip8.h"
+
+// Binary instruction trace
+// chip8_cycle appends one fixed-size record per executed instruction into a ring buffer
+// when chip8->trace is set. The ring keeps the newest `capacity` records and can be dumped
+// to a file at any time. trace_decode turns a dump back into the CHIP8_DEBUG text output.
+
+#define CHIP8_TRACE_MAGIC "C8TR"
+#define CHIP8_TRACE_VERSION 3
+
+// 40 bytes, registers are the values after the instruction executed
+typedef struct
+{
+    uint64_t cycle;
+    uint16_t address; // Address the opcode was fetched from
+    uint16_t opcode;
+    uint16_t pc;
+    uint16_t I;
+    uint8_t V[CHIP8_NUM_VAR_REGISTERS];
+    uint8_t flag; // VF before the instruction, DXYN replaces it with the collision flag
+    uint8_t reserved[7];
+} Chip8TraceRecord;
+
+// Dump file header, followed by `count` records oldest first (host byte order)
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t count;
+    uint8_t quirks; // Quirk profile of the traced machine, it changes how BNNN decodes
+    uint8_t reserved[3];
+} Chip8TraceHeader;
+
+// Single producer (the emulating thread), lock-free
+// The head is published with release semantics after a record is complete, so a reader
+// on another thread sees every record up to the head it loaded, except the oldest ones
+// the producer may be overwriting at the same time.
+struct Chip8Trace
+{
+    Chip8TraceRecord *records;
+    uint32_t capacity; // Power of 2
+    uint8_t quirks;
+    _Atomic uint64_t head;
+
+    // Set by chip8_trace_dump_fd, the producer stops recording so the ring holds still
+    atomic_int frozen;
+};
+
+int chip8_trace_init(Chip8Trace *trace, uint32_t capacity, uint8_t quirks);
+void chip8_trace_free(Chip8Trace *trace);
+void chip8_trace_record(Chip8Trace *trace, const Chip8 *chip8, uint16_t address, uint16_t opcode, uint8_t flag);
+int chip8_trace_dump(Chip8Trace *trace, const char *filename);
+int chip8_trace_dump_fd(Chip8Trace *trace, int fd);
+int chip8_trace_format(const Chip8TraceRecord *record, uint8_t quirks, char *buffer, size_t size);
+
+#endif
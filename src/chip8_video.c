@@ -0,0 +1,440 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "chip8_video.h"
+
+// Off and on pixels, like the window (BLACK and WHITE)
+static const uint8_t video_rgb[2][3] = {{0, 0, 0}, {255, 255, 255}};
+
+/// ********************
+/// Scaling            *
+/// ********************
+
+// BT.601 limited range, what y4m players assume
+static void video_rgb_to_ycbcr(const uint8_t rgb[3], uint8_t ycbcr[3])
+{
+    int r = rgb[0], g = rgb[1], b = rgb[2];
+
+    // Offset by 128 << 8 so the shifts never see a negative value
+    ycbcr[0] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    ycbcr[1] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128 + (128 << 8)) >> 8));
+    ycbcr[2] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128 + (128 << 8)) >> 8));
+}
+
+// Scales display row `y` into every plane
+// Each run of equal pixels is one copy out of the solid row of its color, then the first
+// output row is copied down to the other scale - 1.
+static void video_scale_row(Chip8Video *video, const uint64_t display[], uint8_t y)
+{
+    uint32_t pitch = video->width * video->channels;
+    uint32_t pixel = video->scale * video->channels;
+    uint64_t row = display[y];
+
+    for (uint32_t p = 0; p < video->num_planes; p++)
+    {
+        uint8_t *plane = video->image + (size_t)p * video->height * pitch;
+        uint8_t *line = plane + (size_t)y * video->scale * pitch;
+
+        uint32_t x = 0;
+        while (x < CHIP8_SCREEN_WIDTH)
+        {
+            int on = (row >> (CHIP8_SCREEN_WIDTH - 1 - x)) & 1;
+            uint32_t end = x + 1;
+            while (end < CHIP8_SCREEN_WIDTH && (int)((row >> (CHIP8_SCREEN_WIDTH - 1 - end)) & 1) == on)
+            {
+                end++;
+            }
+
+            memcpy(line + x * pixel, video->solid[p][on] + x * pixel, (end - x) * pixel);
+            x = end;
+        }
+
+        for (uint32_t i = 1; i < video->scale; i++)
+        {
+            memcpy(line + (size_t)i * pitch, line, pitch);
+        }
+    }
+}
+
+/// ********************
+/// PNG                *
+/// ********************
+
+static void put_uint32_be(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = (uint8_t)(value >> 24);
+    buffer[1] = (uint8_t)(value >> 16);
+    buffer[2] = (uint8_t)(value >> 8);
+    buffer[3] = (uint8_t)value;
+}
+
+static uint32_t png_crc(const uint32_t table[], uint32_t crc, const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+// Writes the chunk's length, type and CRC around the `size` bytes already at output + 8
+static size_t png_chunk(const uint32_t table[], uint8_t *output, const char *type, size_t size)
+{
+    put_uint32_be(output, (uint32_t)size);
+    memcpy(output + 4, type, 4);
+    put_uint32_be(output + 8 + size, png_crc(table, 0xFFFFFFFF, output + 4, size + 4) ^ 0xFFFFFFFF);
+
+    return 12 + size;
+}
+
+// Scanlines (filter byte 0, then the row) and their zlib stream, split into stored blocks
+typedef struct
+{
+    uint8_t *output;
+    size_t position;
+    size_t remaining; // Scanline bytes not written yet
+    size_t block_left;
+    uint32_t adler_a;
+    uint32_t adler_b;
+} PngWriter;
+
+static void png_write(PngWriter *writer, const uint8_t *data, size_t size)
+{
+    while (size > 0)
+    {
+        if (writer->block_left == 0)
+        {
+            size_t length = writer->remaining < CHIP8_VIDEO_PNG_STORED_BLOCK ? writer->remaining
+                                                                             : CHIP8_VIDEO_PNG_STORED_BLOCK;
+            uint8_t *header = writer->output + writer->position;
+            header[0] = writer->remaining == length; // BFINAL, BTYPE 00 (stored)
+            header[1] = (uint8_t)length;
+            header[2] = (uint8_t)(length >> 8);
+            header[3] = (uint8_t)~length;
+            header[4] = (uint8_t)(~length >> 8);
+            writer->position += 5;
+            writer->block_left = length;
+        }
+
+        size_t count = size < writer->block_left ? size : writer->block_left;
+        memcpy(writer->output + writer->position, data, count);
+
+        // Adler-32, reduced often enough that the sums never overflow
+        for (size_t i = 0; i < count; i++)
+        {
+            writer->adler_a += data[i];
+            writer->adler_b += writer->adler_a;
+            if ((i & 1023) == 1023)
+            {
+                writer->adler_a %= 65521;
+                writer->adler_b %= 65521;
+            }
+        }
+        writer->adler_a %= 65521;
+        writer->adler_b %= 65521;
+
+        writer->position += count;
+        writer->remaining -= count;
+        writer->block_left -= count;
+        data += count;
+        size -= count;
+    }
+}
+
+// Size of the PNG chip8_video_encode_png writes for an image of this size
+size_t chip8_video_png_size(uint32_t width, uint32_t height)
+{
+    size_t raw = (size_t)height * (1 + (size_t)width * 3);
+    size_t blocks = (raw + CHIP8_VIDEO_PNG_STORED_BLOCK - 1) / CHIP8_VIDEO_PNG_STORED_BLOCK;
+
+    // Signature, IHDR, IDAT around the zlib header, blocks and Adler-32, IEND
+    return 8 + 25 + 12 + 2 + blocks * 5 + raw + 4 + 12;
+}
+
+// Encodes packed RGB rows as a PNG, returns its size (chip8_video_png_size)
+size_t chip8_video_encode_png(const uint8_t *rgb, uint32_t width, uint32_t height, uint8_t *output)
+{
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+    uint32_t table[256];
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        table[n] = c;
+    }
+
+    size_t size = 0;
+    memcpy(output, signature, sizeof(signature));
+    size += sizeof(signature);
+
+    // IHDR: 8-bit RGB, no interlacing
+    uint8_t *ihdr = output + size + 8;
+    put_uint32_be(ihdr, width);
+    put_uint32_be(ihdr + 4, height);
+    ihdr[8] = 8;
+    ihdr[9] = 2;
+    ihdr[10] = 0;
+    ihdr[11] = 0;
+    ihdr[12] = 0;
+    size += png_chunk(table, output + size, "IHDR", 13);
+
+    // IDAT: zlib header (deflate, 32K window, no dictionary), stored blocks, Adler-32
+    PngWriter writer;
+    writer.output = output + size + 8;
+    writer.output[0] = 0x78;
+    writer.output[1] = 0x01;
+    writer.position = 2;
+    writer.remaining = (size_t)height * (1 + (size_t)width * 3);
+    writer.block_left = 0;
+    writer.adler_a = 1;
+    writer.adler_b = 0;
+
+    const uint8_t filter = 0;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        png_write(&writer, &filter, 1);
+        png_write(&writer, rgb + (size_t)y * width * 3, (size_t)width * 3);
+    }
+    put_uint32_be(writer.output + writer.position, writer.adler_b << 16 | writer.adler_a);
+    size += png_chunk(table, output + size, "IDAT", writer.position + 4);
+
+    size += png_chunk(table, output + size, "IEND", 0);
+
+    return size;
+}
+
+/// ********************
+/// Output             *
+/// ********************
+
+int chip8_video_parse_format(const char *text, Chip8VideoFormat *format)
+{
+    static const char *names[] = {"y4m", "raw", "ppm", "png"};
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (strcmp(text, names[i]) == 0)
+        {
+            *format = (Chip8VideoFormat)i;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int video_is_stream(const Chip8Video *video)
+{
+    return video->format == CHIP8_VIDEO_Y4M || video->format == CHIP8_VIDEO_RAW;
+}
+
+static int video_write_bytes(Chip8Video *video, FILE *file, const void *data, size_t size)
+{
+    video->bytes_written += size;
+    return fwrite(data, 1, size, file) != size;
+}
+
+// `output` is the stream's file name ("-" for stdout), or the prefix of the sequence's files
+int chip8_video_open(Chip8Video *video, Chip8VideoFormat format, const char *output, uint32_t scale,
+                     uint32_t frame_rate)
+{
+    memset(video, 0, sizeof(*video));
+    video->format = format;
+    video->scale = scale > 0 ? scale : 1;
+    video->width = CHIP8_SCREEN_WIDTH * video->scale;
+    video->height = CHIP8_SCREEN_HEIGHT * video->scale;
+    video->frame_rate = frame_rate;
+    video->num_planes = format == CHIP8_VIDEO_Y4M ? 3 : 1;
+    video->channels = format == CHIP8_VIDEO_Y4M ? 1 : 3;
+    video->image_size = (size_t)video->width * video->height * 3;
+
+    video->image = malloc(video->image_size);
+    if (video->image == NULL)
+    {
+        return 1;
+    }
+
+    // Solid rows in the output's color space
+    for (uint32_t p = 0; p < video->num_planes; p++)
+    {
+        for (int on = 0; on < 2; on++)
+        {
+            uint8_t color[3];
+            if (format == CHIP8_VIDEO_Y4M)
+            {
+                video_rgb_to_ycbcr(video_rgb[on], color);
+            }
+            else
+            {
+                memcpy(color, video_rgb[on], sizeof(color));
+            }
+
+            video->solid[p][on] = malloc((size_t)video->width * video->channels);
+            if (video->solid[p][on] == NULL)
+            {
+                chip8_video_close(video);
+                return 1;
+            }
+            for (uint32_t x = 0; x < video->width; x++)
+            {
+                for (uint32_t c = 0; c < video->channels; c++)
+                {
+                    video->solid[p][on][x * video->channels + c] = color[p + c];
+                }
+            }
+        }
+    }
+
+    if (format == CHIP8_VIDEO_PNG)
+    {
+        video->encoded = malloc(chip8_video_png_size(video->width, video->height));
+        if (video->encoded == NULL)
+        {
+            chip8_video_close(video);
+            return 1;
+        }
+    }
+
+    if (!video_is_stream(video))
+    {
+        snprintf(video->prefix, sizeof(video->prefix), "%s", output);
+        return 0;
+    }
+
+    if (strcmp(output, "-") == 0)
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        video->stream = stdout;
+    }
+    else
+    {
+        video->stream = fopen(output, "wb");
+        if (video->stream == NULL)
+        {
+            chip8_video_close(video);
+            return 1;
+        }
+    }
+
+    if (format == CHIP8_VIDEO_Y4M)
+    {
+        char header[128];
+        int length = snprintf(header, sizeof(header), "%s W%u H%u F%u:1 Ip A1:1 C444\n", CHIP8_VIDEO_Y4M_MAGIC,
+                              video->width, video->height, frame_rate);
+        if (video_write_bytes(video, video->stream, header, (size_t)length) != 0)
+        {
+            chip8_video_close(video);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int video_write_file(Chip8Video *video)
+{
+    char filename[1100];
+    snprintf(filename, sizeof(filename), "%s%06u.%s", video->prefix, video->frame,
+             video->format == CHIP8_VIDEO_PNG ? "png" : "ppm");
+
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL)
+    {
+        return 1;
+    }
+
+    int error = 0;
+    if (video->format == CHIP8_VIDEO_PNG)
+    {
+        error = video_write_bytes(video, file, video->encoded, video->encoded_size);
+    }
+    else
+    {
+        char header[64];
+        int length = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", video->width, video->height);
+        error = video_write_bytes(video, file, header, (size_t)length) ||
+                video_write_bytes(video, file, video->image, video->image_size);
+    }
+
+    return fclose(file) != 0 || error;
+}
+
+// Adds one frame, returns 1 on a write error
+int chip8_video_write(Chip8Video *video, const uint64_t display[])
+{
+    int changed = !video->has_frame;
+    for (uint8_t y = 0; y < CHIP8_SCREEN_HEIGHT; y++)
+    {
+        if (!video->has_frame || display[y] != video->display[y])
+        {
+            video_scale_row(video, display, y);
+            video->display[y] = display[y];
+            changed = 1;
+        }
+    }
+    video->has_frame = 1;
+
+    int error = 0;
+    if (changed)
+    {
+        video->frames_encoded++;
+        if (video->format == CHIP8_VIDEO_PNG)
+        {
+            video->encoded_size = chip8_video_encode_png(video->image, video->width, video->height, video->encoded);
+        }
+        if (!video_is_stream(video))
+        {
+            error = video_write_file(video);
+        }
+    }
+
+    if (video->format == CHIP8_VIDEO_Y4M)
+    {
+        error = video_write_bytes(video, video->stream, "FRAME\n", 6) != 0;
+    }
+    if (video_is_stream(video))
+    {
+        error = error || video_write_bytes(video, video->stream, video->image, video->image_size);
+    }
+
+    video->frame++;
+
+    return error;
+}
+
+// Flushes and closes the stream, returns 1 if anything could not be written
+int chip8_video_close(Chip8Video *video)
+{
+    int error = 0;
+    if (video->stream != NULL)
+    {
+        error = video->stream == stdout ? fflush(stdout) != 0 : fclose(video->stream) != 0;
+        video->stream = NULL;
+    }
+
+    for (uint32_t p = 0; p < 3; p++)
+    {
+        free(video->solid[p][0]);
+        free(video->solid[p][1]);
+        video->solid[p][0] = NULL;
+        video->solid[p][1] = NULL;
+    }
+    free(video->image);
+    free(video->encoded);
+    video->image = NULL;
+    video->encoded = NULL;
+
+    return error;
+}
@@ -0,0 +1,77 @@
+#ifndef CHIP8_VIDEO_H
+#define CHIP8_VIDEO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8.h"
+
+// Headless video output, no window or GPU needed
+// Scales the display by an integer factor into an image and writes it as a stream (y4m or raw
+// rgb24, to a file or stdout) or as one image file per frame (PPM or PNG).
+// Only the rows that changed since the last frame are scaled again, and an unchanged frame is
+// never encoded again: streams repeat the last frame's bytes, sequences skip the file. Sequence
+// files are named after their frame number, a gap means the previous file is still showing.
+//
+// Streams, one frame per call:
+//      y4m      "YUV4MPEG2" header, then "FRAME\n" and the Y, Cb, Cr planes (4:4:4, BT.601)
+//      raw      packed RGB, 3 bytes per pixel, no header (ffmpeg -f rawvideo -pix_fmt rgb24)
+// Sequences, <prefix><frame number, 6 digits>.<ppm|png>:
+//      ppm      binary PPM (P6)
+//      png      8-bit RGB, in stored (uncompressed) deflate blocks, so no zlib is needed
+
+#define CHIP8_VIDEO_Y4M_MAGIC "YUV4MPEG2"
+#define CHIP8_VIDEO_PNG_STORED_BLOCK 65535
+
+typedef enum
+{
+    CHIP8_VIDEO_Y4M,
+    CHIP8_VIDEO_RAW,
+    CHIP8_VIDEO_PPM,
+    CHIP8_VIDEO_PNG
+} Chip8VideoFormat;
+
+typedef struct
+{
+    Chip8VideoFormat format;
+    uint32_t scale;
+    uint32_t width;
+    uint32_t height;
+    uint32_t frame_rate;
+
+    // Streams go to `stream`, sequences to files named after `prefix`
+    FILE *stream;
+    char prefix[1024];
+
+    // The scaled image: one plane of packed RGB, or the three planes of y4m, one byte per pixel
+    uint8_t *image;
+    size_t image_size;
+    uint32_t num_planes;
+    uint32_t channels;
+
+    // One output row per plane filled with the off and on color, rows are copied out of these
+    uint8_t *solid[3][2];
+
+    // Encoded PNG of the last changed frame
+    uint8_t *encoded;
+    size_t encoded_size;
+
+    // Display of the last frame, rows that differ are scaled again
+    uint64_t display[CHIP8_SCREEN_HEIGHT];
+    int has_frame;
+
+    uint32_t frame;
+    uint64_t frames_encoded;
+    uint64_t bytes_written;
+} Chip8Video;
+
+int chip8_video_parse_format(const char *text, Chip8VideoFormat *format);
+int chip8_video_open(Chip8Video *video, Chip8VideoFormat format, const char *output, uint32_t scale,
+                     uint32_t frame_rate);
+int chip8_video_write(Chip8Video *video, const uint64_t display[]);
+int chip8_video_close(Chip8Video *video);
+size_t chip8_video_encode_png(const uint8_t *rgb, uint32_t width, uint32_t height, uint8_t *output);
+size_t chip8_video_png_size(uint32_t width, uint32_t height);
+
+#endif
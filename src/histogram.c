@@ -0,0 +1,166 @@
+#include "histogram.h"
+
+/// ********************
+/// Buckets            *
+/// ********************
+
+static uint32_t histogram_msb(uint64_t value)
+{
+    uint32_t msb = 0;
+    while (value >>= 1)
+    {
+        msb++;
+    }
+
+    return msb;
+}
+
+// Values below 2 * HISTOGRAM_SUB_BUCKETS are their own bucket, above that the top
+// HISTOGRAM_SUB_BITS + 1 bits pick the bucket and `shift` the power of two
+uint32_t histogram_bucket(uint64_t value)
+{
+    uint32_t msb = histogram_msb(value);
+    uint32_t shift = msb > HISTOGRAM_SUB_BITS ? msb - HISTOGRAM_SUB_BITS : 0;
+
+    return shift * HISTOGRAM_SUB_BUCKETS + (uint32_t)(value >> shift);
+}
+
+// Smallest value in the bucket
+uint64_t histogram_bucket_low(uint32_t bucket)
+{
+    if (bucket < 2 * HISTOGRAM_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+
+    uint32_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+
+    return (uint64_t)(bucket % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+// Largest value in the bucket
+uint64_t histogram_bucket_high(uint32_t bucket)
+{
+    if (bucket < 2 * HISTOGRAM_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+
+    uint32_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+
+    return histogram_bucket_low(bucket) + ((1ULL << shift) - 1);
+}
+
+/// ********************
+/// Recording          *
+/// ********************
+
+void histogram_init(Histogram *histogram)
+{
+    for (uint32_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++)
+    {
+        atomic_init(&histogram->counts[i], 0);
+    }
+    atomic_init(&histogram->total, 0);
+    atomic_init(&histogram->sum, 0);
+    atomic_init(&histogram->min, UINT64_MAX);
+    atomic_init(&histogram->max, 0);
+}
+
+void histogram_record(Histogram *histogram, uint64_t value)
+{
+    atomic_fetch_add_explicit(&histogram->counts[histogram_bucket(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->total, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, value, memory_order_relaxed);
+
+    unsigned long long min = atomic_load_explicit(&histogram->min, memory_order_relaxed);
+    while (value < min &&
+           !atomic_compare_exchange_weak_explicit(&histogram->min, &min, value, memory_order_relaxed,
+                                                  memory_order_relaxed))
+    {
+    }
+
+    unsigned long long max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while (value > max &&
+           !atomic_compare_exchange_weak_explicit(&histogram->max, &max, value, memory_order_relaxed,
+                                                  memory_order_relaxed))
+    {
+    }
+}
+
+/// ********************
+/// Reading            *
+/// ********************
+
+uint64_t histogram_count(const Histogram *histogram)
+{
+    return atomic_load_explicit(&histogram->total, memory_order_relaxed);
+}
+
+double histogram_mean(const Histogram *histogram)
+{
+    uint64_t count = histogram_count(histogram);
+
+    return count > 0 ? (double)atomic_load_explicit(&histogram->sum, memory_order_relaxed) / count : 0.0;
+}
+
+// Value at or below which `percentile` % of the records are, to within the bucket's precision
+// The top of the bucket is reported (never under-reports), clamped to the largest value seen
+uint64_t histogram_percentile(const Histogram *histogram, double percentile)
+{
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++)
+    {
+        count += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+    }
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    // Rank of the record, 1-based, at least the first one
+    uint64_t rank = (uint64_t)(percentile / 100.0 * count + 0.5);
+    rank = rank > 0 ? rank : 1;
+    rank = rank < count ? rank : count;
+
+    uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++)
+    {
+        seen += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+        if (seen >= rank)
+        {
+            uint64_t high = histogram_bucket_high(i);
+            return high < max ? high : max;
+        }
+    }
+
+    return max;
+}
+
+// One summary line, then one line per non-empty bucket (lowest value, count) for merging elsewhere
+//      histogram <name> count=N mean=M min=A p50=B p90=C p99=D p99.9=E max=F
+//      bucket <name> <low> <count>
+void histogram_write(const Histogram *histogram, const char *name, FILE *file)
+{
+    uint64_t count = histogram_count(histogram);
+    uint64_t min = atomic_load_explicit(&histogram->min, memory_order_relaxed);
+
+    fprintf(file, "histogram %s count=%llu mean=%.1f min=%llu p50=%llu p90=%llu p99=%llu p99.9=%llu max=%llu\n", name,
+            (unsigned long long)count, histogram_mean(histogram), (unsigned long long)(count > 0 ? min : 0),
+            (unsigned long long)histogram_percentile(histogram, 50.0),
+            (unsigned long long)histogram_percentile(histogram, 90.0),
+            (unsigned long long)histogram_percentile(histogram, 99.0),
+            (unsigned long long)histogram_percentile(histogram, 99.9),
+            (unsigned long long)atomic_load_explicit(&histogram->max, memory_order_relaxed));
+
+    for (uint32_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++)
+    {
+        uint64_t bucket_count = atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+        if (bucket_count > 0)
+        {
+            fprintf(file, "bucket %s %llu %llu\n", name, (unsigned long long)histogram_bucket_low(i),
+                    (unsigned long long)bucket_count);
+        }
+    }
+}
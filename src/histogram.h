@@ -0,0 +1,42 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Log-linear (HDR style) histogram of 64-bit values
+// Values below 2 * HISTOGRAM_SUB_BUCKETS get a bucket each, above that every power of two is
+// split into HISTOGRAM_SUB_BUCKETS equal buckets, so any value is known to within 1/32 (3 %)
+// of itself, from nanoseconds to hours, in a fixed 15 kB.
+//
+// Recording is lock-free and may happen on any thread, readers see a consistent enough
+// picture for monitoring (a record may show in the count before it shows in the sum).
+
+enum
+{
+    HISTOGRAM_SUB_BITS = 5,
+    HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BITS,
+    HISTOGRAM_NUM_BUCKETS = (64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS
+};
+
+typedef struct
+{
+    atomic_ullong counts[HISTOGRAM_NUM_BUCKETS];
+    atomic_ullong total;
+    atomic_ullong sum;
+    atomic_ullong min;
+    atomic_ullong max;
+} Histogram;
+
+void histogram_init(Histogram *histogram);
+void histogram_record(Histogram *histogram, uint64_t value);
+uint32_t histogram_bucket(uint64_t value);
+uint64_t histogram_bucket_low(uint32_t bucket);
+uint64_t histogram_bucket_high(uint32_t bucket);
+uint64_t histogram_count(const Histogram *histogram);
+double histogram_mean(const Histogram *histogram);
+uint64_t histogram_percentile(const Histogram *histogram, double percentile);
+void histogram_write(const Histogram *histogram, const char *name, FILE *file);
+
+#endif
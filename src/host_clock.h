@@ -0,0 +1,12 @@
+#ifndef HOST_CLOCK_H
+#define HOST_CLOCK_H
+
+#include <stdint.h>
+
+// Monotonic host clock in nanoseconds, unaffected by wall clock changes
+uint64_t host_clock_ns(void);
+
+// Sleeps for about `ns` nanoseconds, at the resolution of the host's timer
+void host_sleep_ns(uint64_t ns);
+
+#endif
@@ -2,94 +2,725 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "chip8.h"
+#include "chip8_input_log.h"
+#include "chip8_rewind.h"
+#include "chip8_scheduler.h"
+#include "chip8_spectator.h"
+#include "chip8_state.h"
+#include "chip8_trace.h"
+#include "host_clock.h"
 #include "raylib.h"
+#include "spsc_queue.h"
+#include "telemetry.h"
+#include "tone_generator.h"
+#include "triple_buffer.h"
+
+#if CHIP8_PROFILE
+#include "chip8_profile.h"
+#endif
 
 #define CYCLES_PER_SECOND 700
 #define REFRESH_RATE 60
 #define CHIP8_DISPLAY_SCALE 20
+#define TRACE_CAPACITY (1 << 16)
+#define REWIND_ARENA_SIZE (4 * 1024 * 1024)
+#define PROFILE_TOP_N 10
+#define TURBO_FRAMES_PER_RENDER 16
+#define TURBO_STATS_INTERVAL_NS 500000000ULL
+#define FRAME_NS (1000000000ULL / REFRESH_RATE)
+#define EMULATION_SLICE_NS 1000000ULL
+#define INPUT_POLL_NS 1000000ULL
+#define KEY_TAP_NS FRAME_NS
+#define EVENT_QUEUE_CAPACITY 256
+#define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_BUFFER_FRAMES 512
+
+// The machine runs on its own thread, so presenting (vsync, compositor hiccups) never stalls it
+// Input and commands go to it through an SPSC queue, completed frames come back through a
+// triple buffer and the render thread only ever presents the newest one.
+
+// Render thread -> emulation thread
+typedef enum
+{
+    HOST_EVENT_KEYPAD, // value: keypad bitmask
+    HOST_EVENT_REWIND, // value: 1 while backspace is held
+    HOST_EVENT_TURBO,
+    HOST_EVENT_SAVE_STATE,
+    HOST_EVENT_LOAD_STATE,
+    HOST_EVENT_DUMP_TRACE,
+    HOST_EVENT_QUIT
+} HostEventType;
+
+typedef struct
+{
+    uint8_t type;
+    uint16_t value;
+    uint64_t time_ns; // Host time it was polled at, applied at the matching cycle
+} HostEvent;
+
+// Emulation thread -> render thread
+typedef struct
+{
+    uint64_t display[CHIP8_SCREEN_HEIGHT];
+    uint8_t turbo;
+    char stats_text[64];
+} Frame;
+
+typedef struct
+{
+    // Owned by the emulation thread until it is joined
+    Chip8 chip8;
+    Chip8Rom rom;
+    Chip8Scheduler scheduler;
+    int clock_frequency;
+    char state_filename[1024];
+    int rewinding;
+
+    // Sound timer state last reported to the tone generator, -1 to report it again after a jump
+    int sound_on;
+
+    // Turbo runs uncapped in emulated time, publishing once every turbo_frames emulated frames
+    int turbo;
+    int turbo_frames;
+
+    // Achieved speed, measured over TURBO_STATS_INTERVAL_NS and shown while in turbo
+    uint64_t stats_start_ns;
+    uint64_t stats_start_cycles;
+    char stats_text[64];
+
+    // Start of the current real-time frame interval for the telemetry, 0 after a mode change
+    uint64_t interval_start_ns;
+    uint64_t interval_start_cycles;
+
+    // Signalled by post_event, so the emulation thread applies an event as soon as it arrives
+    // (an FX0A wait sleeps until the next frame otherwise)
+    pthread_mutex_t wake_lock;
+    pthread_cond_t wake;
+    int woken;
+
+    SpscQueue events;
+    TripleBuffer frames;
+    Frame frame_slots[3];
+} Emulator;
+
+static Emulator emulator;
+
+// Sound timer tone, fed by the emulation thread and rendered on raylib's audio thread
+static ToneGenerator tone;
+
+// Set when tracing is enabled with --trace, dumped on exit, on F2 and on crash
+static Chip8Trace trace;
+static const char *trace_filename = NULL;
+
+// The trace file opened up front for the crash handler, which may not use stdio
+static int trace_fd = -1;
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// Rewind journal, one record per frame, hold backspace to step back
+static Chip8Rewind rewind_journal;
+static uint8_t rewind_arena[REWIND_ARENA_SIZE];
+
+// Set when profiling is enabled with --profile, the report and heatmap are written on exit
+static const char *profile_filename = NULL;
+
+// Set when recording with --record, stops when the run is no longer a straight line (F9, rewind)
+static Chip8InputLog input_log;
+
+// Set with --spectate, every presented frame goes out to the connected viewers
+static Chip8Spectator spectator;
+static const char *spectate_path = NULL;
+
+// Always collected, written to the --stats file once a second and summarized on exit
+static Telemetry telemetry;
+static const char *stats_filename = NULL;
+
+#if CHIP8_PROFILE
+static Chip8Profile profile;
+
+static void write_profile(const Chip8 *chip8)
+{
+    FILE *file = fopen(profile_filename, "w");
+    if (file == NULL)
+    {
+        printf("Error: Could not write profile '%s'\n", profile_filename);
+        return;
+    }
+    chip8_profile_write_report(&profile, chip8, file, PROFILE_TOP_N);
+    fclose(file);
+
+    char heatmap_filename[1024];
+    snprintf(heatmap_filename, sizeof(heatmap_filename), "%s.csv", profile_filename);
+    file = fopen(heatmap_filename, "w");
+    if (file == NULL)
+    {
+        printf("Error: Could not write heatmap '%s'\n", heatmap_filename);
+        return;
+    }
+    chip8_profile_write_heatmap(&profile, file);
+    fclose(file);
+
+    printf("Info: Profile written to '%s' and '%s'\n", profile_filename, heatmap_filename);
+}
+#endif
+
+// Async-signal-safe: the crash may be inside malloc or stdio, so only lseek, write and ftruncate
+static void dump_trace_on_crash(int signal_number)
+{
+    if (lseek(trace_fd, 0, SEEK_SET) == 0 && chip8_trace_dump_fd(&trace, trace_fd) == 0)
+    {
+        ftruncate(trace_fd, lseek(trace_fd, 0, SEEK_CUR));
+    }
+
+    signal(signal_number, SIG_DFL);
+    raise(signal_number);
+}
+
+// Host key of each CHIP-8 key, maps this
+// 1 	2 	3 	4
+// Q 	W 	E 	R
+// A 	S 	D 	F
+// Z 	X 	C 	V
+
+// to this
+// 1 	2 	3 	C
+// 4 	5 	6 	D
+// 7 	8 	9 	E
+// A 	0 	B 	F
+static const int key_map[CHIP8_NUM_KEYS] = {
+    KEY_X, KEY_ONE, KEY_TWO, KEY_THREE, KEY_Q, KEY_W, KEY_E, KEY_A,
+    KEY_S, KEY_D, KEY_Z, KEY_C, KEY_FOUR, KEY_R, KEY_F, KEY_V};
+
+static void stop_recording(const Chip8 *chip8)
+{
+    if (input_log.file == NULL)
+    {
+        return;
+    }
+
+    if (chip8_input_log_close(&input_log, chip8->cycles, chip8_display_hash(chip8->display)) != 0)
+    {
+        printf("Error: Could not finish the input log\n");
+    }
+    else
+    {
+        printf("Info: Recording stopped at cycle %llu\n", (unsigned long long)chip8->cycles);
+    }
+}
+
+static void start_stats(Emulator *emu)
+{
+    emu->stats_start_ns = host_clock_ns();
+    emu->stats_start_cycles = emu->chip8.cycles;
+    snprintf(emu->stats_text, sizeof(emu->stats_text), "TURBO");
+}
+
+static void update_stats(Emulator *emu)
+{
+    uint64_t now = host_clock_ns();
+    if (!emu->turbo || now - emu->stats_start_ns < TURBO_STATS_INTERVAL_NS)
+    {
+        return;
+    }
+
+    double mips = (double)(emu->chip8.cycles - emu->stats_start_cycles) / ((double)(now - emu->stats_start_ns) / 1e3);
+    snprintf(emu->stats_text, sizeof(emu->stats_text), "TURBO %.1f MIPS %.1fx", mips,
+             mips * 1e6 / (emu->clock_frequency > 0 ? emu->clock_frequency : 1));
+
+    emu->stats_start_ns = now;
+    emu->stats_start_cycles = emu->chip8.cycles;
+}
+
+// Reports a sound timer transition at the current cycle, retried on the next call if the queue is full
+static void report_sound(Emulator *emu)
+{
+    int on = emu->chip8.sound_timer > 0;
+
+    if (on != emu->sound_on && tone_generator_push(&tone, emu->chip8.cycles, on) == 0)
+    {
+        emu->sound_on = on;
+    }
+}
+
+// The interpreter, reporting sound timer transitions at the exact cycle they happen
+// Timer ticks fall between calls, so a tick that stopped the sound is caught on entry.
+static uint64_t run_with_sound(Chip8 *chip8, void *engine, uint64_t cycles)
+{
+    Emulator *emu = engine;
+    uint64_t start_ns = host_clock_ns();
+    uint64_t executed = cycles;
+
+    report_sound(emu);
+
+    for (uint64_t i = 0; i < cycles; i++)
+    {
+        chip8_cycle(chip8);
+        if ((chip8->sound_timer > 0) != emu->sound_on)
+        {
+            report_sound(emu);
+        }
+
+        // Stops right after an idle loop iteration, like the default interpreter
+        if (chip8->idle != CHIP8_IDLE_NONE)
+        {
+            executed = i + 1;
+            break;
+        }
+    }
+
+    histogram_record(&telemetry.batch_ns, host_clock_ns() - start_ns);
+
+    return executed;
+}
+
+// Cycles owed for the host time from start_ns to end_ns, and how many of them ran so far
+typedef struct
+{
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t cycles;
+    uint64_t done;
+} EmulationSlice;
+
+// Runs the slice up to the cycle matching host time `time_ns`, all of it from end_ns on
+static void run_slice_until(Emulator *emu, EmulationSlice *slice, uint64_t time_ns)
+{
+    uint64_t target = slice->cycles;
+    if (time_ns < slice->end_ns)
+    {
+        target = time_ns > slice->start_ns
+                     ? (time_ns - slice->start_ns) * slice->cycles / (slice->end_ns - slice->start_ns)
+                     : 0;
+    }
+
+    if (target > slice->done)
+    {
+        chip8_scheduler_run_cycles(&emu->scheduler, &emu->chip8, target - slice->done);
+        slice->done = target;
+    }
+}
+
+// Applies everything the render thread sent, returns 0 once asked to quit
+// In real time each event lands at the cycle of `slice` matching its time stamp, the cycles
+// before it are run first. Mode changes end the slice. `slice` is NULL otherwise.
+static int handle_events(Emulator *emu, EmulationSlice *slice)
+{
+    Chip8 *chip8 = &emu->chip8;
+    HostEvent event;
+
+    while (spsc_queue_pop(&emu->events, &event) == 0)
+    {
+        if (slice != NULL)
+        {
+            run_slice_until(emu, slice, event.time_ns);
+
+            // Rewinding and turbo leave real time, a load replaces the machine
+            if (event.type == HOST_EVENT_REWIND || event.type == HOST_EVENT_TURBO ||
+                event.type == HOST_EVENT_LOAD_STATE)
+            {
+                slice->cycles = slice->done;
+            }
+        }
+
+        switch (event.type)
+        {
+        case HOST_EVENT_KEYPAD:
+            chip8_set_keypad_mask(chip8, event.value);
+            chip8_input_log_record(&input_log, chip8->cycles, event.value);
+            histogram_record(&telemetry.input_ns, host_clock_ns() - event.time_ns);
+            break;
+
+        // Emulation is paused while rewinding
+        case HOST_EVENT_REWIND:
+            emu->rewinding = event.value;
+            emu->interval_start_ns = 0;
+            if (emu->rewinding)
+            {
+                stop_recording(chip8);
+            }
+            break;
+
+        // Leaving turbo must not catch up on the time spent in turbo
+        case HOST_EVENT_TURBO:
+            emu->turbo = !emu->turbo;
+            emu->interval_start_ns = 0;
+            chip8_scheduler_resync(&emu->scheduler, host_clock_ns());
+            start_stats(emu);
+            break;
+
+        case HOST_EVENT_SAVE_STATE:
+            if (chip8_save_state(chip8, &emu->rom, emu->state_filename) != 0)
+            {
+                printf("Error: Could not save state to '%s'\n", emu->state_filename);
+            }
+            break;
+
+        case HOST_EVENT_LOAD_STATE:
+            if (chip8_load_state(chip8, &emu->rom, emu->state_filename) != 0)
+            {
+                printf("Error: Could not load state from '%s'\n", emu->state_filename);
+            }
+            chip8_rewind_reset(&rewind_journal, chip8);
+            chip8_scheduler_sync_phase(&emu->scheduler, chip8->cycles);
+            stop_recording(chip8);
+            emu->sound_on = -1;
+            emu->interval_start_ns = 0;
+            break;
+
+        case HOST_EVENT_DUMP_TRACE:
+            if (chip8->trace != NULL)
+            {
+                chip8_trace_dump(&trace, trace_filename);
+            }
+            break;
+
+        case HOST_EVENT_QUIT:
+            return 0;
+
+        default:
+            break;
+        }
+    }
+
+    return 1;
+}
 
-void get_input(uint8_t input[])
+static void publish_frame(Emulator *emu)
 {
+    Frame *frame = triple_buffer_back(&emu->frames);
+
+    memcpy(frame->display, emu->chip8.display, sizeof(frame->display));
+    frame->turbo = (uint8_t)emu->turbo;
+    memcpy(frame->stats_text, emu->stats_text, sizeof(frame->stats_text));
+
+    triple_buffer_publish(&emu->frames);
+    atomic_fetch_add_explicit(&telemetry.frames_published, 1, memory_order_relaxed);
+}
+
+// Emulated against host time over the frame interval that just ended, in real-time mode only
+// The interval restarts on every mode change, turbo and rewinding are not real time.
+static void measure_interval(Emulator *emu, uint64_t now)
+{
+    if (emu->turbo || emu->rewinding)
+    {
+        emu->interval_start_ns = 0;
+        return;
+    }
+
+    if (emu->interval_start_ns != 0 && now > emu->interval_start_ns)
+    {
+        uint64_t elapsed_ns = now - emu->interval_start_ns;
+        uint64_t cycles = emu->chip8.cycles - emu->interval_start_cycles;
+
+        atomic_fetch_add_explicit(&telemetry.realtime_ns, elapsed_ns, memory_order_relaxed);
+        atomic_fetch_add_explicit(&telemetry.realtime_cycles, cycles, memory_order_relaxed);
+        histogram_record(&telemetry.speed_percent,
+                         (uint64_t)((double)cycles * 1e11 / ((double)elapsed_ns * emu->clock_frequency) + 0.5));
+    }
+
+    emu->interval_start_ns = now;
+    emu->interval_start_cycles = emu->chip8.cycles;
+}
+
+// Sleeps for up to `ns`, returns early when post_event signals an event
+static void wait_for_event(Emulator *emu, uint64_t ns)
+{
+    struct timespec deadline;
+    timespec_get(&deadline, TIME_UTC);
+    deadline.tv_sec += (time_t)(ns / 1000000000ULL);
+    deadline.tv_nsec += (long)(ns % 1000000000ULL);
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&emu->wake_lock);
+    while (!emu->woken && pthread_cond_timedwait(&emu->wake, &emu->wake_lock, &deadline) == 0)
+    {
+    }
+    emu->woken = 0;
+    pthread_mutex_unlock(&emu->wake_lock);
+}
+
+// Runs the cycles owed in slices of EMULATION_SLICE_NS, woken early by events
+// Rewind records and steps back once per FRAME_NS, like the render frames they used to follow.
+// While the machine waits for a key (FX0A) with the tone off, nothing can change before an
+// event or the next frame, so it sleeps until then instead of spinning through idle slices.
+static void *emulation_thread(void *arg)
+{
+    Emulator *emu = arg;
+    Chip8 *chip8 = &emu->chip8;
+
+    chip8_scheduler_init(&emu->scheduler, emu->clock_frequency, host_clock_ns());
+    emu->scheduler.run = run_with_sound;
+    emu->scheduler.engine = emu;
+    start_stats(emu);
+    publish_frame(emu);
+
+    uint64_t next_frame_ns = host_clock_ns() + FRAME_NS;
+
+    for (;;)
+    {
+        uint64_t now = host_clock_ns();
+        int frame_due = now >= next_frame_ns;
+        if (frame_due)
+        {
+            next_frame_ns = (now - next_frame_ns < FRAME_NS) ? next_frame_ns + FRAME_NS : now + FRAME_NS;
+            measure_interval(emu, now);
+        }
+        uint64_t cycles_before = chip8->cycles;
+
+        // Timers tick on exact cycle boundaries, idle loops are fast-forwarded to the next tick
+        // In real time the slice runs around the events, the rest of it after the last one
+        int running;
+        if (!emu->rewinding && !emu->turbo)
+        {
+            EmulationSlice slice = {emu->scheduler.last_ns, now, 0, 0};
+            slice.cycles = chip8_scheduler_advance(&emu->scheduler, now);
+            running = handle_events(emu, &slice);
+            run_slice_until(emu, &slice, now);
+        }
+        else
+        {
+            running = handle_events(emu, NULL);
+        }
+        if (!running)
+        {
+            break;
+        }
+
+        if (emu->rewinding)
+        {
+            if (frame_due)
+            {
+                chip8_rewind_step_back(&rewind_journal, chip8, 1);
+                chip8_scheduler_sync_phase(&emu->scheduler, chip8->cycles);
+                emu->sound_on = -1;
+            }
+            chip8_scheduler_resync(&emu->scheduler, now);
+        }
+        else if (emu->turbo)
+        {
+            // Emulated time only, as many frames as the host can run
+            for (int f = 0; f < emu->turbo_frames; f++)
+            {
+                chip8_scheduler_run_frame(&emu->scheduler, chip8);
+            }
+            frame_due = 1;
+            update_stats(emu);
+        }
 
-    // Map this
-    // 1 	2 	3 	4
-    // Q 	W 	E 	R
-    // A 	S 	D 	F
-    // Z 	X 	C 	V
+        // Rewinding and loads move the cycle count back, only what ran counts
+        if (chip8->cycles > cycles_before)
+        {
+            atomic_fetch_add_explicit(&telemetry.cycles, chip8->cycles - cycles_before, memory_order_relaxed);
+        }
 
-    // to this
-    // 1 	2 	3 	C
-    // 4 	5 	6 	D
-    // 7 	8 	9 	E
-    // A 	0 	B 	F
+        // Also catches the last tick of the slice, and jumps from rewinding or loading
+        report_sound(emu);
+        tone_generator_advance(&tone, chip8->cycles);
 
-    memset(input, 0, sizeof(uint8_t) * CHIP8_NUM_KEYS);
+        // Journal what this frame changed
+        if (frame_due && !emu->rewinding)
+        {
+            chip8_rewind_record(&rewind_journal, chip8);
+        }
 
-    if (IsKeyDown(KEY_ONE))
-        input[0x1] = 1;
+        if (frame_due || chip8->dirty_rows != 0)
+        {
+            chip8->dirty_rows = 0;
+            publish_frame(emu);
+        }
 
-    if (IsKeyDown(KEY_TWO))
-        input[0x2] = 1;
+        if (!emu->turbo)
+        {
+            uint64_t after = host_clock_ns();
+            int waiting = !emu->rewinding && chip8_waiting_for_key(chip8) && chip8->sound_timer == 0;
+            uint64_t wake = !waiting && after + EMULATION_SLICE_NS < next_frame_ns ? after + EMULATION_SLICE_NS
+                                                                                   : next_frame_ns;
+            if (wake > after)
+            {
+                wait_for_event(emu, wake - after);
+            }
+        }
+    }
 
-    if (IsKeyDown(KEY_THREE))
-        input[0x3] = 1;
+    return NULL;
+}
 
-    if (IsKeyDown(KEY_FOUR))
-        input[0xC] = 1;
+// Runs on raylib's audio thread, 16-bit mono
+static void fill_audio(void *buffer, unsigned int frames)
+{
+    tone_generator_fill(&tone, buffer, frames);
+}
 
-    if (IsKeyDown(KEY_Q))
-        input[0x4] = 1;
+// Retries until the emulation thread made room, it drains the queue every slice
+static void post_event(Emulator *emu, uint8_t type, uint16_t value, uint64_t time_ns)
+{
+    HostEvent event = {type, value, time_ns};
+
+    while (spsc_queue_push(&emu->events, &event) != 0)
+    {
+        host_sleep_ns(EMULATION_SLICE_NS);
+    }
+
+    pthread_mutex_lock(&emu->wake_lock);
+    emu->woken = 1;
+    pthread_cond_signal(&emu->wake);
+    pthread_mutex_unlock(&emu->wake_lock);
+}
 
-    if (IsKeyDown(KEY_W))
-        input[0x5] = 1;
+// Input as last sent by the window thread, only changes are sent
+typedef struct
+{
+    uint16_t keys;
+    int rewinding;
 
-    if (IsKeyDown(KEY_E))
-        input[0x6] = 1;
+    // Host time of each key's last press, a tap is held down for at least KEY_TAP_NS so a
+    // ROM reading the keys once a frame still sees it
+    uint64_t pressed_ns[CHIP8_NUM_KEYS];
+} HostInput;
 
-    if (IsKeyDown(KEY_R))
-        input[0xD] = 1;
+// Sends the input that changed since the last call, right after raylib polled it
+// Presses come from raylib's key queue too, a tap between two polls is not lost.
+static void send_input(Emulator *emu, HostInput *input)
+{
+    uint64_t now = host_clock_ns();
 
-    if (IsKeyDown(KEY_A))
-        input[0x7] = 1;
+    if (trace_filename != NULL && IsKeyPressed(KEY_F2))
+    {
+        post_event(emu, HOST_EVENT_DUMP_TRACE, 0, now);
+    }
 
-    if (IsKeyDown(KEY_S))
-        input[0x8] = 1;
+    // F5 saves, F9 loads the save state
+    if (IsKeyPressed(KEY_F5))
+    {
+        post_event(emu, HOST_EVENT_SAVE_STATE, 0, now);
+    }
 
-    if (IsKeyDown(KEY_D))
-        input[0x9] = 1;
+    if (IsKeyPressed(KEY_F9))
+    {
+        post_event(emu, HOST_EVENT_LOAD_STATE, 0, now);
+    }
 
-    if (IsKeyDown(KEY_F))
-        input[0xE] = 1;
+    // Tab toggles turbo
+    if (IsKeyPressed(KEY_TAB))
+    {
+        post_event(emu, HOST_EVENT_TURBO, 0, now);
+    }
 
-    if (IsKeyDown(KEY_Z))
-        input[0xA] = 1;
+    // Step back one frame per frame while backspace is held, emulation is paused meanwhile
+    int rewinding = IsKeyDown(KEY_BACKSPACE);
+    if (rewinding != input->rewinding)
+    {
+        post_event(emu, HOST_EVENT_REWIND, (uint16_t)rewinding, now);
+        input->rewinding = rewinding;
+    }
 
-    if (IsKeyDown(KEY_X))
-        input[0x0] = 1;
+    for (int pressed = GetKeyPressed(); pressed != 0; pressed = GetKeyPressed())
+    {
+        for (uint8_t key = 0; key < CHIP8_NUM_KEYS; key++)
+        {
+            if (key_map[key] == pressed)
+            {
+                input->pressed_ns[key] = now;
+            }
+        }
+    }
 
-    if (IsKeyDown(KEY_C))
-        input[0xB] = 1;
+    uint16_t keys = 0;
+    for (uint8_t key = 0; key < CHIP8_NUM_KEYS; key++)
+    {
+        int held = input->pressed_ns[key] != 0 && now - input->pressed_ns[key] < KEY_TAP_NS;
+        keys |= (uint16_t)(IsKeyDown(key_map[key]) || held) << key;
+    }
 
-    if (IsKeyDown(KEY_V))
-        input[0xF] = 1;
+    if (keys != input->keys)
+    {
+        post_event(emu, HOST_EVENT_KEYPAD, keys, now);
+        input->keys = keys;
+    }
 }
 
 int main(int argc, char *argv[])
 {
+    Emulator *emu = &emulator;
 
     // Init chip8
     if (argc < 3)
     {
-        printf("Usage: chip8 <rom_file> <clock frequency>\n", REFRESH_RATE);
+        printf("Usage: chip8 <rom_file> <clock frequency> [--trace <trace_file>] [--profile <report_file>] [--turbo <frames_per_render>] [--seed <n>] [--record <input_log>] [--audio-buffer <frames>] [--quirks <profile>] [--spectate <socket_path>] [--stats <stats_file>]\n");
         return 1;
     }
 
-    Chip8 chip8;
-    chip8_init(&chip8);
+    emu->turbo = 0;
+    emu->turbo_frames = TURBO_FRAMES_PER_RENDER;
+
+    // CXNN draws from a per-machine generator, a fixed seed gives the same numbers every run
+    uint64_t seed = host_clock_ns();
+    const char *record_filename = NULL;
+    const char *quirks_text = NULL;
+
+    // Audio latency, smaller buffers play the tone sooner but underrun on a busy host
+    int audio_buffer_frames = AUDIO_BUFFER_FRAMES;
 
-    int ret = chip8_load_rom(&chip8, argv[1]);
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--trace") == 0)
+        {
+            trace_filename = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--profile") == 0)
+        {
+            profile_filename = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--turbo") == 0)
+        {
+            emu->turbo = 1;
+            emu->turbo_frames = atoi(argv[i + 1]) > 0 ? atoi(argv[i + 1]) : 1;
+        }
+        else if (strcmp(argv[i], "--seed") == 0)
+        {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--record") == 0)
+        {
+            record_filename = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--audio-buffer") == 0)
+        {
+            audio_buffer_frames = atoi(argv[i + 1]) > 0 ? atoi(argv[i + 1]) : AUDIO_BUFFER_FRAMES;
+        }
+        else if (strcmp(argv[i], "--quirks") == 0)
+        {
+            quirks_text = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--spectate") == 0)
+        {
+            spectate_path = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+            stats_filename = argv[i + 1];
+        }
+    }
+
+    Chip8 *chip8 = &emu->chip8;
+    chip8_init(chip8);
+    chip8_seed(chip8, seed);
+
+    // The ROM image is kept for save states
+    int ret = chip8_rom_read(&emu->rom, argv[1]);
     if (ret != 0)
     {
         printf("Error: Could not load ROM file '%s'. Exiting...\n", argv[1]);
@@ -97,11 +728,116 @@ int main(int argc, char *argv[])
     }
     else
     {
+        chip8_load_rom_image(chip8, &emu->rom);
         printf("Info: ROM file loaded...\n");
     }
 
-    const int clock_frequency = atoi(argv[2]);
-    printf("Info: Clock frequency set to %d\n\n\n", clock_frequency);
+    // --quirks wins over the <rom_file>.quirks file, the default is the modern profile
+    uint8_t quirks = 0;
+    if (quirks_text != NULL)
+    {
+        if (chip8_parse_quirks(quirks_text, &quirks) != 0)
+        {
+            printf("Error: Unknown quirks '%s'. Exiting...\n", quirks_text);
+            return 1;
+        }
+    }
+    else
+    {
+        chip8_read_quirks_file(argv[1], &quirks);
+    }
+    chip8_set_quirks(chip8, quirks);
+
+    char quirks_name[64];
+    chip8_format_quirks(quirks, quirks_name, sizeof(quirks_name));
+    printf("Info: Quirks %s\n", quirks_name);
+
+    // Save states go next to the ROM file
+    snprintf(emu->state_filename, sizeof(emu->state_filename), "%s.state", argv[1]);
+
+    if (trace_filename != NULL)
+    {
+        if (chip8_trace_init(&trace, TRACE_CAPACITY, chip8->quirks) != 0)
+        {
+            printf("Error: Could not allocate trace buffer. Exiting...\n");
+            return 1;
+        }
+        chip8->trace = &trace;
+
+        trace_fd = open(trace_filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+        if (trace_fd < 0)
+        {
+            printf("Error: Could not open trace file '%s'. Exiting...\n", trace_filename);
+            return 1;
+        }
+
+        signal(SIGSEGV, dump_trace_on_crash);
+        signal(SIGABRT, dump_trace_on_crash);
+        signal(SIGFPE, dump_trace_on_crash);
+        signal(SIGILL, dump_trace_on_crash);
+
+        printf("Info: Tracing to '%s' (F2 to dump)\n", trace_filename);
+    }
+
+    if (profile_filename != NULL)
+    {
+#if CHIP8_PROFILE
+        chip8_profile_reset(&profile);
+        chip8->profile = &profile;
+        printf("Info: Profiling to '%s'\n", profile_filename);
+#else
+        printf("Warning: Built without CHIP8_PROFILE, --profile is ignored\n");
+#endif
+    }
+
+    emu->clock_frequency = atoi(argv[2]);
+
+    if (record_filename != NULL)
+    {
+        if (chip8_input_log_open(&input_log, record_filename, emu->clock_frequency, emu->rom.hash, seed) != 0)
+        {
+            printf("Error: Could not record to '%s'. Exiting...\n", record_filename);
+            return 1;
+        }
+        printf("Info: Recording input to '%s'\n", record_filename);
+    }
+
+    if (spectate_path != NULL)
+    {
+        if (chip8_spectator_init(&spectator, spectate_path) != 0)
+        {
+            printf("Error: Could not open spectator socket '%s'. Exiting...\n", spectate_path);
+            return 1;
+        }
+        printf("Info: Spectators can connect to '%s'\n", spectate_path);
+    }
+
+    if (stats_filename != NULL)
+    {
+        printf("Info: Writing stats to '%s' every second\n", stats_filename);
+    }
+
+    printf("Info: Random seed %llu\n", (unsigned long long)seed);
+    printf("Info: Clock frequency set to %d\n\n\n", emu->clock_frequency);
+
+    if (spsc_queue_init(&emu->events, sizeof(HostEvent), EVENT_QUEUE_CAPACITY) != 0)
+    {
+        printf("Error: Could not allocate the event queue. Exiting...\n");
+        return 1;
+    }
+    pthread_mutex_init(&emu->wake_lock, NULL);
+    pthread_cond_init(&emu->wake, NULL);
+    emu->woken = 0;
+    triple_buffer_init(&emu->frames, &emu->frame_slots[0], &emu->frame_slots[1], &emu->frame_slots[2]);
+
+    if (tone_generator_init(&tone, AUDIO_SAMPLE_RATE, emu->clock_frequency, audio_buffer_frames) != 0)
+    {
+        printf("Error: Could not allocate the audio queue. Exiting...\n");
+        return 1;
+    }
+
+    chip8_rewind_init(&rewind_journal, rewind_arena, REWIND_ARENA_SIZE, chip8);
+    telemetry_init(&telemetry, emu->clock_frequency, host_clock_ns());
 
     // --
 
@@ -119,84 +855,176 @@ int main(int argc, char *argv[])
     UnloadImage(image); // Don't need image after loading texture
 
     InitAudioDevice();
-    Sound beep = LoadSound("assets/beep.wav");
+    SetAudioStreamBufferSizeDefault(audio_buffer_frames);
+    AudioStream audio = LoadAudioStream(AUDIO_SAMPLE_RATE, 16, 1);
+    SetAudioStreamCallback(audio, fill_audio);
+    PlayAudioStream(audio);
 
-    // If the input clock_frequency is lower than 60, just match it with the refresh rate
-    uint16_t cycles_per_frame;
-    if (clock_frequency < REFRESH_RATE)
-    {
-        cycles_per_frame = 1;
-        SetTargetFPS(clock_frequency);
-    }
-    else
+    pthread_t emulation;
+    if (pthread_create(&emulation, NULL, emulation_thread, emu) != 0)
     {
-        cycles_per_frame = clock_frequency / REFRESH_RATE;
-        SetTargetFPS(REFRESH_RATE);
+        printf("Error: Could not start the emulation thread. Exiting...\n");
+        return 1;
     }
 
-    // For timers
-    float timer_accumulator = 0.0f;
-    const float timer_interval = 1.0f / 60.0f;
+    // For input, only changes are sent
+    HostInput input;
+    memset(&input, 0, sizeof(input));
+
+    // Converted display and what the texture currently shows, only changed rows are rewritten
+    Color pixels[CHIP8_SCREEN_WIDTH * CHIP8_SCREEN_HEIGHT];
+    uint64_t presented[CHIP8_SCREEN_HEIGHT] = {0};
 
-    // For input
-    uint8_t input_array[CHIP8_NUM_KEYS];
+    uint64_t last_present_ns = 0;
+    uint64_t next_present_ns = host_clock_ns();
+    uint64_t next_stats_ns = host_clock_ns() + TELEMETRY_INTERVAL_NS;
 
     while (!WindowShouldClose())
     {
 
-        // Handle input
-        get_input(input_array);
-        chip8_pass_input(&chip8, input_array);
+        // Polled by EndDrawing, or by the last poll while waiting for the next refresh
+        send_input(emu, &input);
 
-        // Handle cycle
-        for (int i = 0; i < cycles_per_frame; i++)
+        // Newest completed frame, the ones in between are never converted
+        int fresh;
+        const Frame *frame = triple_buffer_read(&emu->frames, &fresh);
+        if (fresh)
         {
-            chip8_cycle(&chip8);
+            atomic_fetch_add_explicit(&telemetry.frames_presented, 1, memory_order_relaxed);
         }
 
-        // Handle timers
-        float frame_time = GetFrameTime();
-        timer_accumulator += frame_time;
+        // Convert and upload only the rows that differ from the texture
+        uint64_t upload_start_ns = host_clock_ns();
+        int y = 0;
+        while (fresh && y < CHIP8_SCREEN_HEIGHT)
+        {
+            if (frame->display[y] == presented[y])
+            {
+                y++;
+                continue;
+            }
 
-        while (timer_accumulator >= timer_interval)
+            // Convert one run of consecutive changed rows
+            int first_row = y;
+            for (; y < CHIP8_SCREEN_HEIGHT && frame->display[y] != presented[y]; y++)
+            {
+                for (int x = 0; x < CHIP8_SCREEN_WIDTH; x++)
+                {
+                    int index = y * CHIP8_SCREEN_WIDTH + x;
+                    pixels[index] = ((frame->display[y] >> (CHIP8_SCREEN_WIDTH - 1 - x)) & 1) ? WHITE : BLACK;
+                }
+                presented[y] = frame->display[y];
+            }
+
+            // Upload the run into the GPU texture
+            Rectangle rows = {0, first_row, CHIP8_SCREEN_WIDTH, y - first_row};
+            UpdateTextureRec(texture, rows, &pixels[first_row * CHIP8_SCREEN_WIDTH]);
+        }
+        if (fresh)
         {
-            if (chip8.delay_timer > 0)
-                chip8.delay_timer--;
-            if (chip8.sound_timer > 0)
-                chip8.sound_timer--;
+            histogram_record(&telemetry.upload_ns, host_clock_ns() - upload_start_ns);
+        }
 
-            timer_accumulator -= timer_interval;
+        // Viewers see what the window shows, an unchanged frame costs nothing
+        if (spectate_path != NULL)
+        {
+            chip8_spectator_publish(&spectator, frame->display);
         }
 
-        // Draw to window
-        Color pixels[CHIP8_SCREEN_WIDTH * CHIP8_SCREEN_HEIGHT];
+        uint64_t render_start_ns = host_clock_ns();
+        BeginDrawing();
+        DrawTextureEx(texture, (Vector2){0, 0}, 0.0f, CHIP8_DISPLAY_SCALE, WHITE);
+        if (frame->turbo)
+        {
+            DrawText(frame->stats_text, 10, 10, 20, RED);
+        }
+        histogram_record(&telemetry.render_ns, host_clock_ns() - render_start_ns);
+        EndDrawing();
 
-        for (int y = 0; y < CHIP8_SCREEN_HEIGHT; y++)
+        // A present later than half a refresh past its slot missed one or more refreshes
+        uint64_t now = host_clock_ns();
+        if (last_present_ns != 0)
         {
-            for (int x = 0; x < CHIP8_SCREEN_WIDTH; x++)
+            uint64_t frame_ns = now - last_present_ns;
+            uint64_t refreshes = (frame_ns + FRAME_NS / 2) / FRAME_NS;
+
+            histogram_record(&telemetry.frame_ns, frame_ns);
+            if (refreshes > 1)
             {
-                int index = y * CHIP8_SCREEN_WIDTH + x;
-                pixels[index] = chip8.display[index] ? WHITE : BLACK;
+                atomic_fetch_add_explicit(&telemetry.frames_dropped, refreshes - 1, memory_order_relaxed);
             }
         }
+        last_present_ns = now;
 
-        // Upload pixel array into the GPU texture
-        UpdateTexture(texture, pixels);
-
-        BeginDrawing();
-        DrawTextureEx(texture, (Vector2){0, 0}, 0.0f, CHIP8_DISPLAY_SCALE, WHITE);
-        EndDrawing();
+        if (now >= next_stats_ns)
+        {
+            next_stats_ns = now + TELEMETRY_INTERVAL_NS;
+            atomic_store_explicit(&telemetry.audio_underruns,
+                                  atomic_load_explicit(&tone.underruns, memory_order_relaxed), memory_order_relaxed);
+            if (stats_filename != NULL && telemetry_write(&telemetry, stats_filename, now) != 0)
+            {
+                printf("Error: Could not write stats to '%s'\n", stats_filename);
+            }
+        }
 
-        if (chip8.sound_timer > 0)
+        // Presents once per refresh, polling input every INPUT_POLL_NS until then, so a key
+        // reaches the machine within a millisecond instead of waiting for the next frame
+        next_present_ns = now - next_present_ns < FRAME_NS ? next_present_ns + FRAME_NS : now + FRAME_NS;
+        while (host_clock_ns() + INPUT_POLL_NS <= next_present_ns && !WindowShouldClose())
         {
-            PlaySound(beep);
+            host_sleep_ns(INPUT_POLL_NS);
+            PollInputEvents();
+            send_input(emu, &input);
         }
     }
 
+    post_event(emu, HOST_EVENT_QUIT, 0, host_clock_ns());
+    pthread_join(emulation, NULL);
+
+    if (chip8->trace != NULL)
+    {
+        signal(SIGSEGV, SIG_DFL);
+        signal(SIGABRT, SIG_DFL);
+        signal(SIGFPE, SIG_DFL);
+        signal(SIGILL, SIG_DFL);
+        close(trace_fd);
+
+        chip8_trace_dump(&trace, trace_filename);
+        chip8_trace_free(&trace);
+    }
+
+#if CHIP8_PROFILE
+    if (chip8->profile != NULL)
+    {
+        write_profile(chip8);
+    }
+#endif
+
+    stop_recording(chip8);
+    chip8_rom_free(&emu->rom);
+
+    atomic_store_explicit(&telemetry.audio_underruns, atomic_load_explicit(&tone.underruns, memory_order_relaxed),
+                          memory_order_relaxed);
+    if (stats_filename != NULL && telemetry_write(&telemetry, stats_filename, host_clock_ns()) != 0)
+    {
+        printf("Error: Could not write stats to '%s'\n", stats_filename);
+    }
+    telemetry_print_summary(&telemetry, host_clock_ns());
+
+    if (spectate_path != NULL)
+    {
+        printf("Info: Sent %llu bytes to spectators\n", (unsigned long long)spectator.bytes_sent);
+        chip8_spectator_free(&spectator);
+    }
+    spsc_queue_free(&emu->events);
+    pthread_cond_destroy(&emu->wake);
+    pthread_mutex_destroy(&emu->wake_lock);
+
     UnloadTexture(texture);
-    UnloadSound(beep);
+    UnloadAudioStream(audio);
     CloseAudioDevice();
+    tone_generator_free(&tone);
     CloseWindow();
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_cache.h"
+
+// Ahead-of-time recompiler
+// Turns ROMs into C source for chip8_aot.c: every basic block reachable from 0x200 becomes
+// one function, and each ROM a Chip8AotProgram in chip8_aot_programs. The blocks and the
+// code emitted for each instruction follow the cache engine, see chip8_aot.h.
+//
+// Each ROM is compiled for the quirk profile of its <rom_file>.quirks file, or -q without one.
+
+#define RECOMPILE_MAX_ROMS 64
+
+typedef struct
+{
+    uint64_t hash;
+    uint8_t quirks;
+} RecompiledRom;
+
+// Instructions handled by chip8_execute_opcode or another call that reads or writes V in memory
+static int calls_out(const Chip8CacheEntry *e)
+{
+    return e->handler == CHIP8_OP_FALLBACK || e->handler == CHIP8_OP_FALLBACK_BRANCH ||
+           e->handler == CHIP8_OP_FALLBACK_WRITE || e->handler == CHIP8_OP_JP;
+}
+
+// Registers an inlined instruction reads or writes, as a bitmask
+static uint16_t registers_used(const Chip8CacheEntry *e)
+{
+    uint16_t x = 1 << e->x;
+    uint16_t y = 1 << e->y;
+
+    switch (e->handler)
+    {
+    case CHIP8_OP_SE_VX_NN:
+    case CHIP8_OP_SNE_VX_NN:
+    case CHIP8_OP_LD_VX_NN:
+    case CHIP8_OP_ADD_VX_NN:
+    case CHIP8_OP_LD_VX_DT:
+    case CHIP8_OP_LD_DT_VX:
+    case CHIP8_OP_LD_ST_VX:
+    case CHIP8_OP_ADD_I:
+    case CHIP8_OP_LD_F:
+        return x;
+
+    case CHIP8_OP_SE_VX_VY:
+    case CHIP8_OP_SNE_VX_VY:
+    case CHIP8_OP_LD_VX_VY:
+    case CHIP8_OP_OR:
+    case CHIP8_OP_AND:
+    case CHIP8_OP_XOR:
+        return x | y;
+
+    case CHIP8_OP_ADD_VX_VY:
+    case CHIP8_OP_SUB:
+    case CHIP8_OP_SUBN:
+        return x | y | 0x8000;
+
+    case CHIP8_OP_SHR:
+    case CHIP8_OP_SHL:
+        return x | 0x8000;
+
+    default:
+        return 0;
+    }
+}
+
+// Copies the register locals back into the machine, or reloads them from it
+static void emit_sync(FILE *out, uint16_t registers, int store)
+{
+    for (uint8_t r = 0; r < CHIP8_NUM_VAR_REGISTERS; r++)
+    {
+        if (registers & (1 << r))
+        {
+            if (store)
+            {
+                fprintf(out, "    chip8->V[0x%X] = v%X;\n", r, r);
+            }
+            else
+            {
+                fprintf(out, "    v%X = chip8->V[0x%X];\n", r, r);
+            }
+        }
+    }
+}
+
+// Emits the C for one decoded instruction at `address`
+// Registers are the block's locals vX, in sync with the machine around every call
+static void emit_instruction(FILE *out, const Chip8CacheEntry *e, uint16_t address)
+{
+    fprintf(out, "    // %03X: %04X\n", address, e->opcode);
+
+    switch (e->handler)
+    {
+    case CHIP8_OP_RET:
+        fprintf(out, "    chip8->pc = stack_pop(&chip8->stack);\n");
+        break;
+
+    case CHIP8_OP_JP:
+        fprintf(out, "    chip8->pc = 0x%03X;\n", e->nnn);
+        if (e->nnn <= address)
+        {
+            fprintf(out, "    chip8_detect_idle_loop(chip8, 0x%03X);\n", address);
+        }
+        break;
+
+    case CHIP8_OP_CALL:
+        fprintf(out, "    stack_push(&chip8->stack, chip8->pc);\n");
+        fprintf(out, "    chip8->pc = 0x%03X;\n", e->nnn);
+        break;
+
+    case CHIP8_OP_SE_VX_NN:
+        fprintf(out, "    if (v%X == 0x%02X)\n        chip8->pc += 2;\n", e->x, e->nn);
+        break;
+
+    case CHIP8_OP_SNE_VX_NN:
+        fprintf(out, "    if (v%X != 0x%02X)\n        chip8->pc += 2;\n", e->x, e->nn);
+        break;
+
+    case CHIP8_OP_SE_VX_VY:
+        fprintf(out, "    if (v%X == v%X)\n        chip8->pc += 2;\n", e->x, e->y);
+        break;
+
+    case CHIP8_OP_SNE_VX_VY:
+        fprintf(out, "    if (v%X != v%X)\n        chip8->pc += 2;\n", e->x, e->y);
+        break;
+
+    case CHIP8_OP_LD_VX_NN:
+        fprintf(out, "    v%X = 0x%02X;\n", e->x, e->nn);
+        break;
+
+    case CHIP8_OP_ADD_VX_NN:
+        fprintf(out, "    v%X += 0x%02X;\n", e->x, e->nn);
+        break;
+
+    case CHIP8_OP_LD_VX_VY:
+        fprintf(out, "    v%X = v%X;\n", e->x, e->y);
+        break;
+
+    case CHIP8_OP_OR:
+        fprintf(out, "    v%X |= v%X;\n", e->x, e->y);
+        break;
+
+    case CHIP8_OP_AND:
+        fprintf(out, "    v%X &= v%X;\n", e->x, e->y);
+        break;
+
+    case CHIP8_OP_XOR:
+        fprintf(out, "    v%X ^= v%X;\n", e->x, e->y);
+        break;
+
+    // VF is written before VX, so with X = F the result wins
+    case CHIP8_OP_ADD_VX_VY:
+        fprintf(out, "    {\n");
+        fprintf(out, "        uint16_t sum = v%X + v%X;\n", e->x, e->y);
+        fprintf(out, "        vF = sum > 0xFF;\n");
+        fprintf(out, "        v%X = sum & 0xFF;\n", e->x);
+        fprintf(out, "    }\n");
+        break;
+
+    case CHIP8_OP_SUB:
+        fprintf(out, "    vF = v%X >= v%X;\n", e->x, e->y);
+        fprintf(out, "    v%X = v%X - v%X;\n", e->x, e->x, e->y);
+        break;
+
+    case CHIP8_OP_SHR:
+        fprintf(out, "    vF = v%X & 0x1;\n", e->x);
+        fprintf(out, "    v%X >>= 1;\n", e->x);
+        break;
+
+    case CHIP8_OP_SUBN:
+        fprintf(out, "    vF = v%X >= v%X;\n", e->y, e->x);
+        fprintf(out, "    v%X = v%X - v%X;\n", e->x, e->y, e->x);
+        break;
+
+    case CHIP8_OP_SHL:
+        fprintf(out, "    vF = (v%X >> 7) & 1;\n", e->x);
+        fprintf(out, "    v%X <<= 1;\n", e->x);
+        break;
+
+    case CHIP8_OP_LD_I:
+        fprintf(out, "    chip8->I = 0x%03X;\n", e->nnn);
+        break;
+
+    case CHIP8_OP_LD_VX_DT:
+        fprintf(out, "    v%X = chip8->delay_timer;\n", e->x);
+        break;
+
+    case CHIP8_OP_LD_DT_VX:
+        fprintf(out, "    chip8->delay_timer = v%X;\n", e->x);
+        break;
+
+    case CHIP8_OP_LD_ST_VX:
+        fprintf(out, "    chip8->sound_timer = v%X;\n", e->x);
+        break;
+
+    case CHIP8_OP_ADD_I:
+        fprintf(out, "    chip8->I += v%X;\n", e->x);
+        break;
+
+    case CHIP8_OP_LD_F:
+        fprintf(out, "    chip8->I = 0x50 + v%X * 5;\n", e->x);
+        break;
+
+    // FX33 writes 3 bytes, FX55 writes X + 1 bytes
+    case CHIP8_OP_FALLBACK_WRITE:
+        fprintf(out, "    {\n");
+        fprintf(out, "        uint16_t address = chip8->I;\n");
+        fprintf(out, "        chip8_execute_opcode(chip8, 0x%04X);\n", e->opcode);
+        fprintf(out, "        chip8_aot_invalidate(aot, address, %u);\n", ((e->opcode & 0xFF) == 0x33) ? 3 : e->x + 1);
+        fprintf(out, "    }\n");
+        break;
+
+    // DXYN, CXNN, 00E0, EX9E/EXA1, BNNN, FX0A, FX65 and unknown opcodes
+    default:
+        fprintf(out, "    chip8_execute_opcode(chip8, 0x%04X);\n", e->opcode);
+        break;
+    }
+}
+
+// Emits one block as a function, with the registers it uses held in locals
+static void emit_block(FILE *out, uint32_t index, const Chip8Cache *cache, uint16_t pc)
+{
+    uint8_t length = cache->block_length[pc];
+    const Chip8CacheEntry *entries = &cache->entries[pc];
+
+    // Entries are indexed by address, 2 apart
+    uint16_t used = 0;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        used |= registers_used(&entries[2 * i]);
+    }
+
+    // Only the last instruction of a block reads or changes the PC, it is set past the block first
+    fprintf(out, "static void block_%u_%03X(Chip8 *chip8, Chip8Aot *aot)\n{\n", index, pc);
+    fprintf(out, "    (void)aot;\n");
+    fprintf(out, "    chip8->pc = 0x%03X;\n", pc + 2 * length);
+    for (uint8_t r = 0; r < CHIP8_NUM_VAR_REGISTERS; r++)
+    {
+        if (used & (1 << r))
+        {
+            fprintf(out, "    uint8_t v%X = chip8->V[0x%X];\n", r, r);
+        }
+    }
+    fprintf(out, "\n");
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        const Chip8CacheEntry *e = &entries[2 * i];
+
+        if (calls_out(e))
+        {
+            emit_sync(out, used, 1);
+        }
+        emit_instruction(out, e, (uint16_t)(pc + 2 * i));
+
+        // The call may have changed any register
+        if (calls_out(e) && i + 1 < length)
+        {
+            emit_sync(out, used, 0);
+        }
+    }
+
+    if (length > 0 && !calls_out(&entries[2 * (length - 1)]))
+    {
+        emit_sync(out, used, 1);
+    }
+    fprintf(out, "}\n\n");
+}
+
+// Emits the program for one ROM, returns the number of blocks
+static uint32_t emit_program(FILE *out, uint32_t index, const char *rom_filename, const Chip8 *chip8,
+                             const Chip8Cache *cache)
+{
+    char quirks_name[64];
+    chip8_format_quirks(chip8->quirks, quirks_name, sizeof(quirks_name));
+
+    fprintf(out, "/// ********************\n");
+    fprintf(out, "/// %s\n", rom_filename);
+    fprintf(out, "/// hash %016llX, quirks %s\n", (unsigned long long)chip8->rom_hash, quirks_name);
+    fprintf(out, "/// ********************\n\n");
+
+    fprintf(out, "static const uint8_t memory_%u[CHIP8_MEMORY_SIZE] = {\n", index);
+    for (uint32_t i = 0; i < CHIP8_MEMORY_SIZE; i += 16)
+    {
+        fprintf(out, "   ");
+        for (uint32_t b = 0; b < 16; b++)
+        {
+            fprintf(out, " 0x%02X,", chip8->memory[i + b]);
+        }
+        fprintf(out, "\n");
+    }
+    fprintf(out, "};\n\n");
+
+    uint32_t num_blocks = 0;
+    for (uint32_t pc = 0; pc < CHIP8_MEMORY_SIZE; pc++)
+    {
+        if (cache->block_length[pc] != 0)
+        {
+            emit_block(out, index, cache, (uint16_t)pc);
+            num_blocks++;
+        }
+    }
+
+    fprintf(out, "static const Chip8AotBlockInfo blocks_%u[] = {\n", index);
+    for (uint32_t pc = 0; pc < CHIP8_MEMORY_SIZE; pc++)
+    {
+        if (cache->block_length[pc] != 0)
+        {
+            fprintf(out, "    {0x%03X, %u, block_%u_%03X},\n", pc, cache->block_length[pc], index, pc);
+        }
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const Chip8AotProgram program_%u = {0x%016llXULL, 0x%X, memory_%u, blocks_%u, %u};\n\n",
+            index, (unsigned long long)chip8->rom_hash, chip8->quirks, index, index, num_blocks);
+
+    return num_blocks;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        printf("Usage: recompile <output.c> <rom_file>... [-q quirks]\n");
+        return 1;
+    }
+
+    uint8_t default_quirks = 0;
+    for (int i = 2; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "-q") == 0 && chip8_parse_quirks(argv[i + 1], &default_quirks) != 0)
+        {
+            printf("Error: Unknown quirks '%s'. Exiting...\n", argv[i + 1]);
+            return 1;
+        }
+    }
+
+    FILE *out = fopen(argv[1], "w");
+    if (out == NULL)
+    {
+        printf("Error: Could not open output file '%s'. Exiting...\n", argv[1]);
+        return 1;
+    }
+
+    // Too big for the stack
+    Chip8Cache *cache = malloc(sizeof(Chip8Cache));
+    if (cache == NULL)
+    {
+        printf("Error: Out of memory. Exiting...\n");
+        fclose(out);
+        return 1;
+    }
+
+    fprintf(out, "// Generated by recompile, do not edit\n\n");
+    fprintf(out, "#include \"chip8_aot.h\"\n\n");
+
+    RecompiledRom roms[RECOMPILE_MAX_ROMS];
+    uint32_t num_roms = 0;
+    int failed = 0;
+
+    for (int i = 2; i < argc && !failed; i++)
+    {
+        if (strcmp(argv[i], "-q") == 0)
+        {
+            i++;
+            continue;
+        }
+
+        Chip8 chip8;
+        Chip8Rom rom;
+        chip8_init(&chip8);
+        if (chip8_rom_read(&rom, argv[i]) != 0)
+        {
+            printf("Error: Could not load ROM file '%s'. Exiting...\n", argv[i]);
+            failed = 1;
+            break;
+        }
+        chip8_load_rom_image(&chip8, &rom);
+        chip8_rom_free(&rom);
+
+        uint8_t quirks;
+        if (chip8_read_quirks_file(argv[i], &quirks) != 0)
+        {
+            quirks = default_quirks;
+        }
+        chip8_set_quirks(&chip8, quirks);
+
+        // The same ROM and profile under another name is already compiled
+        int duplicate = 0;
+        for (uint32_t r = 0; r < num_roms; r++)
+        {
+            duplicate |= roms[r].hash == chip8.rom_hash && roms[r].quirks == quirks;
+        }
+        if (duplicate)
+        {
+            continue;
+        }
+        if (num_roms == RECOMPILE_MAX_ROMS)
+        {
+            printf("Error: More than %d ROMs. Exiting...\n", RECOMPILE_MAX_ROMS);
+            failed = 1;
+            break;
+        }
+
+        chip8_cache_prepare(cache, &chip8, CHIP8_PROGRAM_START);
+        uint32_t num_blocks = emit_program(out, num_roms, argv[i], &chip8, cache);
+        printf("Info: %s, %u blocks\n", argv[i], num_blocks);
+
+        roms[num_roms].hash = chip8.rom_hash;
+        roms[num_roms].quirks = quirks;
+        num_roms++;
+    }
+
+    fprintf(out, "const Chip8AotProgram *const chip8_aot_programs[] = {\n");
+    for (uint32_t r = 0; r < num_roms; r++)
+    {
+        fprintf(out, "    &program_%u,\n", r);
+    }
+    if (num_roms == 0)
+    {
+        fprintf(out, "    NULL,\n");
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "const uint32_t chip8_aot_num_programs = %u;\n", num_roms);
+
+    free(cache);
+    failed |= ferror(out) != 0;
+    failed |= fclose(out) != 0;
+
+    if (failed)
+    {
+        remove(argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_input_log.h"
+#include "chip8_scheduler.h"
+#include "chip8_video.h"
+#include "host_clock.h"
+
+// Headless renderer
+// Runs a ROM, or replays an input log, and writes one video frame per 60 Hz timer tick of
+// emulated time, as fast as the host can encode. No window, audio or GPU.
+// Messages go to stderr, so the video can go to stdout (-o -) and into a pipe.
+
+#define RENDER_DEFAULT_CLOCK 700
+#define RENDER_DEFAULT_SCALE 10
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: chip8_render <rom_file> <frames> [-o output] [-f y4m|raw|ppm|png] [-x scale] [-c clock frequency] [-s seed] [-q quirks] [-i input_log]\n");
+        return 1;
+    }
+
+    uint32_t frames = (uint32_t)strtoul(argv[2], NULL, 10);
+    const char *output = "-";
+    Chip8VideoFormat format = CHIP8_VIDEO_Y4M;
+    uint32_t scale = RENDER_DEFAULT_SCALE;
+    uint32_t clock_frequency = RENDER_DEFAULT_CLOCK;
+    uint64_t seed = 0;
+    const char *quirks_text = NULL;
+    const char *log_filename = NULL;
+
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-o") == 0)
+        {
+            output = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-f") == 0)
+        {
+            if (chip8_video_parse_format(argv[i + 1], &format) != 0)
+            {
+                fprintf(stderr, "Error: Unknown format '%s'. Exiting...\n", argv[i + 1]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-x") == 0)
+        {
+            scale = atoi(argv[i + 1]) > 0 ? atoi(argv[i + 1]) : 1;
+        }
+        else if (strcmp(argv[i], "-c") == 0)
+        {
+            clock_frequency = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            quirks_text = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-i") == 0)
+        {
+            log_filename = argv[i + 1];
+        }
+    }
+
+    Chip8 chip8;
+    Chip8Rom rom;
+    chip8_init(&chip8);
+    if (chip8_rom_read(&rom, argv[1]) != 0)
+    {
+        fprintf(stderr, "Error: Could not load ROM file '%s'. Exiting...\n", argv[1]);
+        return 1;
+    }
+    chip8_load_rom_image(&chip8, &rom);
+
+    // -q wins over the <rom_file>.quirks file, like --quirks in the emulator
+    uint8_t quirks = 0;
+    if (quirks_text != NULL)
+    {
+        if (chip8_parse_quirks(quirks_text, &quirks) != 0)
+        {
+            fprintf(stderr, "Error: Unknown quirks '%s'. Exiting...\n", quirks_text);
+            return 1;
+        }
+    }
+    else
+    {
+        chip8_read_quirks_file(argv[1], &quirks);
+    }
+    chip8_set_quirks(&chip8, quirks);
+
+    // A replay uses the recorded seed and clock frequency, 0 frames runs to the end of the recording
+    Chip8InputReplay replay;
+    uint64_t event_cycle = 0;
+    uint16_t keys = 0;
+    int more = 0;
+    uint64_t end_cycle = 0;
+    if (log_filename != NULL)
+    {
+        if (chip8_input_replay_open(&replay, log_filename) != 0)
+        {
+            fprintf(stderr, "Error: Could not read input log '%s'. Exiting...\n", log_filename);
+            return 1;
+        }
+        if (replay.rom_hash != rom.hash)
+        {
+            fprintf(stderr, "Error: Input log '%s' was recorded with another ROM. Exiting...\n", log_filename);
+            return 1;
+        }
+        seed = replay.seed;
+        clock_frequency = replay.clock_frequency;
+        end_cycle = frames == 0 ? replay.end_cycle : 0;
+        more = chip8_input_replay_next(&replay, &event_cycle, &keys) == 0;
+    }
+    chip8_seed(&chip8, seed);
+
+    if (frames == 0 && end_cycle == 0)
+    {
+        fprintf(stderr, "Error: 0 frames needs a closed input log. Exiting...\n");
+        return 1;
+    }
+
+    Chip8Video video;
+    if (chip8_video_open(&video, format, output, scale, CHIP8_TIMER_FREQUENCY) != 0)
+    {
+        fprintf(stderr, "Error: Could not open video output '%s'. Exiting...\n", output);
+        return 1;
+    }
+
+    Chip8Scheduler scheduler;
+    chip8_scheduler_init(&scheduler, clock_frequency, 0);
+
+    uint64_t start_ns = host_clock_ns();
+    int error = 0;
+    for (uint32_t frame = 0; end_cycle != 0 ? chip8.cycles < end_cycle : frame < frames; frame++)
+    {
+        // One frame is up to the next timer tick, split at every recorded keypad change
+        uint64_t frame_end = chip8.cycles + chip8_scheduler_cycles_to_tick(&scheduler);
+        if (end_cycle != 0 && frame_end > end_cycle)
+        {
+            frame_end = end_cycle;
+        }
+
+        while (chip8.cycles < frame_end)
+        {
+            while (more && event_cycle <= chip8.cycles)
+            {
+                chip8_set_keypad_mask(&chip8, keys);
+                more = chip8_input_replay_next(&replay, &event_cycle, &keys) == 0;
+            }
+
+            uint64_t stop = more && event_cycle < frame_end ? event_cycle : frame_end;
+            chip8_scheduler_run_cycles(&scheduler, &chip8, stop - chip8.cycles);
+        }
+
+        if (chip8_video_write(&video, chip8.display) != 0)
+        {
+            error = 1;
+            break;
+        }
+    }
+    double seconds = (host_clock_ns() - start_ns) / 1e9;
+
+    uint32_t written = video.frame;
+    uint64_t encoded = video.frames_encoded;
+    uint64_t bytes = video.bytes_written;
+    if (chip8_video_close(&video) != 0 || error)
+    {
+        fprintf(stderr, "Error: Could not write video output '%s'. Exiting...\n", output);
+        return 1;
+    }
+
+    fprintf(stderr, "Info: %u frames (%llu encoded, the rest unchanged) in %.3f s (%.0f frames/s), %llu bytes\n",
+            written, (unsigned long long)encoded, seconds, seconds > 0 ? written / seconds : 0.0,
+            (unsigned long long)bytes);
+    fprintf(stderr, "cycles=%llu hash=%016llX", (unsigned long long)chip8.cycles,
+            (unsigned long long)chip8_display_hash(chip8.display));
+
+    // Like the batch runner, a replay run to its end checks the recorded display hash
+    if (log_filename != NULL)
+    {
+        if (end_cycle != 0)
+        {
+            fprintf(stderr, " replay=%s",
+                    chip8_display_hash(chip8.display) == replay.display_hash ? "ok" : "mismatch");
+        }
+        chip8_input_replay_close(&replay);
+    }
+    fprintf(stderr, "\n");
+
+    chip8_rom_free(&rom);
+
+    return 0;
+}
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_input_log.h"
+#include "chip8_scheduler.h"
+#include "chip8_search.h"
+#include "host_clock.h"
+#include "thread_pool.h"
+
+// Input search tool
+// Searches the keypad inputs that maximize a goal after a number of steps, each input held for
+// a few frames, and prints the best path found. The path is replayed from boot on chip8_cycle
+// to check it reaches the same state, and can be written as an input log for the batch runner.
+//
+// Goals:
+//      vX       register VX (hex digit)
+//      mNNN     memory byte at NNN (hex address)
+//      pixels   number of pixels on
+// A '-' in front minimizes instead.
+
+#define SEARCH_DEFAULT_CLOCK 700
+
+typedef enum
+{
+    SEARCH_GOAL_REGISTER,
+    SEARCH_GOAL_MEMORY,
+    SEARCH_GOAL_PIXELS
+} SearchGoalType;
+
+typedef struct
+{
+    SearchGoalType type;
+    uint16_t address; // Register or memory address
+    double sign;
+} SearchGoal;
+
+static int search_parse_goal(const char *text, SearchGoal *goal)
+{
+    char *end;
+
+    goal->sign = 1.0;
+    if (text[0] == '-')
+    {
+        goal->sign = -1.0;
+        text++;
+    }
+
+    if (strcmp(text, "pixels") == 0)
+    {
+        goal->type = SEARCH_GOAL_PIXELS;
+        goal->address = 0;
+        return 0;
+    }
+
+    if (text[0] != 'v' && text[0] != 'm')
+    {
+        return 1;
+    }
+
+    unsigned long address = strtoul(text + 1, &end, 16);
+    if (end == text + 1 || *end != '\0')
+    {
+        return 1;
+    }
+
+    goal->type = text[0] == 'v' ? SEARCH_GOAL_REGISTER : SEARCH_GOAL_MEMORY;
+    goal->address = (uint16_t)address;
+
+    return address >= (goal->type == SEARCH_GOAL_REGISTER ? CHIP8_NUM_VAR_REGISTERS : CHIP8_MEMORY_SIZE);
+}
+
+static double search_score_goal(const Chip8 *chip8, void *context)
+{
+    const SearchGoal *goal = context;
+    double value = 0.0;
+
+    switch (goal->type)
+    {
+    case SEARCH_GOAL_REGISTER:
+        value = chip8->V[goal->address];
+        break;
+
+    case SEARCH_GOAL_MEMORY:
+        value = chip8->memory[goal->address];
+        break;
+
+    case SEARCH_GOAL_PIXELS:
+        for (uint8_t y = 0; y < CHIP8_SCREEN_HEIGHT; y++)
+        {
+            for (uint64_t row = chip8->display[y]; row != 0; row &= row - 1)
+            {
+                value += 1.0;
+            }
+        }
+        break;
+    }
+
+    return value != 0.0 ? goal->sign * value : 0.0;
+}
+
+// Runs the path again from the root on chip8_cycle, recording it if `log` is open
+static void search_replay(Chip8 *chip8, const Chip8SearchConfig *config, const uint16_t keys[], uint32_t depth,
+                          Chip8InputLog *log)
+{
+    Chip8Scheduler scheduler;
+    chip8_scheduler_init(&scheduler, config->clock_frequency, 0);
+
+    for (uint32_t step = 0; step < depth; step++)
+    {
+        chip8_set_keypad_mask(chip8, keys[step]);
+        chip8_input_log_record(log, chip8->cycles, keys[step]);
+
+        for (uint32_t frame = 0; frame < config->frames_per_input; frame++)
+        {
+            chip8_scheduler_run_frame(&scheduler, chip8);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("Usage: chip8_search <rom_file> [-g goal] [-d depth] [-w beam width] [-f frames per input] [-j threads] [-c clock frequency] [-s seed] [-q quirks] [-o input_log]\n");
+        return 1;
+    }
+
+    Chip8SearchConfig config;
+    config.beam_width = 64;
+    config.depth = 20;
+    config.frames_per_input = 6;
+    config.clock_frequency = SEARCH_DEFAULT_CLOCK;
+
+    SearchGoal goal = {SEARCH_GOAL_PIXELS, 0, 1.0};
+    int num_threads = thread_pool_num_cores();
+    uint64_t seed = 0;
+    const char *quirks_text = NULL;
+    const char *log_filename = NULL;
+
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-g") == 0)
+        {
+            if (search_parse_goal(argv[i + 1], &goal) != 0)
+            {
+                printf("Error: Unknown goal '%s'. Exiting...\n", argv[i + 1]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-d") == 0)
+        {
+            config.depth = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-w") == 0)
+        {
+            config.beam_width = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-f") == 0)
+        {
+            config.frames_per_input = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-j") == 0)
+        {
+            num_threads = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-c") == 0)
+        {
+            config.clock_frequency = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            quirks_text = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            log_filename = argv[i + 1];
+        }
+    }
+    config.score = search_score_goal;
+    config.context = &goal;
+
+    Chip8 root;
+    Chip8Rom rom;
+    chip8_init(&root);
+    chip8_seed(&root, seed);
+    if (chip8_rom_read(&rom, argv[1]) != 0)
+    {
+        printf("Error: Could not load ROM file '%s'. Exiting...\n", argv[1]);
+        return 1;
+    }
+    chip8_load_rom_image(&root, &rom);
+
+    // -q wins over the <rom_file>.quirks file, like --quirks in the emulator
+    uint8_t quirks = 0;
+    if (quirks_text != NULL)
+    {
+        if (chip8_parse_quirks(quirks_text, &quirks) != 0)
+        {
+            printf("Error: Unknown quirks '%s'. Exiting...\n", quirks_text);
+            return 1;
+        }
+    }
+    else
+    {
+        chip8_read_quirks_file(argv[1], &quirks);
+    }
+    chip8_set_quirks(&root, quirks);
+
+    ThreadPool pool;
+    if (thread_pool_init(&pool, num_threads) != 0)
+    {
+        printf("Error: Could not start thread pool. Exiting...\n");
+        return 1;
+    }
+
+    Chip8Search search;
+    uint16_t *keys = malloc((config.depth + 1) * sizeof(uint16_t));
+    if (keys == NULL || chip8_search_init(&search, &root, &config, &pool) != 0)
+    {
+        printf("Error: Out of memory. Exiting...\n");
+        return 1;
+    }
+
+    uint64_t start_ns = host_clock_ns();
+    int out_of_memory = chip8_search_run(&search);
+    double seconds = (host_clock_ns() - start_ns) / 1e9;
+    thread_pool_destroy(&pool);
+
+    if (out_of_memory)
+    {
+        printf("Warning: Out of memory, stopped at depth %u\n", search.depth_reached);
+    }
+
+    Chip8 best;
+    double score = chip8_search_best(&search, &best, keys);
+
+    uint64_t references = search.pages_written + search.pages_shared;
+    printf("Info: %llu forks in %.3f s (%.0f forks/s), %llu duplicates dropped\n",
+           (unsigned long long)search.forks_run, seconds, seconds > 0 ? search.forks_run / seconds : 0.0,
+           (unsigned long long)search.duplicates);
+    printf("Info: %llu pages written, %llu shared (%.1f %%), arena of %llu pages\n",
+           (unsigned long long)search.pages_written, (unsigned long long)search.pages_shared,
+           references > 0 ? 100.0 * search.pages_shared / references : 0.0,
+           (unsigned long long)chip8_search_pool_pages(&search));
+
+    printf("score=%g depth=%u keys=", score, search.depth_reached);
+    for (uint32_t step = 0; step < search.depth_reached; step++)
+    {
+        uint16_t mask = keys[step];
+        if (mask == 0)
+        {
+            printf("-");
+        }
+        for (uint8_t k = 0; k < CHIP8_NUM_KEYS; k++)
+        {
+            if ((mask >> k) & 1)
+            {
+                printf("%X", k);
+            }
+        }
+        printf(step + 1 < search.depth_reached ? " " : "");
+    }
+    printf(" hash=%016llX", (unsigned long long)chip8_display_hash(best.display));
+
+    Chip8InputLog log;
+    log.file = NULL;
+    if (log_filename != NULL &&
+        chip8_input_log_open(&log, log_filename, config.clock_frequency, rom.hash, seed) != 0)
+    {
+        printf("\nError: Could not write input log '%s'. Exiting...\n", log_filename);
+        return 1;
+    }
+
+    Chip8 replay = root;
+    search_replay(&replay, &config, keys, search.depth_reached, &log);
+    int replay_ok = replay.cycles == best.cycles &&
+                    chip8_display_equal(replay.display, best.display) && replay.pc == best.pc &&
+                    memcmp(replay.V, best.V, sizeof(replay.V)) == 0 &&
+                    memcmp(replay.memory, best.memory, sizeof(replay.memory)) == 0;
+    printf(" replay=%s\n", replay_ok ? "ok" : "mismatch");
+
+    if (log_filename != NULL && chip8_input_log_close(&log, replay.cycles, chip8_display_hash(replay.display)) != 0)
+    {
+        printf("Error: Could not write input log '%s'. Exiting...\n", log_filename);
+        return 1;
+    }
+
+    chip8_search_free(&search);
+    chip8_rom_free(&rom);
+    free(keys);
+
+    return replay_ok ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8_spectator.h"
+
+// Reference spectator client
+// Connects to an emulator started with --spectate, rebuilds every frame from the keyframes and
+// deltas and draws it in the terminal. With -s it prints one line per message instead, with the
+// display hash the batch runner and input logs use.
+
+static void draw(const uint64_t display[])
+{
+    char text[(CHIP8_SCREEN_WIDTH + 1) * CHIP8_SCREEN_HEIGHT + 1];
+    char *out = text;
+
+    for (int y = 0; y < CHIP8_SCREEN_HEIGHT; y++)
+    {
+        for (int x = 0; x < CHIP8_SCREEN_WIDTH; x++)
+        {
+            *out++ = ((display[y] >> (CHIP8_SCREEN_WIDTH - 1 - x)) & 1) ? '#' : ' ';
+        }
+        *out++ = '\n';
+    }
+    *out = '\0';
+
+    // Cursor home, then overwrite the previous frame
+    printf("\x1b[H%s", text);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("Usage: spectate <socket_path> [-s]\n");
+        return 1;
+    }
+
+    int stats = (argc > 2 && strcmp(argv[2], "-s") == 0);
+
+    Chip8SpectatorViewer viewer;
+    if (chip8_spectator_connect(&viewer, argv[1]) != 0)
+    {
+        printf("Error: Could not connect to '%s'. Exiting...\n", argv[1]);
+        return 1;
+    }
+
+    if (!stats)
+    {
+        printf("\x1b[2J");
+    }
+
+    uint32_t messages = 0;
+    while (chip8_spectator_receive(&viewer) == 0)
+    {
+        messages++;
+
+        if (stats)
+        {
+            printf("%c frame=%u size=%u hash=%016llX%s\n", viewer.type, viewer.frame, viewer.size,
+                   (unsigned long long)chip8_display_hash(viewer.display), viewer.synced ? "" : " unsynced");
+        }
+        else if (viewer.synced)
+        {
+            draw(viewer.display);
+        }
+    }
+
+    printf("Info: Stream ended, %u messages, %llu bytes\n", messages, (unsigned long long)viewer.bytes_received);
+    chip8_spectator_disconnect(&viewer);
+
+    return 0;
+}
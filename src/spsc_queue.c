@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc_queue.h"
+
+/// ********************
+/// Queue functions    *
+/// ********************
+
+// capacity must be a power of 2
+int spsc_queue_init(SpscQueue *queue, uint32_t element_size, uint32_t capacity)
+{
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+    {
+        return 1;
+    }
+
+    queue->elements = malloc((size_t)element_size * capacity);
+    queue->element_size = element_size;
+    queue->capacity = capacity;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+
+    return queue->elements == NULL;
+}
+
+// Producer side, returns 1 if the queue is full
+int spsc_queue_push(SpscQueue *queue, const void *element)
+{
+    unsigned tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    if (tail - head == queue->capacity)
+    {
+        return 1;
+    }
+
+    memcpy(queue->elements + (size_t)(tail & (queue->capacity - 1)) * queue->element_size, element,
+           queue->element_size);
+
+    // Publishes the element to the consumer
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+
+    return 0;
+}
+
+// Consumer side, returns 1 if the queue is empty
+int spsc_queue_pop(SpscQueue *queue, void *element)
+{
+    unsigned head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+    if (head == tail)
+    {
+        return 1;
+    }
+
+    memcpy(element, queue->elements + (size_t)(head & (queue->capacity - 1)) * queue->element_size,
+           queue->element_size);
+
+    // Hands the slot back to the producer
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+
+    return 0;
+}
+
+void spsc_queue_free(SpscQueue *queue)
+{
+    free(queue->elements);
+    queue->elements = NULL;
+}
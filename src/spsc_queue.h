@@ -0,0 +1,29 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Lock-free single producer, single consumer ring of fixed-size elements
+// Exactly one thread pushes and exactly one thread pops. head and tail are free running
+// and only ever written by one side each, so acquire/release ordering is all it takes.
+
+typedef struct
+{
+    uint8_t *elements;
+    uint32_t element_size;
+    uint32_t capacity; // Power of 2
+
+    // Written by the consumer only
+    _Alignas(64) atomic_uint head;
+
+    // Written by the producer only, on its own cache line
+    _Alignas(64) atomic_uint tail;
+} SpscQueue;
+
+int spsc_queue_init(SpscQueue *queue, uint32_t element_size, uint32_t capacity);
+int spsc_queue_push(SpscQueue *queue, const void *element);
+int spsc_queue_pop(SpscQueue *queue, void *element);
+void spsc_queue_free(SpscQueue *queue);
+
+#endif
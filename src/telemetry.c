@@ -0,0 +1,120 @@
+#include <stdio.h>
+
+#include "telemetry.h"
+
+#define TELEMETRY_TIMER_FREQUENCY 60
+
+static uint64_t load(const atomic_ullong *value)
+{
+    return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+void telemetry_init(Telemetry *telemetry, uint32_t clock_frequency, uint64_t now_ns)
+{
+    telemetry->start_ns = now_ns;
+    telemetry->clock_frequency = clock_frequency > 0 ? clock_frequency : 1;
+
+    atomic_init(&telemetry->cycles, 0);
+    atomic_init(&telemetry->frames_published, 0);
+    atomic_init(&telemetry->realtime_ns, 0);
+    atomic_init(&telemetry->realtime_cycles, 0);
+    histogram_init(&telemetry->batch_ns);
+    histogram_init(&telemetry->speed_percent);
+    histogram_init(&telemetry->input_ns);
+
+    atomic_init(&telemetry->frames_presented, 0);
+    atomic_init(&telemetry->frames_dropped, 0);
+    histogram_init(&telemetry->frame_ns);
+    histogram_init(&telemetry->upload_ns);
+    histogram_init(&telemetry->render_ns);
+
+    atomic_init(&telemetry->audio_underruns, 0);
+}
+
+// Emulated timer ticks minus 60 Hz host ticks over the real-time part of the session
+// Negative when emulation fell behind (host stalls beyond the scheduler's catch-up limit)
+double telemetry_timer_drift(const Telemetry *telemetry)
+{
+    double emulated = (double)load(&telemetry->realtime_cycles) * TELEMETRY_TIMER_FREQUENCY / telemetry->clock_frequency;
+    double host = (double)load(&telemetry->realtime_ns) * TELEMETRY_TIMER_FREQUENCY / 1e9;
+
+    return emulated - host;
+}
+
+static void telemetry_write_metrics(const Telemetry *telemetry, FILE *file, uint64_t now_ns)
+{
+    double uptime = (double)(now_ns - telemetry->start_ns) / 1e9;
+    uint64_t cycles = load(&telemetry->cycles);
+    uint64_t published = load(&telemetry->frames_published);
+    uint64_t presented = load(&telemetry->frames_presented);
+
+    fprintf(file, "uptime_s %.3f\n", uptime);
+    fprintf(file, "clock_frequency %u\n", telemetry->clock_frequency);
+    fprintf(file, "cycles %llu\n", (unsigned long long)cycles);
+    fprintf(file, "cycles_per_second %.1f\n", uptime > 0 ? cycles / uptime : 0.0);
+    fprintf(file, "timer_drift_ticks %.2f\n", telemetry_timer_drift(telemetry));
+    fprintf(file, "frames_published %llu\n", (unsigned long long)published);
+    fprintf(file, "frames_presented %llu\n", (unsigned long long)presented);
+    fprintf(file, "frames_skipped %llu\n", (unsigned long long)(published > presented ? published - presented : 0));
+    fprintf(file, "frames_dropped %llu\n", (unsigned long long)load(&telemetry->frames_dropped));
+    fprintf(file, "audio_underruns %llu\n", (unsigned long long)load(&telemetry->audio_underruns));
+
+    histogram_write(&telemetry->batch_ns, "batch_ns", file);
+    histogram_write(&telemetry->speed_percent, "speed_percent", file);
+    histogram_write(&telemetry->input_ns, "input_ns", file);
+    histogram_write(&telemetry->frame_ns, "frame_ns", file);
+    histogram_write(&telemetry->upload_ns, "upload_ns", file);
+    histogram_write(&telemetry->render_ns, "render_ns", file);
+}
+
+// Replaces the file with the current metrics, readers see the old or the new file, never a mix
+int telemetry_write(const Telemetry *telemetry, const char *filename, uint64_t now_ns)
+{
+    char temporary[1024];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", filename);
+
+    FILE *file = fopen(temporary, "w");
+    if (file == NULL)
+    {
+        return 1;
+    }
+    telemetry_write_metrics(telemetry, file, now_ns);
+    if (fclose(file) != 0)
+    {
+        return 1;
+    }
+
+#ifdef _WIN32
+    // rename does not replace an existing file here
+    remove(filename);
+#endif
+
+    return rename(temporary, filename) != 0;
+}
+
+void telemetry_print_summary(const Telemetry *telemetry, uint64_t now_ns)
+{
+    double uptime = (double)(now_ns - telemetry->start_ns) / 1e9;
+    uint64_t published = load(&telemetry->frames_published);
+    uint64_t presented = load(&telemetry->frames_presented);
+
+    printf("Info: %.1f cycles/s over %.1f s, timer drift %.2f ticks\n",
+           uptime > 0 ? load(&telemetry->cycles) / uptime : 0.0, uptime, telemetry_timer_drift(telemetry));
+    printf("Info: Speed p1 %llu %%, p50 %llu %%\n",
+           (unsigned long long)histogram_percentile(&telemetry->speed_percent, 1.0),
+           (unsigned long long)histogram_percentile(&telemetry->speed_percent, 50.0));
+    printf("Info: Batch p50 %llu ns, p99 %llu ns, max %llu ns\n",
+           (unsigned long long)histogram_percentile(&telemetry->batch_ns, 50.0),
+           (unsigned long long)histogram_percentile(&telemetry->batch_ns, 99.0),
+           (unsigned long long)load(&telemetry->batch_ns.max));
+    printf("Info: Input latency p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+           histogram_percentile(&telemetry->input_ns, 50.0) / 1e6, histogram_percentile(&telemetry->input_ns, 99.0) / 1e6,
+           load(&telemetry->input_ns.max) / 1e6);
+    printf("Info: Frame time p50 %.2f ms, p99 %.2f ms, upload p99 %llu ns, render p99 %llu ns\n",
+           histogram_percentile(&telemetry->frame_ns, 50.0) / 1e6, histogram_percentile(&telemetry->frame_ns, 99.0) / 1e6,
+           (unsigned long long)histogram_percentile(&telemetry->upload_ns, 99.0),
+           (unsigned long long)histogram_percentile(&telemetry->render_ns, 99.0));
+    printf("Info: Frames %llu presented, %llu skipped, %llu dropped, %llu audio underruns\n",
+           (unsigned long long)presented, (unsigned long long)(published > presented ? published - presented : 0),
+           (unsigned long long)load(&telemetry->frames_dropped), (unsigned long long)load(&telemetry->audio_underruns));
+}
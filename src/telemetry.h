@@ -0,0 +1,56 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "histogram.h"
+
+// Runtime telemetry of the emulator
+// Filled in by the emulation, render and audio threads as they run, each field has a single
+// writer. With --stats the whole block is written to a text file once a second (to a temporary
+// file renamed over the previous one, so readers never see half a file), and a summary is
+// printed on exit. Tells whether a session keeps real time, and where it loses it.
+//
+// File format, one metric per line:
+//      <name> <value>
+//      histogram <name> count=N mean=M min=A p50=B p90=C p99=D p99.9=E max=F
+//      bucket <name> <low> <count>
+
+#define TELEMETRY_INTERVAL_NS 1000000000ULL
+
+typedef struct
+{
+    uint64_t start_ns;
+    uint32_t clock_frequency;
+
+    // Emulation thread
+    atomic_ullong cycles;
+    atomic_ullong frames_published;
+
+    // Host time and cycles run while emulating in real time (not in turbo, paused or rewinding),
+    // their difference is the drift of the emulated 60 Hz timers from the host clock
+    atomic_ullong realtime_ns;
+    atomic_ullong realtime_cycles;
+
+    Histogram batch_ns;      // Host time per batch of chip8_cycle calls
+    Histogram speed_percent; // Emulated time per host frame of real-time emulation, 100 is on time
+    Histogram input_ns;      // From polling a keypad change to the machine running with it
+
+    // Render thread
+    atomic_ullong frames_presented;
+    atomic_ullong frames_dropped; // Display refreshes a presented frame missed
+    Histogram frame_ns;           // Time between presents
+    Histogram upload_ns;          // Converting and uploading changed rows
+    Histogram render_ns;          // Drawing, up to the buffer swap
+
+    // Copied from the tone generator (audio thread) by the render thread
+    atomic_ullong audio_underruns;
+} Telemetry;
+
+void telemetry_init(Telemetry *telemetry, uint32_t clock_frequency, uint64_t now_ns);
+double telemetry_timer_drift(const Telemetry *telemetry);
+int telemetry_write(const Telemetry *telemetry, const char *filename, uint64_t now_ns);
+void telemetry_print_summary(const Telemetry *telemetry, uint64_t now_ns);
+
+#endif
@@ -0,0 +1,310 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "thread_pool.h"
+
+/// ********************
+/// Deque functions    *
+/// ********************
+
+#define THREAD_POOL_INITIAL_CAPACITY 64
+
+static int deque_init(ThreadPoolDeque *deque)
+{
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->head = 0;
+    deque->tail = 0;
+    deque->capacity = THREAD_POOL_INITIAL_CAPACITY;
+    deque->tasks = malloc(deque->capacity * sizeof(ThreadPoolTask));
+
+    return deque->tasks == NULL;
+}
+
+// Returns 1 if the deque was full and could not grow
+static int deque_push_back(ThreadPoolDeque *deque, ThreadPoolTask task)
+{
+    pthread_mutex_lock(&deque->lock);
+
+    // head and tail are free running, the ring index is taken modulo capacity (a power of 2)
+    if (deque->tail - deque->head == deque->capacity)
+    {
+        ThreadPoolTask *grown = malloc(2 * deque->capacity * sizeof(ThreadPoolTask));
+        if (grown == NULL)
+        {
+            pthread_mutex_unlock(&deque->lock);
+            return 1;
+        }
+        for (uint32_t i = 0; i < deque->capacity; i++)
+        {
+            grown[i] = deque->tasks[(deque->head + i) & (deque->capacity - 1)];
+        }
+        free(deque->tasks);
+
+        deque->tasks = grown;
+        deque->tail -= deque->head;
+        deque->head = 0;
+        deque->capacity *= 2;
+    }
+
+    deque->tasks[deque->tail & (deque->capacity - 1)] = task;
+    deque->tail++;
+
+    pthread_mutex_unlock(&deque->lock);
+
+    return 0;
+}
+
+static int deque_pop_back(ThreadPoolDeque *deque, ThreadPoolTask *task)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail != deque->head)
+    {
+        deque->tail--;
+        *task = deque->tasks[deque->tail & (deque->capacity - 1)];
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return found;
+}
+
+static int deque_steal_front(ThreadPoolDeque *deque, ThreadPoolTask *task)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail != deque->head)
+    {
+        *task = deque->tasks[deque->head & (deque->capacity - 1)];
+        deque->head++;
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return found;
+}
+
+/// ********************
+/// Pool functions     *
+/// ********************
+
+typedef struct
+{
+    ThreadPool *pool;
+    int index;
+} WorkerArgs;
+
+// Index of the deque owned by the calling thread, -1 outside the pool
+static _Thread_local int worker_index = -1;
+static _Thread_local ThreadPool *worker_pool = NULL;
+
+static void *worker_main(void *arg)
+{
+    WorkerArgs *args = arg;
+    ThreadPool *pool = args->pool;
+    int self = args->index;
+    free(args);
+
+    worker_index = self;
+    worker_pool = pool;
+
+    for (;;)
+    {
+        // Claim one queued task, it is guaranteed to sit in some deque
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued == 0 && !pool->shutdown)
+        {
+            pthread_cond_wait(&pool->work_available, &pool->lock);
+        }
+
+        if (pool->queued == 0 && pool->shutdown)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pool->queued--;
+        pthread_mutex_unlock(&pool->lock);
+
+        // Own deque first (newest task, warm cache), then steal the oldest task of the others
+        ThreadPoolTask task;
+        int found = deque_pop_back(&pool->deques[self], &task);
+        for (int i = 1; !found; i++)
+        {
+            int victim = (self + i) % pool->num_threads;
+            found = deque_steal_front(&pool->deques[victim], &task);
+        }
+
+        task.fn(task.arg);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->pending--;
+        if (pool->pending == 0)
+        {
+            pthread_cond_broadcast(&pool->all_done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+// Stops and joins the first `num_started` workers, then frees the first `num_deques` deques
+// Also unwinds a thread_pool_init that failed part way
+static void thread_pool_release(ThreadPool *pool, int num_deques, int num_started)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < num_started; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (int i = 0; i < num_deques; i++)
+    {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].tasks);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_available);
+    pthread_cond_destroy(&pool->all_done);
+
+    free(pool->deques);
+    free(pool->threads);
+}
+
+int thread_pool_init(ThreadPool *pool, int num_threads)
+{
+    memset(pool, 0, sizeof(*pool));
+
+    if (num_threads < 1)
+    {
+        num_threads = 1;
+    }
+
+    pool->num_threads = num_threads;
+    pool->threads = malloc(num_threads * sizeof(pthread_t));
+    pool->deques = malloc(num_threads * sizeof(ThreadPoolDeque));
+    if (pool->threads == NULL || pool->deques == NULL)
+    {
+        free(pool->deques);
+        free(pool->threads);
+        return 1;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_available, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        // A failed deque still holds an initialized lock, so it is released with the others
+        if (deque_init(&pool->deques[i]) != 0)
+        {
+            thread_pool_release(pool, i + 1, 0);
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        WorkerArgs *args = malloc(sizeof(WorkerArgs));
+        if (args == NULL)
+        {
+            thread_pool_release(pool, num_threads, i);
+            return 1;
+        }
+        args->pool = pool;
+        args->index = i;
+
+        if (pthread_create(&pool->threads[i], NULL, worker_main, args) != 0)
+        {
+            free(args);
+            thread_pool_release(pool, num_threads, i);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Returns 1 if the task could not be queued (out of memory), it is then not run
+int thread_pool_submit(ThreadPool *pool, ThreadPoolTaskFn fn, void *arg)
+{
+    ThreadPoolTask task = {fn, arg};
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pending++;
+
+    // Tasks spawned by a worker stay local, others are spread round robin
+    int target;
+    if (worker_pool == pool)
+    {
+        target = worker_index;
+    }
+    else
+    {
+        target = pool->next_deque;
+        pool->next_deque = (pool->next_deque + 1) % pool->num_threads;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    // Push before announcing, so a claimed task always exists
+    int failed = deque_push_back(&pool->deques[target], task);
+
+    pthread_mutex_lock(&pool->lock);
+    if (failed)
+    {
+        pool->pending--;
+        if (pool->pending == 0)
+        {
+            pthread_cond_broadcast(&pool->all_done);
+        }
+    }
+    else
+    {
+        pool->queued++;
+        pthread_cond_signal(&pool->work_available);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return failed;
+}
+
+void thread_pool_wait(ThreadPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+    {
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_destroy(ThreadPool *pool)
+{
+    thread_pool_release(pool, pool->num_threads, pool->num_threads);
+}
+
+int thread_pool_num_cores(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
@@ -0,0 +1,55 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+typedef void (*ThreadPoolTaskFn)(void *arg);
+
+typedef struct
+{
+    ThreadPoolTaskFn fn;
+    void *arg;
+} ThreadPoolTask;
+
+// Per-worker double ended queue
+// The owner pushes and pops at the back, thieves take from the front
+typedef struct
+{
+    pthread_mutex_t lock;
+    ThreadPoolTask *tasks;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t capacity;
+} ThreadPoolDeque;
+
+typedef struct ThreadPool
+{
+    pthread_t *threads;
+    ThreadPoolDeque *deques;
+    int num_threads;
+
+    // Guards the counters below
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    pthread_cond_t all_done;
+
+    // Tasks sitting in a deque that no worker has claimed yet
+    uint32_t queued;
+
+    // Tasks submitted but not yet finished
+    uint32_t pending;
+
+    // Round robin target for tasks submitted from outside the pool
+    uint32_t next_deque;
+
+    int shutdown;
+} ThreadPool;
+
+int thread_pool_init(ThreadPool *pool, int num_threads);
+int thread_pool_submit(ThreadPool *pool, ThreadPoolTaskFn fn, void *arg);
+void thread_pool_wait(ThreadPool *pool);
+void thread_pool_destroy(ThreadPool *pool);
+int thread_pool_num_cores(void);
+
+#endif
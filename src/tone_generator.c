@@ -0,0 +1,156 @@
+#include "tone_generator.h"
+
+#define TONE_GENERATOR_FREQUENCY 440
+#define TONE_GENERATOR_AMPLITUDE 6000
+
+// Error beyond which the cursor snaps instead of following emulation at the normal rate
+#define TONE_GENERATOR_MAX_DRIFT 4
+
+/// ********************
+/// Emulation side     *
+/// ********************
+
+int tone_generator_init(ToneGenerator *generator, uint32_t sample_rate, uint32_t clock_frequency,
+                        uint32_t latency_samples)
+{
+    generator->sample_rate = sample_rate > 0 ? sample_rate : 1;
+    generator->clock_frequency = clock_frequency > 0 ? clock_frequency : 1;
+    generator->tone_frequency = TONE_GENERATOR_FREQUENCY;
+    generator->amplitude = TONE_GENERATOR_AMPLITUDE;
+    generator->latency_samples = latency_samples;
+
+    atomic_init(&generator->emulated_cycles, 0);
+    generator->cursor = 0;
+    generator->phase = 0;
+    generator->on = 0;
+    generator->waiting_start = 0;
+    generator->waiting_count = 0;
+    atomic_init(&generator->underruns, 0);
+    generator->last_emulated = 0;
+
+    return spsc_queue_init(&generator->events, sizeof(ToneEvent), TONE_GENERATOR_QUEUE_CAPACITY);
+}
+
+// Returns 1 if the queue is full, the caller should report the transition again later
+int tone_generator_push(ToneGenerator *generator, uint64_t cycle, int on)
+{
+    ToneEvent event = {cycle, (uint8_t)(on != 0)};
+
+    return spsc_queue_push(&generator->events, &event);
+}
+
+// Call after pushing the transitions up to `cycle`, audio is rendered up to there at most
+void tone_generator_advance(ToneGenerator *generator, uint64_t cycle)
+{
+    atomic_store_explicit(&generator->emulated_cycles, cycle, memory_order_release);
+}
+
+/// ********************
+/// Audio side         *
+/// ********************
+
+static void tone_generator_apply(ToneGenerator *generator, const ToneEvent *event)
+{
+    if (event->on && !generator->on)
+    {
+        generator->phase = 0;
+    }
+    generator->on = event->on;
+}
+
+// Moves the pushed transitions into the waiting list
+static void tone_generator_receive(ToneGenerator *generator)
+{
+    ToneEvent event;
+
+    while (spsc_queue_pop(&generator->events, &event) == 0)
+    {
+        if (generator->waiting_count > 0)
+        {
+            const ToneEvent *last = &generator->waiting[(generator->waiting_start + generator->waiting_count - 1) %
+                                                        TONE_GENERATOR_QUEUE_CAPACITY];
+
+            // Went back in time, what is still waiting will never happen
+            if (event.cycle < last->cycle)
+            {
+                generator->waiting_count = 0;
+            }
+        }
+
+        // Full: the oldest takes effect now
+        if (generator->waiting_count == TONE_GENERATOR_QUEUE_CAPACITY)
+        {
+            tone_generator_apply(generator, &generator->waiting[generator->waiting_start]);
+            generator->waiting_start = (generator->waiting_start + 1) % TONE_GENERATOR_QUEUE_CAPACITY;
+            generator->waiting_count--;
+        }
+
+        generator->waiting[(generator->waiting_start + generator->waiting_count) % TONE_GENERATOR_QUEUE_CAPACITY] =
+            event;
+        generator->waiting_count++;
+    }
+}
+
+void tone_generator_fill(ToneGenerator *generator, int16_t samples[], uint32_t count)
+{
+    uint64_t step = generator->clock_frequency;
+    uint64_t emulated = atomic_load_explicit(&generator->emulated_cycles, memory_order_acquire) * generator->sample_rate;
+    uint64_t lag = (uint64_t)generator->latency_samples * step;
+    uint64_t target = emulated > lag ? emulated - lag : 0;
+    uint64_t max_drift = TONE_GENERATOR_MAX_DRIFT * (lag + count * step);
+
+    if (generator->cursor + max_drift < target || generator->cursor > target + max_drift)
+    {
+        generator->cursor = target;
+    }
+
+    tone_generator_receive(generator);
+
+    int held = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        // Transitions due at or before this sample
+        while (generator->waiting_count > 0 &&
+               generator->waiting[generator->waiting_start].cycle * generator->sample_rate <= generator->cursor)
+        {
+            tone_generator_apply(generator, &generator->waiting[generator->waiting_start]);
+            generator->waiting_start = (generator->waiting_start + 1) % TONE_GENERATOR_QUEUE_CAPACITY;
+            generator->waiting_count--;
+        }
+
+        // Holds, silent, where emulation has not got to yet
+        if (generator->cursor + step > emulated)
+        {
+            samples[i] = 0;
+            held |= generator->on;
+            continue;
+        }
+        generator->cursor += step;
+
+        if (!generator->on)
+        {
+            samples[i] = 0;
+            continue;
+        }
+
+        samples[i] = generator->phase < generator->sample_rate / 2 ? generator->amplitude : -generator->amplitude;
+        generator->phase += generator->tone_frequency;
+        if (generator->phase >= generator->sample_rate)
+        {
+            generator->phase -= generator->sample_rate;
+        }
+    }
+
+    // Holding while emulation stands still is a pause, not an underrun, and holding silence is
+    // inaudible (the machine sleeps through whole frames while it waits for a key)
+    if (held && emulated != generator->last_emulated)
+    {
+        atomic_fetch_add_explicit(&generator->underruns, 1, memory_order_relaxed);
+    }
+    generator->last_emulated = emulated;
+}
+
+void tone_generator_free(ToneGenerator *generator)
+{
+    spsc_queue_free(&generator->events);
+}
@@ -0,0 +1,66 @@
+#ifndef TONE_GENERATOR_H
+#define TONE_GENERATOR_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "spsc_queue.h"
+
+// Square wave tone generator for the sound timer
+// The emulation thread pushes on/off transitions stamped with the emulated cycle they happened
+// at, and reports how far emulation has got. The audio thread renders samples on an emulated
+// time cursor that trails emulation by latency_samples, switching the tone exactly on the
+// sample a transition falls on. Both sides are lock-free.
+//
+// The cursor never runs past emulation (it holds, silent, while emulation is paused or
+// rewinding). When emulation jumps (turbo, rewind, a load or a stall) the cursor snaps back
+// to latency_samples behind it, transitions older than the cursor then apply at once.
+// A transition stamped earlier than the one before it means emulation went back in time,
+// the transitions still waiting from the abandoned timeline are dropped.
+
+enum
+{
+    TONE_GENERATOR_QUEUE_CAPACITY = 1024
+};
+
+typedef struct
+{
+    uint64_t cycle;
+    uint8_t on;
+} ToneEvent;
+
+typedef struct
+{
+    // Emulation thread -> audio thread
+    SpscQueue events;
+    atomic_ullong emulated_cycles;
+
+    uint32_t sample_rate;
+    uint32_t clock_frequency;
+    uint32_t tone_frequency;
+    int16_t amplitude;
+    uint32_t latency_samples;
+
+    // Audio thread only
+    uint64_t cursor; // Emulated time of the next sample, in 1 / sample_rate cycles
+    uint32_t phase;  // Position in the tone period, in 1 / sample_rate periods
+    int on;
+
+    // Transitions taken off the queue that are not due yet, oldest first
+    ToneEvent waiting[TONE_GENERATOR_QUEUE_CAPACITY];
+    uint32_t waiting_start;
+    uint32_t waiting_count;
+
+    // Callbacks that ran out of emulated time while emulation was advancing (not paused)
+    atomic_ullong underruns;
+    uint64_t last_emulated;
+} ToneGenerator;
+
+int tone_generator_init(ToneGenerator *generator, uint32_t sample_rate, uint32_t clock_frequency,
+                        uint32_t latency_samples);
+int tone_generator_push(ToneGenerator *generator, uint64_t cycle, int on);
+void tone_generator_advance(ToneGenerator *generator, uint64_t cycle);
+void tone_generator_fill(ToneGenerator *generator, int16_t samples[], uint32_t count);
+void tone_generator_free(ToneGenerator *generator);
+
+#endif
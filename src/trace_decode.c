@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8_trace.h"
+
+// Offline trace decoder
+// Turns a binary trace dump into the text chip8_debug_printf prints for each instruction.
+// Registers are the values after the instruction executed, except VF for DXYN, which is the
+// value it drew with, before the collision flag, like the CHIP8_DEBUG output.
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("Usage: trace_decode <trace_file> [-v]\n");
+        return 1;
+    }
+
+    // -v prefixes every instruction with its cycle number and fetch address
+    int verbose = (argc > 2 && strcmp(argv[2], "-v") == 0);
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL)
+    {
+        printf("Error: Could not open trace file '%s'. Exiting...\n", argv[1]);
+        return 1;
+    }
+
+    Chip8TraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, CHIP8_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CHIP8_TRACE_VERSION ||
+        header.record_size != sizeof(Chip8TraceRecord))
+    {
+        printf("Error: '%s' is not a supported trace file. Exiting...\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+
+    Chip8TraceRecord record;
+    char text[512];
+    uint32_t decoded = 0;
+
+    while (decoded < header.count && fread(&record, sizeof(record), 1, file) == 1)
+    {
+        if (verbose)
+        {
+            printf("[%llu] %03X: %04X\n", (unsigned long long)record.cycle, record.address, record.opcode);
+        }
+
+        chip8_trace_format(&record, header.quirks, text, sizeof(text));
+        fputs(text, stdout);
+        decoded++;
+    }
+
+    fclose(file);
+
+    if (decoded != header.count)
+    {
+        printf("Error: Trace file truncated, %u of %u records decoded.\n", decoded, header.count);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include "triple_buffer.h"
+
+/// ********************
+/// Buffer functions   *
+/// ********************
+
+void triple_buffer_init(TripleBuffer *buffer, void *slot0, void *slot1, void *slot2)
+{
+    buffer->slots[0] = slot0;
+    buffer->slots[1] = slot1;
+    buffer->slots[2] = slot2;
+    buffer->back = 0;
+    atomic_init(&buffer->middle, 1);
+    buffer->front = 2;
+}
+
+// Writer side, the buffer to fill next
+void *triple_buffer_back(TripleBuffer *buffer)
+{
+    return buffer->slots[buffer->back];
+}
+
+// Writer side, makes the back buffer the newest frame
+void triple_buffer_publish(TripleBuffer *buffer)
+{
+    // Release: the reader must see the contents written to the slot before its index
+    unsigned previous = atomic_exchange_explicit(&buffer->middle, buffer->back | TRIPLE_BUFFER_FRESH,
+                                                 memory_order_acq_rel);
+    buffer->back = previous & ~TRIPLE_BUFFER_FRESH;
+}
+
+// Reader side, the newest published frame (the front buffer again if nothing new)
+// fresh is set if it was published since the previous read
+const void *triple_buffer_read(TripleBuffer *buffer, int *fresh)
+{
+    *fresh = (atomic_load_explicit(&buffer->middle, memory_order_relaxed) & TRIPLE_BUFFER_FRESH) != 0;
+
+    if (*fresh)
+    {
+        // Acquire: pairs with the release in triple_buffer_publish
+        unsigned previous = atomic_exchange_explicit(&buffer->middle, buffer->front, memory_order_acq_rel);
+        buffer->front = previous & ~TRIPLE_BUFFER_FRESH;
+    }
+
+    return buffer->slots[buffer->front];
+}
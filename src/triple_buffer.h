@@ -0,0 +1,32 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Lock-free triple buffer, one writer and one reader
+// The writer always has a back buffer to fill and the reader a front buffer to read, neither
+// ever waits. Publishing swaps the back buffer with the middle one; reading swaps the middle
+// one with the front buffer, only if something new was published since. Frames the reader
+// did not get to in time are simply overwritten, the reader always sees the newest one.
+
+#define TRIPLE_BUFFER_FRESH 0x4
+
+typedef struct
+{
+    void *slots[3];
+
+    // Index of the middle slot, with TRIPLE_BUFFER_FRESH set while it holds an unread publish
+    atomic_uint middle;
+
+    // Owned by the writer and the reader respectively
+    uint32_t back;
+    uint32_t front;
+} TripleBuffer;
+
+void triple_buffer_init(TripleBuffer *buffer, void *slot0, void *slot1, void *slot2);
+void *triple_buffer_back(TripleBuffer *buffer);
+void triple_buffer_publish(TripleBuffer *buffer);
+const void *triple_buffer_read(TripleBuffer *buffer, int *fresh);
+
+#endif